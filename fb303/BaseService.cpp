@@ -22,7 +22,20 @@ THRIFT_FLAG_DEFINE_int64(fb303_counters_queue_timeout_ms, 5 * 1000);
 
 namespace facebook::fb303 {
 
-BaseService::~BaseService() = default;
+namespace {
+constexpr std::string_view kGetCountersQueueDepthKey{
+    "fb303.get_counters_executor.queue_depth"};
+constexpr std::string_view kGetCountersRejectsKey{
+    "fb303.get_counters_executor.rejects"};
+} // namespace
+
+BaseService::~BaseService() {
+  if (selfStatsExported_) {
+    auto* dynamicCounters = ServiceData::get()->getDynamicCounters();
+    dynamicCounters->unregisterCallback(kGetCountersQueueDepthKey);
+    dynamicCounters->unregisterCallback(kGetCountersRejectsKey);
+  }
+}
 
 std::chrono::milliseconds BaseService::getCountersExpiration() const {
   return getCountersExpiration_
@@ -30,4 +43,18 @@ std::chrono::milliseconds BaseService::getCountersExpiration() const {
       : std::chrono::milliseconds(THRIFT_FLAG(fb303_counters_queue_timeout_ms));
 }
 
+void BaseService::exportSelfStats() {
+  auto* serviceData = ServiceData::get();
+  serviceData->exportSelfStats();
+
+  auto* dynamicCounters = serviceData->getDynamicCounters();
+  dynamicCounters->registerCallback(kGetCountersQueueDepthKey, [this] {
+    return static_cast<int64_t>(getCountersExecutor_.getPendingTaskCount());
+  });
+  dynamicCounters->registerCallback(kGetCountersRejectsKey, [this] {
+    return static_cast<int64_t>(getCountersRejects_);
+  });
+  selfStatsExported_ = true;
+}
+
 } // namespace facebook::fb303
@@ -23,6 +23,7 @@
 #include <fb303/thrift/gen-cpp2/BaseService.h>
 #include <folly/executors/CPUThreadPoolExecutor.h>
 #include <folly/small_vector.h>
+#include <folly/synchronization/RelaxedAtomic.h>
 
 namespace facebook {
 namespace fb303 {
@@ -171,6 +172,7 @@ class BaseService : virtual public cpp2::BaseServiceSvIf {
          keepAlive = folly::getKeepAliveToken(getCountersExecutor_)]() {
           if (auto expiration = getCountersExpiration();
               expiration.count() > 0 && clock::now() - start > expiration) {
+            getCountersRejects_ += 1;
             using Exn = apache::thrift::TApplicationException;
             callback_->exception(
                 folly::make_exception_wrapper<Exn>(
@@ -212,6 +214,7 @@ class BaseService : virtual public cpp2::BaseServiceSvIf {
          keepAlive = folly::getKeepAliveToken(getCountersExecutor_)]() mutable {
           if (auto expiration = getCountersExpiration();
               expiration.count() > 0 && clock::now() - start > expiration) {
+            getCountersRejects_ += 1;
             using Exn = apache::thrift::TApplicationException;
             callback_->exception(
                 folly::make_exception_wrapper<Exn>(
@@ -254,6 +257,7 @@ class BaseService : virtual public cpp2::BaseServiceSvIf {
          keepAlive = folly::getKeepAliveToken(getCountersExecutor_)]() mutable {
           if (auto expiration = getCountersExpiration();
               expiration.count() > 0 && clock::now() - start > expiration) {
+            getCountersRejects_ += 1;
             using Exn = apache::thrift::TApplicationException;
             callback_->exception(
                 folly::make_exception_wrapper<Exn>(
@@ -289,11 +293,21 @@ class BaseService : virtual public cpp2::BaseServiceSvIf {
 
   std::chrono::milliseconds getCountersExpiration() const;
 
+  /**
+   * Calls ServiceData::exportSelfStats(), and also exports the queue depth
+   * and the cumulative number of requests rejected as expired of the executor
+   * serving getCounters(), getRegexCounters() and getSelectedCounters(), as
+   * "fb303.get_counters_executor.{queue_depth,rejects}".
+   */
+  void exportSelfStats();
+
  private:
   folly::CPUThreadPoolExecutor getCountersExecutor_{
       2,
       std::make_shared<folly::NamedThreadFactory>("GetCountersCPU")};
   std::optional<std::chrono::milliseconds> getCountersExpiration_;
+  folly::relaxed_atomic<uint64_t> getCountersRejects_{0};
+  bool selfStatsExported_{false};
 };
 
 } // namespace fb303
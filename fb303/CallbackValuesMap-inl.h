@@ -16,10 +16,14 @@
 
 #pragma once
 
+#include <algorithm>
 #include <bit>
+#include <utility>
+#include <vector>
 
 #include <fb303/detail/RegexUtil.h>
 #include <folly/MapUtil.h>
+#include <folly/container/F14Map.h>
 #include <folly/container/Reserve.h>
 #include <glog/logging.h>
 
@@ -29,7 +33,14 @@ namespace fb303 {
 template <typename T>
 void CallbackValuesMap<T>::getValues(ValuesMap* output) const {
   CHECK(output);
+  forEachValue([&](const std::string& name, T&& value) {
+    (*output)[name] = std::move(value);
+  });
+}
 
+template <typename T>
+void CallbackValuesMap<T>::forEachValue(
+    folly::FunctionRef<void(const std::string&, T&&)> fn) const {
   // if callbacks were to be invoked under the lock, that could deadlock
   // so copy under the shared lock and invoke after the lock is released
   std::vector<std::shared_ptr<CallbackEntry>> mapCopy;
@@ -47,7 +58,7 @@ void CallbackValuesMap<T>::getValues(ValuesMap* output) const {
     T result;
     // if the entry was unregistered underneath, getValue returns false
     if (it->getValue(&result)) {
-      (*output)[it->name()] = std::move(result);
+      fn(it->name(), std::move(result));
     }
   }
 }
@@ -112,6 +123,68 @@ void CallbackValuesMap<T>::registerCallback(
   }
   auto inserted = detail::cachedAddString(*wlock, std::move(entry)).second;
   DCHECK(inserted);
+  numRegistrations_ += 1;
+}
+
+template <typename T>
+void CallbackValuesMap<T>::registerCallbacks(
+    std::vector<std::pair<std::string, Callback>> callbacks,
+    bool overwrite) {
+  // resolve duplicate names up front, so that each name is looked up and
+  // added to the regex-match-cache at most once under the lock
+  std::vector<bool> keep(callbacks.size());
+  {
+    folly::F14FastMap<folly::StringPiece, size_t> indices;
+    indices.reserve(callbacks.size());
+    for (size_t i = 0; i < callbacks.size(); ++i) {
+      auto [iter, inserted] = indices.try_emplace(callbacks[i].first, i);
+      if (!inserted && overwrite) {
+        keep[iter->second] = false;
+        iter->second = i;
+        inserted = true;
+      }
+      keep[i] = inserted;
+    }
+  }
+  std::vector<typename CallbackMap::SPtr> entries;
+  entries.reserve(callbacks.size());
+  for (size_t i = 0; i < callbacks.size(); ++i) {
+    if (keep[i]) {
+      entries.push_back(std::make_shared<CallbackEntry>(
+          std::move(callbacks[i].first), std::move(callbacks[i].second)));
+    }
+  }
+
+  auto wlock = callbackMap_.wlock();
+  if (!overwrite) {
+    entries.erase(
+        std::remove_if(
+            entries.begin(),
+            entries.end(),
+            [&](auto const& entry) {
+              auto const& map = wlock->map;
+              return map.find(folly::StringPiece(entry->name())) != map.end();
+            }),
+        entries.end());
+  }
+  // Do all the fallible work before touching the map, so that a failure
+  // leaves the existing callbacks registered.
+  std::vector<detail::DeferredRegexMatchCache::string_pointer> added;
+  added.reserve(entries.size());
+  for (auto const& entry : entries) {
+    added.push_back(&entry->name());
+  }
+  folly::grow_capacity_by(wlock->map, entries.size());
+  wlock->matches.addStrings(folly::range(added));
+  for (auto& entry : entries) {
+    auto iter = wlock->map.find(folly::StringPiece(entry->name()));
+    if (iter != wlock->map.end()) {
+      // Cannot replace an entry in a set, we need to remove it first.
+      detail::cachedEraseString(*wlock, iter);
+    }
+    wlock->map.insert(std::move(entry));
+  }
+  numRegistrations_ += added.size();
 }
 
 template <typename T>
@@ -146,6 +219,11 @@ void CallbackValuesMap<T>::trimRegexCache(
   detail::cachedTrimStale(callbackMap_, expiry);
 }
 
+template <typename T>
+detail::RegexMatchCacheStats CallbackValuesMap<T>::getRegexCacheStats() const {
+  return detail::cachedGetStats(callbackMap_);
+}
+
 template <typename T>
 std::shared_ptr<typename CallbackValuesMap<T>::CallbackEntry>
 CallbackValuesMap<T>::getCallback(folly::StringPiece name) const {
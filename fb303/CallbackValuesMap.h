@@ -20,7 +20,10 @@
 #include <map>
 #include <string>
 
+#include <fb303/detail/LockProfile.h>
+#include <fb303/detail/RegexUtil.h>
 #include <folly/Chrono.h>
+#include <folly/Function.h>
 #include <folly/Range.h>
 #include <folly/Synchronized.h>
 #include <folly/container/F14Set.h>
@@ -45,6 +48,14 @@ class CallbackValuesMap {
   /** Returns all the values in the map by invoking all the callbacks */
   void getValues(ValuesMap* output) const;
 
+  /**
+   * Invokes all the callbacks and passes each name and value to fn, in no
+   * particular order, without collecting them into a map. Neither the
+   * callbacks nor fn are invoked under the lock.
+   */
+  void forEachValue(
+      folly::FunctionRef<void(const std::string&, T&&)> fn) const;
+
   /**
    * If the name is present, invokes the callback and places the result
    * in 'output' and returns true; returns false otherwise.
@@ -83,6 +94,17 @@ class CallbackValuesMap {
       Callback cob,
       bool overwrite = true);
 
+  /**
+   * Registers each of the given (name, callback) pairs as-if by
+   * registerCallback(), but under a single acquisition of the lock and with a
+   * single update of the regex-match-cache. Meant for registering many
+   * callbacks at once, e.g. at startup. If a name occurs several times, the
+   * last occurrence wins when overwrite = true, and the first otherwise.
+   */
+  void registerCallbacks(
+      std::vector<std::pair<std::string, Callback>> callbacks,
+      bool overwrite = true);
+
   /**
    * Unregisters the callback asssociated with the given name.
    *
@@ -99,6 +121,16 @@ class CallbackValuesMap {
 
   void trimRegexCache(folly::RegexMatchCache::time_point expiry);
 
+  detail::RegexMatchCacheStats getRegexCacheStats() const;
+
+  /**
+   * Returns the number of callbacks registered by registerCallback() and
+   * registerCallbacks(), including those replacing an existing one.
+   */
+  uint64_t getNumRegistrations() const {
+    return numRegistrations_;
+  }
+
   class CallbackEntry {
    public:
     CallbackEntry(std::string&& name, Callback&& callback);
@@ -168,10 +200,14 @@ class CallbackValuesMap {
     // CallbackEntry, so they are stable regardless of map type.
     // Use a vector-set to optimize for iteration in getValues().
     folly::F14VectorSet<SPtr, Hash, EqualTo> map;
-    folly::RegexMatchCache matches;
+    detail::DeferredRegexMatchCache matches;
   };
 
-  folly::Synchronized<CallbackMap> callbackMap_;
+  folly::Synchronized<
+      CallbackMap,
+      detail::ProfiledSharedMutex<detail::LockSite::kCallbackMap>>
+      callbackMap_;
+  folly::relaxed_atomic<uint64_t> numRegistrations_{0};
 };
 
 } // namespace fb303
@@ -0,0 +1,359 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fb303/CounterSnapshotWriter.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <filesystem>
+#include <stdexcept>
+#include <utility>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <fmt/core.h>
+#include <folly/Exception.h>
+#include <folly/FileUtil.h>
+#include <folly/ScopeGuard.h>
+#include <folly/Varint.h>
+#include <glog/logging.h>
+
+namespace facebook::fb303 {
+
+namespace {
+
+constexpr char kMagic[] = {'F', 'B', 'C', 'S'};
+constexpr uint8_t kVersion = 1;
+constexpr size_t kHeaderSize = sizeof(kMagic) + 1;
+constexpr uint8_t kDictionaryRecord = 1;
+constexpr uint8_t kSnapshotRecord = 2;
+
+void putVarint(std::string& out, uint64_t value) {
+  uint8_t buf[folly::kMaxVarintLength64];
+  auto const size = folly::encodeVarint(value, buf);
+  out.append(reinterpret_cast<const char*>(buf), size);
+}
+
+// Deltas wrap around, so that any pair of int64 values round-trips.
+int64_t delta(int64_t value, int64_t base) {
+  return int64_t(uint64_t(value) - uint64_t(base));
+}
+
+int64_t undelta(int64_t delta, int64_t base) {
+  return int64_t(uint64_t(base) + uint64_t(delta));
+}
+
+std::string getPath(const std::string& pathPrefix, uint64_t index) {
+  return fmt::format("{}.{}", pathPrefix, index);
+}
+
+std::vector<std::pair<uint64_t, std::string>> listIndexedFiles(
+    const std::string& pathPrefix) {
+  namespace fs = std::filesystem;
+  const fs::path prefix(pathPrefix);
+  const auto dir = prefix.has_parent_path() ? prefix.parent_path()
+                                            : fs::path(".");
+  const auto base = prefix.filename().string() + ".";
+
+  std::vector<std::pair<uint64_t, std::string>> files;
+  std::error_code ec;
+  for (const auto& entry : fs::directory_iterator(dir, ec)) {
+    const auto name = entry.path().filename().string();
+    if (name.size() <= base.size() || name.compare(0, base.size(), base)) {
+      continue;
+    }
+    const auto suffix = std::string_view(name).substr(base.size());
+    if (!std::all_of(suffix.begin(), suffix.end(), [](char c) {
+          return c >= '0' && c <= '9';
+        })) {
+      continue;
+    }
+    files.emplace_back(std::stoull(std::string(suffix)), entry.path().string());
+  }
+  std::sort(files.begin(), files.end());
+  return files;
+}
+
+[[noreturn]] void throwMalformed(const std::string& path) {
+  throw std::runtime_error(
+      fmt::format("malformed counter snapshots: {}", path));
+}
+
+} // namespace
+
+CounterSnapshotWriter::CounterSnapshotWriter(
+    ServiceData& serviceData,
+    Options options)
+    : serviceData_(serviceData), options_(std::move(options)) {
+  CHECK(!options_.pathPrefix.empty());
+  CHECK_GT(options_.maxFiles, 0);
+  auto const files = listIndexedFiles(options_.pathPrefix);
+  if (!files.empty()) {
+    fileIndex_ = files.back().first + 1;
+  }
+}
+
+CounterSnapshotWriter::~CounterSnapshotWriter() {
+  stop();
+  if (fd_ >= 0) {
+    ::close(fd_);
+  }
+}
+
+void CounterSnapshotWriter::start() {
+  if (started_) {
+    return;
+  }
+  scheduler_.addFunction(
+      [this] {
+        try {
+          writeSnapshot();
+        } catch (const std::exception& ex) {
+          LOG(ERROR) << "Failed to write counter snapshot: " << ex.what();
+        }
+      },
+      options_.interval,
+      "fb303-snapshot");
+  scheduler_.setThreadName("fb303-snapshot");
+  started_ = scheduler_.start();
+  DCHECK(started_);
+}
+
+void CounterSnapshotWriter::stop() {
+  if (started_) {
+    scheduler_.shutdown();
+    started_ = false;
+  }
+}
+
+void CounterSnapshotWriter::openNextFile() {
+  if (fd_ >= 0) {
+    ::close(fd_);
+    fd_ = -1;
+  }
+  ids_.clear();
+  lastValues_.clear();
+  lastTimeMs_ = 0;
+
+  auto const path = getPath(options_.pathPrefix, fileIndex_++);
+  auto const fd = folly::openNoInt(
+      path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  folly::checkUnixError(fd, "CounterSnapshotWriter: cannot open ", path);
+
+  // Only keep the file once it has its header, so that a failure here makes
+  // the next snapshot open a new one.
+  std::string header(kMagic, sizeof(kMagic));
+  header += char(kVersion);
+  if (folly::writeFull(fd, header.data(), header.size()) < 0) {
+    auto const err = errno;
+    ::close(fd);
+    folly::throwSystemErrorExplicit(
+        err, "CounterSnapshotWriter: cannot write ", path);
+  }
+  fd_ = fd;
+  fileBytes_ = header.size();
+
+  auto files = listIndexedFiles(options_.pathPrefix);
+  for (size_t i = 0; i + options_.maxFiles < files.size(); ++i) {
+    std::error_code ec;
+    std::filesystem::remove(files[i].second, ec);
+  }
+}
+
+void CounterSnapshotWriter::writeRecord(
+    uint8_t type,
+    const std::string& payload) {
+  std::string record;
+  record.reserve(payload.size() + 1 + folly::kMaxVarintLength64);
+  record += char(type);
+  putVarint(record, payload.size());
+  record += payload;
+  folly::checkUnixError(
+      folly::writeFull(fd_, record.data(), record.size()),
+      "CounterSnapshotWriter: write failed");
+  fileBytes_ += record.size();
+}
+
+void CounterSnapshotWriter::writeSnapshot() {
+  std::unique_lock lock(mutex_);
+  if (fd_ < 0 || fileBytes_ >= options_.maxFileBytes) {
+    openNextFile();
+  }
+  // A failed write leaves the file inconsistent with ids_ and lastValues_, so
+  // the next snapshot starts a new file.
+  auto failGuard = folly::makeGuard([&] {
+    ::close(fd_);
+    fd_ = -1;
+  });
+
+  // Only look the names up while the counters are visited, and do the rest
+  // once their locks are released.
+  std::vector<std::string> newNames;
+  std::vector<std::pair<uint32_t, int64_t>> values;
+  serviceData_.forEachCounterValue([&](const std::string& name, int64_t value) {
+    auto const [iter, inserted] =
+        ids_.try_emplace(name, static_cast<uint32_t>(ids_.size()));
+    if (inserted) {
+      newNames.push_back(name);
+    }
+    values.emplace_back(iter->second, value);
+  });
+  auto const nowMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                         std::chrono::system_clock::now().time_since_epoch())
+                         .count();
+
+  std::string payload;
+  if (!newNames.empty()) {
+    putVarint(payload, newNames.size());
+    for (const auto& name : newNames) {
+      putVarint(payload, name.size());
+      payload += name;
+    }
+    writeRecord(kDictionaryRecord, payload);
+  }
+
+  auto const numIds = ids_.size();
+  lastValues_.resize(numIds, 0);
+  std::string present((numIds + 7) / 8, '\0');
+  auto current = lastValues_;
+  for (const auto& [id, value] : values) {
+    present[id / 8] |= char(1 << (id % 8));
+    current[id] = value;
+  }
+
+  payload.clear();
+  putVarint(payload, folly::encodeZigZag(delta(nowMs, lastTimeMs_)));
+  putVarint(payload, numIds);
+  payload += present;
+  for (size_t id = 0; id < numIds; ++id) {
+    if (present[id / 8] & (1 << (id % 8))) {
+      putVarint(
+          payload, folly::encodeZigZag(delta(current[id], lastValues_[id])));
+    }
+  }
+  writeRecord(kSnapshotRecord, payload);
+
+  failGuard.dismiss();
+  lastValues_ = std::move(current);
+  lastTimeMs_ = nowMs;
+  numSnapshots_ += 1;
+}
+
+/* static */
+std::vector<CounterSnapshotReader::Snapshot> CounterSnapshotReader::readFile(
+    const std::string& path) {
+  std::string data;
+  if (!folly::readFile(path.c_str(), data)) {
+    throw std::runtime_error(fmt::format("cannot read {}", path));
+  }
+  folly::ByteRange in(folly::StringPiece(data));
+  if (in.size() < kHeaderSize ||
+      !std::equal(std::begin(kMagic), std::end(kMagic), in.begin()) ||
+      in[sizeof(kMagic)] != kVersion) {
+    throwMalformed(path);
+  }
+  in.advance(kHeaderSize);
+
+  auto const getVarint = [&](folly::ByteRange& range) {
+    auto const value = folly::tryDecodeVarint(range);
+    if (!value) {
+      throwMalformed(path);
+    }
+    return *value;
+  };
+
+  std::vector<Snapshot> snapshots;
+  std::vector<std::string> names;
+  std::vector<int64_t> lastValues;
+  int64_t lastTimeMs = 0;
+  while (!in.empty()) {
+    auto const type = in.front();
+    in.advance(1);
+    auto const size = folly::tryDecodeVarint(in);
+    if (!size || *size > in.size()) {
+      break; // truncated by a crash
+    }
+    auto record = in.subpiece(0, *size);
+    in.advance(*size);
+
+    if (type == kDictionaryRecord) {
+      auto const count = getVarint(record);
+      for (uint64_t i = 0; i < count; ++i) {
+        auto const nameSize = getVarint(record);
+        if (nameSize > record.size()) {
+          throwMalformed(path);
+        }
+        names.emplace_back(
+            reinterpret_cast<const char*>(record.data()), nameSize);
+        record.advance(nameSize);
+      }
+    } else if (type == kSnapshotRecord) {
+      lastTimeMs = undelta(folly::decodeZigZag(getVarint(record)), lastTimeMs);
+      auto const numIds = getVarint(record);
+      auto const bitmapSize = (numIds + 7) / 8;
+      if (numIds > names.size() || bitmapSize > record.size()) {
+        throwMalformed(path);
+      }
+      auto const present = record.subpiece(0, bitmapSize);
+      record.advance(bitmapSize);
+      lastValues.resize(numIds, 0);
+
+      auto& snapshot = snapshots.emplace_back();
+      snapshot.time = std::chrono::system_clock::time_point(
+          std::chrono::milliseconds(lastTimeMs));
+      for (size_t id = 0; id < numIds; ++id) {
+        if (present[id / 8] & (1 << (id % 8))) {
+          lastValues[id] = undelta(
+              folly::decodeZigZag(getVarint(record)), lastValues[id]);
+          snapshot.counters.emplace(names[id], lastValues[id]);
+        }
+      }
+    } else {
+      throwMalformed(path);
+    }
+    if (!record.empty()) {
+      throwMalformed(path);
+    }
+  }
+  return snapshots;
+}
+
+/* static */
+std::vector<CounterSnapshotReader::Snapshot> CounterSnapshotReader::read(
+    const std::string& pathPrefix) {
+  std::vector<Snapshot> snapshots;
+  for (const auto& path : listFiles(pathPrefix)) {
+    auto fileSnapshots = readFile(path);
+    std::move(
+        fileSnapshots.begin(),
+        fileSnapshots.end(),
+        std::back_inserter(snapshots));
+  }
+  return snapshots;
+}
+
+/* static */
+std::vector<std::string> CounterSnapshotReader::listFiles(
+    const std::string& pathPrefix) {
+  std::vector<std::string> paths;
+  for (auto& [_, path] : listIndexedFiles(pathPrefix)) {
+    paths.push_back(std::move(path));
+  }
+  return paths;
+}
+
+} // namespace facebook::fb303
@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <fb303/ServiceData.h>
+#include <folly/container/F14Map.h>
+#include <folly/experimental/FunctionScheduler.h>
+#include <folly/synchronization/RelaxedAtomic.h>
+
+namespace facebook::fb303 {
+
+/**
+ * Periodically appends all the counters of a ServiceData, i.e. what
+ * getCounters() returns, to compact files on local disk, so that the last
+ * minutes of counters are available for post-mortem analysis without an
+ * external scraper. CounterSnapshotReader reads the files back.
+ *
+ * The files are named <pathPrefix>.<n>, with n increasing. Once the current
+ * file reaches Options::maxFileBytes, the next snapshot starts a new file and
+ * the oldest files beyond Options::maxFiles are deleted, which bounds the disk
+ * space used to about maxFileBytes * maxFiles.
+ *
+ * Each file is self-contained: a header, then records which are either
+ *  - a dictionary record, assigning the next ids to the counter names first
+ *    seen by the following snapshot, so each name is written once per file;
+ *  - or a snapshot record: the time, then a column of values indexed by
+ *    dictionary id, with a presence bitmap for the counters missing from the
+ *    snapshot, each value being delta-encoded against the same counter's
+ *    value in the previous snapshot of the file, as a zigzag varint.
+ * Since most counters change little or not at all between snapshots, most
+ * values take one byte.
+ *
+ * The counters are collected under their locks, but encoded and written
+ * after the locks are released.
+ */
+class CounterSnapshotWriter {
+ public:
+  struct Options {
+    std::string pathPrefix;
+    std::chrono::milliseconds interval{std::chrono::seconds(10)};
+    size_t maxFileBytes = 16 << 20;
+    size_t maxFiles = 4;
+  };
+
+  /**
+   * Files left by a previous writer with the same path prefix are kept, and
+   * count towards Options::maxFiles. Does not write until start() or
+   * writeSnapshot() is called.
+   */
+  CounterSnapshotWriter(ServiceData& serviceData, Options options);
+  ~CounterSnapshotWriter();
+
+  CounterSnapshotWriter(const CounterSnapshotWriter&) = delete;
+  CounterSnapshotWriter& operator=(const CounterSnapshotWriter&) = delete;
+
+  /** Starts writing a snapshot every Options::interval in the background. */
+  void start();
+
+  /** Stops the background snapshots, if started. */
+  void stop();
+
+  /**
+   * Writes a snapshot now, from the calling thread. Throws std::system_error
+   * if the file cannot be written. The background snapshots log such errors
+   * instead.
+   */
+  void writeSnapshot();
+
+  uint64_t getNumSnapshots() const {
+    return numSnapshots_;
+  }
+
+ private:
+  void openNextFile();
+  void writeRecord(uint8_t type, const std::string& payload);
+
+  ServiceData& serviceData_;
+  const Options options_;
+
+  // guards the state of the current file
+  std::mutex mutex_;
+  int fd_{-1};
+  uint64_t fileIndex_{0};
+  size_t fileBytes_{0};
+  folly::F14FastMap<std::string, uint32_t> ids_;
+  std::vector<int64_t> lastValues_;
+  int64_t lastTimeMs_{0};
+
+  folly::relaxed_atomic<uint64_t> numSnapshots_{0};
+  folly::FunctionScheduler scheduler_;
+  bool started_{false};
+};
+
+/** Reads the files written by CounterSnapshotWriter. */
+class CounterSnapshotReader {
+ public:
+  struct Snapshot {
+    std::chrono::system_clock::time_point time;
+    std::map<std::string, int64_t> counters;
+  };
+
+  /**
+   * Reads the snapshots of one file, in order. Throws std::runtime_error if the
+   * file is malformed, except for a truncated last record, which is ignored
+   * since the writer may have been killed in the middle of it.
+   */
+  static std::vector<Snapshot> readFile(const std::string& path);
+
+  /** Reads the snapshots of all the files with the given prefix, in order. */
+  static std::vector<Snapshot> read(const std::string& pathPrefix);
+
+  /** Returns the files with the given prefix, oldest first. */
+  static std::vector<std::string> listFiles(const std::string& pathPrefix);
+};
+
+} // namespace facebook::fb303
@@ -0,0 +1,274 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fb303/DatagramPushExporter.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <iterator>
+
+#include <unistd.h>
+
+#include <folly/Exception.h>
+#include <folly/String.h>
+#include <folly/Varint.h>
+#include <glog/logging.h>
+
+namespace facebook::fb303 {
+
+namespace {
+
+constexpr char kMagic[] = {'F', 'B', 'P', 'C'};
+constexpr uint8_t kVersion = 1;
+constexpr uint8_t kFlagFull = 1;
+constexpr size_t kMaxCountersPerPacket = 0xffff;
+constexpr size_t kCountersPerBatch = 4096;
+
+void putLittleEndian(std::string& out, size_t offset, uint64_t value, int n) {
+  for (int i = 0; i < n; ++i) {
+    out[offset + i] = char(value >> (8 * i));
+  }
+}
+
+uint64_t getLittleEndian(folly::ByteRange in, size_t offset, int n) {
+  uint64_t value = 0;
+  for (int i = 0; i < n; ++i) {
+    value |= uint64_t(in[offset + i]) << (8 * i);
+  }
+  return value;
+}
+
+void putVarint(std::string& out, uint64_t value) {
+  uint8_t buf[folly::kMaxVarintLength64];
+  auto const size = folly::encodeVarint(value, buf);
+  out.append(reinterpret_cast<const char*>(buf), size);
+}
+
+void startPacket(std::string& packet, uint64_t sequence, bool full) {
+  packet.assign(DatagramPushExporter::kHeaderSize, '\0');
+  packet.replace(0, sizeof(kMagic), kMagic, sizeof(kMagic));
+  packet[4] = char(kVersion);
+  packet[5] = char(full ? kFlagFull : 0);
+  putLittleEndian(packet, 8, sequence, 8);
+}
+
+} // namespace
+
+DatagramPushExporter::DatagramPushExporter(
+    ServiceData& serviceData,
+    const folly::SocketAddress& destination,
+    Options options)
+    : serviceData_(serviceData),
+      options_(options),
+      statNames_{
+          "fb303.push.pushes",
+          "fb303.push.packets_sent",
+          "fb303.push.counters_sent",
+          "fb303.push.packets_dropped",
+          "fb303.push.counters_dropped",
+      } {
+  CHECK_GT(options_.maxPacketSize, kHeaderSize);
+  destinationLen_ = destination.getAddress(&destination_);
+  fd_ = ::socket(
+      destination.getFamily(), SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  folly::checkUnixError(fd_, "DatagramPushExporter: socket() failed");
+
+  auto* counters = serviceData_.getDynamicCounters();
+  counters->registerCallback(statNames_[0], [this] { return pushes_.load(); });
+  counters->registerCallback(
+      statNames_[1], [this] { return packetsSent_.load(); });
+  counters->registerCallback(
+      statNames_[2], [this] { return countersSent_.load(); });
+  counters->registerCallback(
+      statNames_[3], [this] { return packetsDropped_.load(); });
+  counters->registerCallback(
+      statNames_[4], [this] { return countersDropped_.load(); });
+}
+
+DatagramPushExporter::~DatagramPushExporter() {
+  stop();
+  for (auto const& name : statNames_) {
+    serviceData_.getDynamicCounters()->unregisterCallback(name);
+  }
+  ::close(fd_);
+}
+
+void DatagramPushExporter::start() {
+  if (started_) {
+    return;
+  }
+  scheduler_.addFunction([this] { push(); }, options_.interval, "fb303-push");
+  scheduler_.setThreadName("fb303-push");
+  started_ = scheduler_.start();
+  DCHECK(started_);
+}
+
+void DatagramPushExporter::stop() {
+  if (started_) {
+    scheduler_.shutdown();
+    started_ = false;
+  }
+}
+
+void DatagramPushExporter::push() {
+  std::unique_lock lock(pushMutex_);
+  auto const sequence = sequence_++;
+  auto const full = sequence == 0 ||
+      (options_.fullPushInterval && sequence % options_.fullPushInterval == 0);
+  Changed changed;
+  collect(changed, full);
+  send(changed, sequence, full);
+  pushes_ += 1;
+}
+
+void DatagramPushExporter::collect(Changed& changed, bool full) {
+  // The datagrams are sent after the traversal, without any lock held.
+  if (full) {
+    // A full push sends everything, so rebuild lastPushed_ from the counters
+    // visited; this drops the counters removed from the ServiceData.
+    folly::F14FastMap<std::string, int64_t> visited;
+    visited.reserve(lastPushed_.size());
+    serviceData_.forEachCounterValue(
+        [&](const std::string& name, int64_t value) {
+          visited.insert_or_assign(name, value);
+          changed.emplace_back(name, value);
+        },
+        kCountersPerBatch);
+    lastPushed_.swap(visited);
+    return;
+  }
+
+  serviceData_.forEachCounterValue(
+      [&](const std::string& name, int64_t value) {
+        auto [iter, inserted] = lastPushed_.try_emplace(name, value);
+        if (inserted || iter->second != value) {
+          iter->second = value;
+          changed.emplace_back(name, value);
+        }
+      },
+      kCountersPerBatch);
+}
+
+void DatagramPushExporter::send(
+    Changed const& changed,
+    uint64_t sequence,
+    bool full) {
+  std::string packet;
+  packet.reserve(options_.maxPacketSize);
+  startPacket(packet, sequence, full);
+  size_t begin = 0;
+  std::string entry;
+  for (size_t i = 0; i < changed.size(); ++i) {
+    auto const& [name, value] = changed[i];
+    entry.clear();
+    putVarint(entry, name.size());
+    entry += name;
+    putVarint(entry, folly::encodeZigZag(value));
+    if (kHeaderSize + entry.size() > options_.maxPacketSize) {
+      // can never fit; the counter is not retried unless it changes
+      countersDropped_ += 1;
+      if (begin < i) {
+        sendPacket(packet, changed, begin, i);
+        startPacket(packet, sequence, full);
+      }
+      begin = i + 1;
+      continue;
+    }
+    if (packet.size() + entry.size() > options_.maxPacketSize ||
+        i - begin == kMaxCountersPerPacket) {
+      sendPacket(packet, changed, begin, i);
+      startPacket(packet, sequence, full);
+      begin = i;
+    }
+    packet += entry;
+  }
+  if (begin < changed.size()) {
+    sendPacket(packet, changed, begin, changed.size());
+  }
+}
+
+void DatagramPushExporter::sendPacket(
+    std::string& packet,
+    Changed const& changed,
+    size_t begin,
+    size_t end) {
+  auto const numCounters = end - begin;
+  putLittleEndian(packet, 6, numCounters, 2);
+  auto const sent = ::sendto(
+      fd_,
+      packet.data(),
+      packet.size(),
+      MSG_DONTWAIT,
+      reinterpret_cast<const sockaddr*>(&destination_),
+      destinationLen_);
+  if (sent == ssize_t(packet.size())) {
+    packetsSent_ += 1;
+    countersSent_ += numCounters;
+    return;
+  }
+  // Either the agent is not keeping up (EAGAIN, ENOBUFS) or it is not there
+  // (ECONNREFUSED, ENOENT). Forget the counters of the datagram, so that they
+  // are sent again on the next push.
+  VLOG(4) << "DatagramPushExporter: dropped datagram: "
+          << folly::errnoStr(errno);
+  packetsDropped_ += 1;
+  countersDropped_ += numCounters;
+  for (auto i = begin; i < end; ++i) {
+    lastPushed_.erase(changed[i].first);
+  }
+}
+
+DatagramPushExporter::Stats DatagramPushExporter::getStats() const {
+  return Stats{
+      pushes_,
+      packetsSent_,
+      countersSent_,
+      packetsDropped_,
+      countersDropped_,
+  };
+}
+
+/* static */
+bool DatagramPushExporter::decode(folly::ByteRange datagram, Packet& out) {
+  if (datagram.size() < kHeaderSize ||
+      !std::equal(std::begin(kMagic), std::end(kMagic), datagram.begin()) ||
+      datagram[4] != kVersion) {
+    return false;
+  }
+  out.full = datagram[5] & kFlagFull;
+  auto const numCounters = getLittleEndian(datagram, 6, 2);
+  out.sequence = getLittleEndian(datagram, 8, 8);
+  out.counters.clear();
+  out.counters.reserve(numCounters);
+
+  auto in = datagram.subpiece(kHeaderSize);
+  for (uint64_t i = 0; i < numCounters; ++i) {
+    auto const nameSize = folly::tryDecodeVarint(in);
+    if (!nameSize || *nameSize > in.size()) {
+      return false;
+    }
+    std::string name(reinterpret_cast<const char*>(in.data()), *nameSize);
+    in.advance(*nameSize);
+    auto const value = folly::tryDecodeVarint(in);
+    if (!value) {
+      return false;
+    }
+    out.counters.emplace_back(std::move(name), folly::decodeZigZag(*value));
+  }
+  return in.empty();
+}
+
+} // namespace facebook::fb303
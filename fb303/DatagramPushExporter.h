@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fb303/ServiceData.h>
+#include <folly/Range.h>
+#include <folly/SocketAddress.h>
+#include <folly/container/F14Map.h>
+#include <folly/experimental/FunctionScheduler.h>
+#include <folly/portability/Sockets.h>
+#include <folly/synchronization/RelaxedAtomic.h>
+
+namespace facebook::fb303 {
+
+/**
+ * Periodically pushes the counters of a ServiceData to a local agent, as an
+ * alternative to the agent scraping getCounters().
+ *
+ * Each push sends the flat, quantile and dynamic counters whose values changed
+ * since the previous push, packed into datagrams of at most
+ * Options::maxPacketSize bytes, to a Unix datagram socket or a UDP address,
+ * usually on the loopback interface. Every Options::fullPushInterval-th push
+ * sends all of the counters, so that a restarted agent catches up. Counters
+ * which are removed from the ServiceData are no longer sent, and are
+ * forgotten at the next full push.
+ *
+ * The socket is non-blocking: when the agent does not keep up, or is not
+ * listening, the datagrams are dropped and counted, and their counters are
+ * sent again on the next push. The counts are exported as the dynamic
+ * counters fb303.push.{pushes,packets_sent,counters_sent,packets_dropped,
+ * counters_dropped}.
+ *
+ * Each datagram is a 16-byte header followed by the counters:
+ *
+ *   bytes 0-3   magic "FBPC"
+ *   byte  4     version, currently 1
+ *   byte  5     flags; bit 0 is set in the datagrams of a full push
+ *   bytes 6-7   number of counters, little-endian
+ *   bytes 8-15  sequence number of the push, little-endian
+ *
+ * and each counter is the varint length of its name, its name, and its value
+ * as a zigzag varint. decode() parses a datagram.
+ */
+class DatagramPushExporter {
+ public:
+  struct Options {
+    std::chrono::milliseconds interval{std::chrono::seconds(1)};
+    size_t maxPacketSize = 1400;
+    // every Nth push sends all of the counters; 0 for only the first push
+    uint32_t fullPushInterval = 60;
+  };
+
+  struct Stats {
+    uint64_t pushes{0};
+    uint64_t packetsSent{0};
+    uint64_t countersSent{0};
+    uint64_t packetsDropped{0};
+    uint64_t countersDropped{0};
+  };
+
+  struct Packet {
+    uint64_t sequence{0};
+    bool full{false};
+    std::vector<std::pair<std::string, int64_t>> counters;
+  };
+
+  static constexpr size_t kHeaderSize = 16;
+
+  /**
+   * Creates the socket and exports the drop counters to serviceData. Throws
+   * std::system_error if the socket cannot be created. Does not push until
+   * start() or push() is called.
+   */
+  DatagramPushExporter(
+      ServiceData& serviceData,
+      const folly::SocketAddress& destination,
+      Options options);
+  DatagramPushExporter(
+      ServiceData& serviceData,
+      const folly::SocketAddress& destination)
+      : DatagramPushExporter(serviceData, destination, Options()) {}
+  ~DatagramPushExporter();
+
+  DatagramPushExporter(const DatagramPushExporter&) = delete;
+  DatagramPushExporter& operator=(const DatagramPushExporter&) = delete;
+
+  /** Starts pushing every Options::interval from a background thread. */
+  void start();
+
+  /** Stops the background pushes, if started. */
+  void stop();
+
+  /** Pushes now, from the calling thread. */
+  void push();
+
+  Stats getStats() const;
+
+  /** Parses a datagram. Returns false if it is malformed. */
+  static bool decode(folly::ByteRange datagram, Packet& out);
+
+ private:
+  using Changed = std::vector<std::pair<std::string, int64_t>>;
+
+  void collect(Changed& changed, bool full);
+  void send(Changed const& changed, uint64_t sequence, bool full);
+  void sendPacket(
+      std::string& packet,
+      Changed const& changed,
+      size_t begin,
+      size_t end);
+
+  ServiceData& serviceData_;
+  const Options options_;
+  const std::vector<std::string> statNames_;
+  int fd_{-1};
+  sockaddr_storage destination_{};
+  socklen_t destinationLen_{0};
+
+  // guards the pushes, which may come from start() and from push()
+  std::mutex pushMutex_;
+  uint64_t sequence_{0};
+  folly::F14FastMap<std::string, int64_t> lastPushed_;
+
+  folly::relaxed_atomic<uint64_t> pushes_{0};
+  folly::relaxed_atomic<uint64_t> packetsSent_{0};
+  folly::relaxed_atomic<uint64_t> countersSent_{0};
+  folly::relaxed_atomic<uint64_t> packetsDropped_{0};
+  folly::relaxed_atomic<uint64_t> countersDropped_{0};
+
+  folly::FunctionScheduler scheduler_;
+  bool started_{false};
+};
+
+} // namespace facebook::fb303
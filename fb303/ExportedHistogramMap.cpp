@@ -54,21 +54,16 @@ ExportedHistogramMap::HistogramPtr ExportedHistogramMap::getOrCreateUnlocked(
     return hist;
   }
 
-  auto value = std::make_shared<SyncHistogram>(makeExportedHistogram());
-
-  bool inserted;
-  {
-    // The returned iterator may be invalidated by a concurrent insert, so it
-    // must be dereferenced before releasing the lock guard.
-    HistMap::value_type toInsert(name, std::move(value));
-    auto lockedHistMap = histMap_.wlock();
-    auto item = lockedHistMap->insert(std::move(toInsert));
-    inserted = item.second;
-    hist = item.first->second;
-    CHECK(hist);
-  }
+  auto value =
+      std::make_shared<SyncHistogram>(generation_, makeExportedHistogram());
+
+  auto [iter, inserted] =
+      histMap_.try_emplace(std::string(name), std::move(value));
+  hist = iter->second;
+  CHECK(hist);
 
   if (inserted) {
+    numHistogramsCreated_ += 1;
     HistogramExporter::exportBuckets(hist, name, dynamicStrings_);
   }
   wasCreated = inserted;
@@ -98,41 +93,25 @@ bool ExportedHistogramMap::addHistogram(
     int64_t bucketWidth,
     int64_t min,
     int64_t max) {
-  HistogramPtr newHistogram;
-
-  // Acquire the lock while attempting the insert.
-  {
-    auto lockedHistMap = histMap_.wlock();
-
-    // Call emplace() with a null HistogramPtr first.  Creating a new histogram
-    // object is somewhat expensive, so wait to create it until we know we'll
-    // need it.
-    auto ret = lockedHistMap->emplace(name, nullptr);
-    if (!ret.second) {
-      // The histogram already existed.
-      return false;
-    }
-
-    // We inserted a new entry.  We now need to create and export the
-    // histogram.
-    //
-    // In the unlikely case that anything goes wrong after we have inserted the
-    // null pointer into the map before we can initialize it, erase the
-    // inserted null element.
-    SCOPE_FAIL {
-      lockedHistMap->erase(ret.first);
-    };
-
-    newHistogram = std::make_shared<SyncHistogram>(
-        std::in_place, bucketWidth, min, max, **defaultStat_.rlock());
-    ret.first->second = newHistogram;
-
-    // End of scope:
-    // Note that both our lock around histMap_ and our SCOPE_FAIL statement
-    // expire here.
+  if (contains(name)) {
+    return false;
   }
 
-  // Invoke the HistogramExporter after releasing the histMap_ lock.
+  // Creating a new histogram object is somewhat expensive, so only do it
+  // once the histogram is known to be missing; a racing creator may still
+  // insert first, in which case this one is dropped.
+  auto newHistogram = std::make_shared<SyncHistogram>(
+      generation_,
+      std::in_place,
+      bucketWidth,
+      min,
+      max,
+      **defaultStat_.rlock());
+  if (!histMap_.try_emplace(std::string(name), newHistogram).second) {
+    return false;
+  }
+
+  numHistogramsCreated_ += 1;
   HistogramExporter::exportBuckets(newHistogram, name, dynamicStrings_);
   return true;
 }
@@ -200,9 +179,6 @@ void ExportedHistogramMap::unexportStat(StringPiece name, ExportType type) {
 }
 
 void ExportedHistogramMap::clearAllHistograms() {
-  auto lockedHistMap = histMap_.wlock();
-  for (auto& histPtrKvp : *lockedHistMap) {
-    histPtrKvp.second->wlock()->clear();
-  }
+  generation_->fetch_add(1, std::memory_order_acq_rel);
 }
 } // namespace facebook::fb303
@@ -19,11 +19,19 @@
 #include <fb303/DynamicCounters.h>
 #include <fb303/ExportType.h>
 #include <fb303/TimeseriesHistogram.h>
+#include <fb303/detail/LazilyClearedSynchronized.h>
+#include <fb303/detail/LockProfile.h>
 #include <folly/Function.h>
 #include <folly/MapUtil.h>
 #include <folly/Synchronized.h>
-#include <folly/container/F14Map.h>
+#include <folly/concurrency/ConcurrentHashMap.h>
+#include <folly/container/HeterogeneousAccess.h>
 #include <folly/small_vector.h>
+#include <folly/synchronization/RelaxedAtomic.h>
+
+#include <string>
+#include <utility>
+#include <vector>
 
 namespace facebook {
 namespace fb303 {
@@ -61,10 +69,18 @@ using ExportedStatForHistogram = MultiLevelTimeSeries<
 
 class ExportedHistogramMap {
  public:
-  using SyncHistogram = folly::Synchronized<ExportedHistogram>;
+  using SyncHistogram = detail::LazilyClearedSynchronized<
+      ExportedHistogram,
+      detail::ProfiledSharedMutex<detail::LockSite::kHistogram>>;
   using HistogramPtr = std::shared_ptr<SyncHistogram>;
   using LockedHistogramPtr = SyncHistogram::WLockedPtr;
-  using HistMap = folly::F14NodeMap<std::string, HistogramPtr>;
+  // Lookups of existing histograms are lock-free, and creating a histogram
+  // only locks the shard it goes to.
+  using HistMap = folly::ConcurrentHashMap<
+      std::string,
+      HistogramPtr,
+      folly::HeterogeneousAccessHash<std::string>,
+      folly::HeterogeneousAccessEqualTo<std::string>>;
   using MakeExportedHistogram = folly::FunctionRef<ExportedHistogram()>;
   using TimePoint = ExportedStatForHistogram::TimePoint;
 
@@ -126,7 +142,7 @@ class ExportedHistogramMap {
    * Returns true if the given histogram exists in the map
    */
   bool contains(folly::StringPiece name) const {
-    return histMap_.rlock()->contains(name);
+    return histMap_.find(name) != histMap_.cend();
   }
 
   /**
@@ -150,7 +166,21 @@ class ExportedHistogramMap {
    * If the histogram doesn't exist, returns a nullptr.
    */
   HistogramPtr getHistogramUnlocked(folly::StringPiece name) {
-    return folly::get_default(*histMap_.rlock(), name);
+    auto iter = histMap_.find(name);
+    return iter != histMap_.cend() ? iter->second : nullptr;
+  }
+
+  /**
+   * Appends the name and unlocked HistogramPtr of every histogram in the map to
+   * out. Histograms created or removed concurrently may or may not be
+   * included.
+   */
+  void getHistograms(
+      std::vector<std::pair<std::string, HistogramPtr>>& out) const {
+    out.reserve(out.size() + histMap_.size());
+    for (const auto& [name, hist] : histMap_) {
+      out.emplace_back(name, hist);
+    }
   }
 
   /**
@@ -368,7 +398,8 @@ class ExportedHistogramMap {
   }
 
   /**
-   * Clear all of the histograms
+   * Clear all of the histograms. Takes constant time: each histogram is
+   * cleared the next time it is locked.
    */
   void clearAllHistograms();
 
@@ -388,7 +419,7 @@ class ExportedHistogramMap {
    * on clearing the entire DynamicCounters and DynamicStrings maps anyway.)
    */
   void forgetAllHistograms() {
-    histMap_.wlock()->clear();
+    histMap_.clear();
   }
 
   /*
@@ -398,7 +429,14 @@ class ExportedHistogramMap {
    *
    */
   void forgetHistogramsFor(folly::StringPiece name) {
-    histMap_.wlock()->erase(name);
+    histMap_.erase(name);
+  }
+
+  /*
+   * Returns the number of histograms ever created in this map.
+   */
+  uint64_t getNumHistogramsCreated() const {
+    return numHistogramsCreated_;
   }
 
  protected:
@@ -409,7 +447,11 @@ class ExportedHistogramMap {
       int64_t min,
       int64_t max) const;
 
-  folly::Synchronized<HistMap> histMap_;
+  HistMap histMap_;
+  folly::relaxed_atomic<uint64_t> numHistogramsCreated_{0};
+  // bumped by clearAllHistograms()
+  const std::shared_ptr<SyncHistogram::Generation> generation_{
+      std::make_shared<SyncHistogram::Generation>(0)};
 
   DynamicCounters* dynamicCounters_;
   DynamicStrings* dynamicStrings_;
@@ -15,8 +15,11 @@
  */
 
 #include <fb303/ExportedStatMap.h>
+#include <fb303/DynamicCounters.h>
 #include <fb303/TimeseriesExporter.h>
 
+#include <vector>
+
 using folly::StringPiece;
 
 namespace facebook::fb303 {
@@ -48,6 +51,48 @@ void ExportedStatMap::exportStat(
   }
 }
 
+void ExportedStatMap::exportStats(
+    folly::Range<const std::string*> names,
+    folly::Range<const ExportType*> types,
+    const ExportedStat* copyMe,
+    bool updateOnRead) {
+  std::vector<StatPtr> items(names.size());
+  std::shared_ptr<ExportedStat> defaultStat;
+  for (size_t i = 0; i < names.size(); ++i) {
+    auto iter = statMap_.find(names[i]);
+    if (iter != statMap_.cend()) {
+      items[i] = iter->second;
+      continue;
+    }
+    if (!copyMe && !defaultStat) {
+      defaultStat = *defaultStat_.rlock();
+    }
+    auto [entry, created] = statMap_.try_emplace(
+        names[i],
+        std::make_shared<SyncStat>(
+            generation_, copyMe ? *copyMe : *defaultStat));
+    if (created) {
+      numStatsCreated_ += 1;
+    }
+    // Existing, or created for an earlier duplicate of the name.
+    items[i] = entry->second;
+  }
+
+  TimeseriesExporter::ExportCallbacks callbacks;
+  if (!items.empty()) {
+    auto const& statObj = items.front()->unsafeGetUnlocked();
+    callbacks.reserve(items.size() * types.size() * statObj.numLevels());
+  }
+  for (size_t i = 0; i < names.size(); ++i) {
+    for (auto type : types) {
+      TimeseriesExporter::appendExportCallbacks(
+          callbacks, items[i], type, names[i], updateOnRead);
+    }
+  }
+  dynamicCounters_->registerCallbacks(
+      std::move(callbacks), /* overwrite */ false);
+}
+
 ExportedStatMap::StatPtr ExportedStatMap::getStatPtr(
     StringPiece name,
     const ExportType* exportType) {
@@ -81,69 +126,55 @@ ExportedStatMap::StatPtr ExportedStatMap::getStatPtrNoExport(
     *createdPtr = false;
   }
 
-  {
-    auto rlock = statMap_.rlock();
-    auto iter = rlock->find(name);
-    if (iter != rlock->end()) {
-      return iter->second;
-    }
-  }
-
-  auto ulock = statMap_.ulock();
-  auto iter = ulock->find(name);
-  if (iter != ulock->end()) {
-    // Stat was populated before we acquired the ulock.
+  if (auto iter = statMap_.find(name); iter != statMap_.cend()) {
     return iter->second;
   }
 
-  auto value =
-      std::make_shared<SyncStat>(copyMe ? *copyMe : **defaultStat_.rlock());
-
-  if (createdPtr) {
-    *createdPtr = true;
+  // Racing creators of the same stat each build one, but only the first to
+  // insert it gets it exported.
+  auto [iter, created] = statMap_.try_emplace(
+      std::string(name),
+      std::make_shared<SyncStat>(
+          generation_, copyMe ? *copyMe : **defaultStat_.rlock()));
+  if (created) {
+    numStatsCreated_ += 1;
+    if (createdPtr) {
+      *createdPtr = true;
+    }
   }
-
-  auto wlock = ulock.moveFromUpgradeToWrite();
-  auto item = wlock->try_emplace(name, std::move(value));
-  DCHECK(item.second);
-  return item.first->second;
+  return iter->second;
 }
 
 void ExportedStatMap::unExportStatAll(StringPiece name) {
   // Get unlocked item as we will not access the value of the item
   // And the function called on the value assume that they can access
   // the value without locking
-  auto lockedStatMap = statMap_.wlock();
-  auto stat = lockedStatMap->find(name);
-  if (stat != lockedStatMap->end()) {
+  auto stat = statMap_.find(name);
+  if (stat != statMap_.cend()) {
     for (auto type : ExportTypeMeta::kExportTypes) {
       TimeseriesExporter::unExportStat(
           stat->second, type, name, dynamicCounters_);
     }
-    lockedStatMap->erase(name);
+    statMap_.erase(stat->first);
   }
 }
 
 void ExportedStatMap::forgetAllStats() {
-  statMap_.wlock()->clear();
+  statMap_.clear();
 }
 
 void ExportedStatMap::forgetStatsFor(StringPiece name) {
-  statMap_.wlock()->erase(name);
+  statMap_.erase(name);
 }
 
 void ExportedStatMap::flushAllStats() {
-  auto lockedStatMap = statMap_.wlock();
-  for (auto& [_, ptr] : *lockedStatMap) {
+  for (auto const& [_, ptr] : statMap_) {
     ptr->wlock()->flush();
   }
 }
 
 void ExportedStatMap::clearAllStats() {
-  auto lockedStatMap = statMap_.wlock();
-  for (auto& [_, ptr] : *lockedStatMap) {
-    ptr->wlock()->clear();
-  }
+  generation_->fetch_add(1, std::memory_order_acq_rel);
 }
 
 } // namespace facebook::fb303
@@ -17,11 +17,16 @@
 #pragma once
 
 #include <memory>
+#include <string>
 
 #include <fb303/ExportType.h>
 #include <fb303/Timeseries.h>
+#include <fb303/detail/LazilyClearedSynchronized.h>
+#include <fb303/detail/LockProfile.h>
 #include <folly/Synchronized.h>
-#include <folly/container/F14Map.h>
+#include <folly/concurrency/ConcurrentHashMap.h>
+#include <folly/container/HeterogeneousAccess.h>
+#include <folly/synchronization/RelaxedAtomic.h>
 
 namespace facebook {
 namespace fb303 {
@@ -39,10 +44,18 @@ using TimePoint = ExportedStat::TimePoint;
 
 class ExportedStatMap {
  public:
-  using SyncStat = folly::Synchronized<ExportedStat>;
+  using SyncStat = detail::LazilyClearedSynchronized<
+      ExportedStat,
+      detail::ProfiledSharedMutex<detail::LockSite::kStat>>;
   using StatPtr = std::shared_ptr<SyncStat>;
   using LockedStatPtr = SyncStat::WLockedPtr;
-  using StatMap = folly::F14FastMap<std::string, StatPtr>;
+  // Lookups of existing stats are lock-free, and creating a stat only locks
+  // the shard it goes to.
+  using StatMap = folly::ConcurrentHashMap<
+      std::string,
+      StatPtr,
+      folly::HeterogeneousAccessHash<std::string>,
+      folly::HeterogeneousAccessEqualTo<std::string>>;
 
   /*
    * Creates an ExportedStatMap and hooks it up to the given DynamicCounters
@@ -229,8 +242,7 @@ class ExportedStatMap {
    * at any time (immediately) after returning.
    */
   bool contains(folly::StringPiece name) const {
-    auto lockedStatMap = statMap_.rlock();
-    return lockedStatMap->find(name) != lockedStatMap->end();
+    return statMap_.find(name) != statMap_.cend();
   }
 
   /*
@@ -266,6 +278,17 @@ class ExportedStatMap {
       const ExportedStat* copyMe = nullptr,
       bool updateOnRead = true);
 
+  /*
+   * Equivalent to calling exportStat() with the given types for each name,
+   * but for registering many stats at once, e.g. at startup: all of their
+   * counters are registered with a single DynamicCounters::registerCallbacks().
+   */
+  void exportStats(
+      folly::Range<const std::string*> names,
+      folly::Range<const ExportType*> types,
+      const ExportedStat* copyMe = nullptr,
+      bool updateOnRead = true);
+
   /*
    * Unexports stats of all types with the specified name and removes it from
    * the map.
@@ -301,11 +324,23 @@ class ExportedStatMap {
 
   /*
    * Reset all of the exported timeseries so they contain no data points.
+   * Takes constant time: each stat is cleared the next time it is locked.
    */
   void clearAllStats();
 
+  /*
+   * Returns the number of stats ever created in this map.
+   */
+  uint64_t getNumStatsCreated() const {
+    return numStatsCreated_;
+  }
+
  protected:
-  folly::Synchronized<StatMap> statMap_;
+  StatMap statMap_;
+  folly::relaxed_atomic<uint64_t> numStatsCreated_{0};
+  // bumped by clearAllStats()
+  const std::shared_ptr<SyncStat::Generation> generation_{
+      std::make_shared<SyncStat::Generation>(0)};
   DynamicCounters* dynamicCounters_;
 
   std::vector<ExportType> defaultTypes_;
@@ -19,12 +19,15 @@
 #include <fb303/DynamicCounters.h>
 #include <fb303/ExportedStatMapImpl.h>
 #include <fb303/TimeseriesHistogram.h>
-#include <folly/Synchronized.h>
+#include <fb303/detail/LazilyClearedSynchronized.h>
+#include <fb303/detail/LockProfile.h>
 
 namespace facebook::fb303 {
 
 using ExportedHistogram = TimeseriesHistogram<CounterType>;
-using HistogramPtr = std::shared_ptr<folly::Synchronized<ExportedHistogram>>;
+using HistogramPtr = std::shared_ptr<detail::LazilyClearedSynchronized<
+    ExportedHistogram,
+    detail::ProfiledSharedMutex<detail::LockSite::kHistogram>>>;
 
 class HistogramExporter {
  public:
@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fb303/HotKeySampler.h>
+
+#include <algorithm>
+
+#include <folly/Indestructible.h>
+#include <folly/Random.h>
+
+namespace facebook::fb303 {
+
+namespace detail {
+
+std::atomic<uint32_t> hotKeySamplingPeriod{0};
+
+void sampleHotKeySlow(std::string_view key) {
+  HotKeySampler::get().sample(key);
+}
+
+} // namespace detail
+
+void SpaceSavingSketch::add(
+    std::string_view key,
+    uint64_t count,
+    uint64_t error) {
+  if (auto it = counters_.find(key); it != counters_.end()) {
+    it->second.count += count;
+    it->second.error += error;
+    return;
+  }
+  if (counters_.size() < capacity_) {
+    counters_.emplace(key, Counter{count, error});
+    return;
+  }
+  if (capacity_ == 0) {
+    return;
+  }
+  auto min = std::min_element(
+      counters_.begin(), counters_.end(), [](auto const& a, auto const& b) {
+        return a.second.count < b.second.count;
+      });
+  auto const floor = min->second.count;
+  counters_.erase(min);
+  counters_.emplace(key, Counter{floor + count, floor + error});
+}
+
+void SpaceSavingSketch::merge(const SpaceSavingSketch& other) {
+  for (auto const& [key, counter] : other.counters_) {
+    add(key, counter.count, counter.error);
+  }
+}
+
+std::vector<SpaceSavingSketch::Entry> SpaceSavingSketch::getEntries() const {
+  std::vector<Entry> entries;
+  entries.reserve(counters_.size());
+  for (auto const& [key, counter] : counters_) {
+    entries.push_back(Entry{key, counter.count, counter.error});
+  }
+  std::sort(entries.begin(), entries.end(), [](auto const& a, auto const& b) {
+    return a.count != b.count ? a.count > b.count : a.key < b.key;
+  });
+  return entries;
+}
+
+HotKeySampler& HotKeySampler::get() {
+  // leaked, since stats may be updated during static destruction
+  static folly::Indestructible<HotKeySampler> sampler;
+  return *sampler;
+}
+
+void HotKeySampler::setSamplingPeriod(
+    uint32_t samplingPeriod,
+    std::chrono::seconds window) {
+  auto accessor = threadSketches_.accessAllThreads();
+  std::lock_guard lock(mergeMutex_);
+  for (auto& threadSketch : accessor) {
+    std::lock_guard threadLock(threadSketch.mutex);
+    threadSketch.sketch.clear();
+  }
+  pending_.clear();
+  windowStart_ = std::chrono::steady_clock::now();
+  window_ = window;
+  windowPeriod_ = samplingPeriod;
+  detail::hotKeySamplingPeriod.store(
+      samplingPeriod, std::memory_order_relaxed);
+}
+
+HotKeySampler::ThreadSketch::~ThreadSketch() {
+  // Threads cannot exit while merge() holds its accessAllThreads() accessor,
+  // which it takes before the mutex.
+  std::lock_guard lock(sampler.mergeMutex_);
+  sampler.pending_.merge(sketch);
+}
+
+void HotKeySampler::sample(std::string_view key) {
+  auto& threadSketch = *threadSketches_;
+  if (threadSketch.countdown > 1) {
+    --threadSketch.countdown;
+    return;
+  }
+  auto const period = getSamplingPeriod();
+  if (period == 0) {
+    return;
+  }
+  // start each thread at a random offset, so they do not sample in lockstep
+  threadSketch.countdown = threadSketch.countdown == 0
+      ? folly::Random::rand32(period) + 1
+      : period;
+  std::lock_guard lock(threadSketch.mutex);
+  threadSketch.sketch.add(key);
+}
+
+void HotKeySampler::merge(std::chrono::steady_clock::time_point now) {
+  if (getSamplingPeriod() == 0) {
+    return;
+  }
+  auto accessor = threadSketches_.accessAllThreads();
+  std::lock_guard lock(mergeMutex_);
+  for (auto& threadSketch : accessor) {
+    std::lock_guard threadLock(threadSketch.mutex);
+    if (!threadSketch.sketch.empty()) {
+      pending_.merge(threadSketch.sketch);
+      threadSketch.sketch.clear();
+    }
+  }
+
+  auto const elapsed = now - windowStart_;
+  if (elapsed < window_) {
+    return;
+  }
+  auto const seconds = std::chrono::duration<double>(elapsed).count();
+  auto const scale = windowPeriod_ / seconds;
+  hotKeys_.clear();
+  for (auto& entry : pending_.getEntries()) {
+    hotKeys_.push_back(HotKey{
+        std::move(entry.key), entry.count * scale, entry.error * scale});
+  }
+  pending_.clear();
+  windowStart_ = now;
+}
+
+std::vector<HotKeySampler::HotKey> HotKeySampler::getHotKeys(size_t k) const {
+  std::lock_guard lock(mergeMutex_);
+  return std::vector<HotKey>(
+      hotKeys_.begin(), hotKeys_.begin() + std::min(k, hotKeys_.size()));
+}
+
+} // namespace facebook::fb303
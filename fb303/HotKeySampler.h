@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <folly/CPortability.h>
+#include <folly/Likely.h>
+#include <folly/ThreadLocal.h>
+#include <folly/container/F14Map.h>
+
+namespace facebook::fb303 {
+
+namespace detail {
+// the sampling period of HotKeySampler, or 0 while it is disabled
+extern std::atomic<uint32_t> hotKeySamplingPeriod;
+
+FOLLY_NOINLINE void sampleHotKeySlow(std::string_view key);
+} // namespace detail
+
+/**
+ * Reports an update of the stat with the given key to HotKeySampler. Costs
+ * a relaxed load and a branch while the sampler is disabled.
+ */
+FOLLY_ALWAYS_INLINE void sampleHotKey(std::string_view key) {
+  if (FOLLY_UNLIKELY(
+          detail::hotKeySamplingPeriod.load(std::memory_order_relaxed) != 0)) {
+    detail::sampleHotKeySlow(key);
+  }
+}
+
+/**
+ * Counts the approximate number of updates of the most frequently updated
+ * keys in a bounded amount of memory, i.e. a Space-Saving sketch: once it
+ * holds capacity keys, a new key replaces the one with the least count and
+ * inherits that count, which is also the most it can be overestimated by.
+ */
+class SpaceSavingSketch {
+ public:
+  struct Entry {
+    std::string key;
+    uint64_t count;
+    // the most by which count may be overestimated
+    uint64_t error;
+  };
+
+  explicit SpaceSavingSketch(size_t capacity) : capacity_(capacity) {}
+
+  void add(std::string_view key, uint64_t count = 1, uint64_t error = 0);
+
+  /** Adds all the entries of other, as if their keys were added here. */
+  void merge(const SpaceSavingSketch& other);
+
+  /** Returns the entries, by decreasing count. */
+  std::vector<Entry> getEntries() const;
+
+  bool empty() const {
+    return counters_.empty();
+  }
+
+  void clear() {
+    counters_.clear();
+  }
+
+ private:
+  struct Counter {
+    uint64_t count;
+    uint64_t error;
+  };
+
+  const size_t capacity_;
+  folly::F14FastMap<std::string, Counter> counters_;
+};
+
+/**
+ * Finds the keys of the stats that are updated the most, to tell which ones
+ * are being hammered when the stats take a lot of CPU.
+ *
+ * While enabled, each thread reports one in every samplingPeriod of the
+ * updates it makes through the instrumented APIs, such as
+ * ServiceData::incrementCounter() or ThreadLocalStatsMap::addStatValue(), to
+ * a sketch of its own. ThreadCachedServiceData::publishStats() and
+ * ServiceData::getHotKeys() merge them; at the end of each window, the merged
+ * keys with the highest estimated rates become the ones returned by
+ * getHotKeys().
+ *
+ * The samples of exiting threads are carried over to the next merge.
+ */
+class HotKeySampler {
+ public:
+  static constexpr size_t kSketchCapacity = 128;
+
+  struct HotKey {
+    std::string key;
+    // estimated updates per second, and the most it may be overestimated by
+    double rate;
+    double maxError;
+  };
+
+  static HotKeySampler& get();
+
+  HotKeySampler() = default;
+  HotKeySampler(const HotKeySampler&) = delete;
+  HotKeySampler& operator=(const HotKeySampler&) = delete;
+
+  /**
+   * Starts sampling one in every samplingPeriod updates, or stops it if
+   * samplingPeriod is 0. Starts a new window in either case.
+   */
+  void setSamplingPeriod(
+      uint32_t samplingPeriod,
+      std::chrono::seconds window = std::chrono::seconds(60));
+
+  uint32_t getSamplingPeriod() const {
+    return detail::hotKeySamplingPeriod.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Merges the samples of all the threads, and publishes the hot keys if the
+   * window is over. Does nothing while sampling is disabled.
+   */
+  void merge(
+      std::chrono::steady_clock::time_point now =
+          std::chrono::steady_clock::now());
+
+  /** Returns the k hottest keys of the last window, hottest first. */
+  std::vector<HotKey> getHotKeys(size_t k) const;
+
+ private:
+  friend void detail::sampleHotKeySlow(std::string_view key);
+
+  struct ThreadSketch {
+    explicit ThreadSketch(HotKeySampler& s) : sampler(s) {}
+    ~ThreadSketch();
+
+    HotKeySampler& sampler;
+    // updates left to skip; only touched by the owning thread
+    uint32_t countdown{0};
+    // guards sketch against merge()
+    std::mutex mutex;
+    SpaceSavingSketch sketch{kSketchCapacity};
+  };
+  struct ThreadSketchTag {};
+
+  void sample(std::string_view key);
+
+  // guards the state below
+  mutable std::mutex mergeMutex_;
+  SpaceSavingSketch pending_{kSketchCapacity};
+  std::chrono::steady_clock::time_point windowStart_;
+  std::chrono::seconds window_{60};
+  uint32_t windowPeriod_{0};
+  std::vector<HotKey> hotKeys_;
+
+  // last, since the sketches of the remaining threads are merged into
+  // pending_ when it is destroyed
+  folly::ThreadLocal<ThreadSketch, ThreadSketchTag, folly::AccessModeStrict>
+      threadSketches_{[this] { return new ThreadSketch(*this); }};
+};
+
+} // namespace facebook::fb303
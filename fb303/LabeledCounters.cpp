@@ -0,0 +1,186 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fb303/LabeledCounters.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <fmt/core.h>
+#include <folly/container/F14Set.h>
+
+namespace facebook::fb303 {
+
+LabeledCounterFamily::LabeledCounterFamily(
+    std::string name,
+    std::vector<std::string> labelNames,
+    size_t maxLabelSets)
+    : name_(std::move(name)),
+      labelNames_(std::move(labelNames)),
+      maxLabelSets_(maxLabelSets) {
+  if (labelNames_.empty()) {
+    throw std::invalid_argument(
+        fmt::format("labeled counter family {} has no labels", name_));
+  }
+  folly::F14FastSet<std::string_view> seen;
+  for (auto const& label : labelNames_) {
+    if (!seen.insert(label).second) {
+      throw std::invalid_argument(fmt::format(
+          "labeled counter family {} has label {} twice", name_, label));
+    }
+  }
+  state_.wlock()->index.resize(labelNames_.size());
+}
+
+std::string LabeledCounterFamily::joinValues(
+    const std::vector<std::string_view>& values) {
+  std::string joined;
+  for (auto const& value : values) {
+    joined += value;
+    joined += '\0';
+  }
+  return joined;
+}
+
+LabeledCounterFamily::Handle LabeledCounterFamily::getHandle(
+    const std::vector<std::string_view>& labelValues) {
+  if (labelValues.size() != labelNames_.size()) {
+    throw std::invalid_argument(fmt::format(
+        "labeled counter family {} takes {} label values, not {}",
+        name_,
+        labelNames_.size(),
+        labelValues.size()));
+  }
+  auto const joined = joinValues(labelValues);
+  {
+    auto state = state_.rlock();
+    if (auto it = state->ids.find(joined); it != state->ids.end()) {
+      return Handle(&state->labelSets[it->second].value, it->second);
+    }
+  }
+
+  auto state = state_.wlock();
+  if (auto it = state->ids.find(joined); it != state->ids.end()) {
+    return Handle(&state->labelSets[it->second].value, it->second);
+  }
+  auto const numRegular = state->labelSets.size() - state->hasOverflow;
+  if (numRegular < maxLabelSets_) {
+    auto handle = addLabelSet(
+        *state,
+        std::vector<std::string>(labelValues.begin(), labelValues.end()));
+    state->ids.emplace(joined, handle.getLabelSetId());
+    return handle;
+  }
+
+  overflows_.fetch_add(1, std::memory_order_relaxed);
+  if (!state->hasOverflow) {
+    auto handle = addLabelSet(
+        *state,
+        std::vector<std::string>(
+            labelNames_.size(), std::string(kOverflowLabelValue)));
+    state->overflowId = handle.getLabelSetId();
+    state->hasOverflow = true;
+  }
+  return Handle(
+      &state->labelSets[state->overflowId].value, state->overflowId);
+}
+
+LabeledCounterFamily::Handle LabeledCounterFamily::addLabelSet(
+    State& state,
+    std::vector<std::string> values) {
+  auto const id = uint32_t(state.labelSets.size());
+  for (size_t i = 0; i < values.size(); ++i) {
+    state.index[i][values[i]].push_back(id);
+  }
+  auto& labelSet = state.labelSets.emplace_back(std::move(values));
+  return Handle(&labelSet.value, id);
+}
+
+size_t LabeledCounterFamily::getNumLabelSets() const {
+  return state_.rlock()->labelSets.size();
+}
+
+void LabeledCounterFamily::forEach(
+    const LabelSelector& selector,
+    folly::FunctionRef<void(uint32_t, const std::vector<std::string>&, int64_t)>
+        fn) const {
+  // positions of the selected labels, with their values
+  std::vector<std::pair<size_t, std::string_view>> terms;
+  for (auto const& [label, value] : selector) {
+    auto it = std::find(labelNames_.begin(), labelNames_.end(), label);
+    if (it == labelNames_.end()) {
+      return;
+    }
+    terms.emplace_back(it - labelNames_.begin(), value);
+  }
+
+  auto state = state_.rlock();
+  auto visit = [&](uint32_t id) {
+    auto const& labelSet = state->labelSets[id];
+    for (auto const& [pos, value] : terms) {
+      if (labelSet.values[pos] != value) {
+        return;
+      }
+    }
+    fn(id, labelSet.values, labelSet.value.load(std::memory_order_relaxed));
+  };
+  if (terms.empty()) {
+    for (uint32_t id = 0; id < state->labelSets.size(); ++id) {
+      visit(id);
+    }
+    return;
+  }
+
+  // walk the shortest list of candidates out of the index
+  const std::vector<uint32_t>* candidates = nullptr;
+  for (auto const& [pos, value] : terms) {
+    auto const& byValue = state->index[pos];
+    auto it = byValue.find(value);
+    if (it == byValue.end()) {
+      return;
+    }
+    if (!candidates || it->second.size() < candidates->size()) {
+      candidates = &it->second;
+    }
+  }
+  for (auto const id : *candidates) {
+    visit(id);
+  }
+}
+
+void LabeledCounterFamily::getCounters(
+    std::map<std::string, int64_t>& out,
+    const LabelSelector& selector) const {
+  forEach(
+      selector,
+      [&](uint32_t, const std::vector<std::string>& values, int64_t value) {
+        out.emplace(renderName(values), value);
+      });
+}
+
+std::string LabeledCounterFamily::renderName(
+    const std::vector<std::string>& labelValues) const {
+  std::string name = name_;
+  for (size_t i = 0; i < labelNames_.size(); ++i) {
+    name += '.';
+    name += labelNames_[i];
+    name += '=';
+    name += labelValues[i];
+  }
+  return name;
+}
+
+} // namespace facebook::fb303
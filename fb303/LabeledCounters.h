@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <folly/Function.h>
+#include <folly/SharedMutex.h>
+#include <folly/Synchronized.h>
+#include <folly/container/F14Map.h>
+
+namespace facebook::fb303 {
+
+/**
+ * Pairs of label name and value, all of which a label set must have to be
+ * selected.
+ */
+using LabelSelector = std::vector<std::pair<std::string, std::string>>;
+
+/**
+ * A family of flat counters sharing a name and a list of label names, with
+ * one counter per set of label values, instead of one string key per
+ * combination with the values encoded into it. Label sets are given dense
+ * ids in the order they are first used.
+ *
+ * Updates go through a Handle resolved once per label set, which points
+ * directly at the value. Reads select label sets by label value through a
+ * per-label index, and the legacy flat names, of the form
+ * "<name>.<label>=<value>[.<label>=<value>...]", are only rendered when the
+ * counters are read.
+ *
+ * To bound the cardinality, once maxLabelSets label sets exist, handles for
+ * new ones all share a single overflow label set, whose values are all
+ * kOverflowLabelValue.
+ */
+class LabeledCounterFamily {
+ public:
+  static constexpr std::string_view kOverflowLabelValue = "__overflow__";
+
+  class Handle {
+   public:
+    Handle() = default;
+
+    bool isNull() const {
+      return value_ == nullptr;
+    }
+
+    uint32_t getLabelSetId() const {
+      return id_;
+    }
+
+    int64_t increment(int64_t amount = 1) const {
+      return value_->fetch_add(amount, std::memory_order_relaxed) + amount;
+    }
+
+    void set(int64_t value) const {
+      value_->store(value, std::memory_order_relaxed);
+    }
+
+    int64_t get() const {
+      return value_->load(std::memory_order_relaxed);
+    }
+
+   private:
+    friend class LabeledCounterFamily;
+    Handle(std::atomic<int64_t>* value, uint32_t id) : value_(value), id_(id) {}
+
+    std::atomic<int64_t>* value_{nullptr};
+    uint32_t id_{0};
+  };
+
+  /**
+   * Throws std::invalid_argument if labelNames is empty or has duplicates.
+   */
+  LabeledCounterFamily(
+      std::string name,
+      std::vector<std::string> labelNames,
+      size_t maxLabelSets);
+
+  LabeledCounterFamily(const LabeledCounterFamily&) = delete;
+  LabeledCounterFamily& operator=(const LabeledCounterFamily&) = delete;
+
+  const std::string& getName() const {
+    return name_;
+  }
+
+  const std::vector<std::string>& getLabelNames() const {
+    return labelNames_;
+  }
+
+  size_t getMaxLabelSets() const {
+    return maxLabelSets_;
+  }
+
+  /**
+   * Returns the handle of the counter with the given label values, one per
+   * label name, adding it if needed. Resolve handles once and keep them,
+   * since this looks the label set up by its values.
+   *
+   * Throws std::invalid_argument if the number of values is wrong.
+   */
+  Handle getHandle(const std::vector<std::string_view>& labelValues);
+
+  /** Returns the number of label sets, including the overflow one. */
+  size_t getNumLabelSets() const;
+
+  /** Returns how many times a new label set was folded into the overflow. */
+  uint64_t getNumOverflows() const {
+    return overflows_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Passes the id, label values and value of every label set matching
+   * selector to fn, in id order. fn is invoked under the shared lock of the
+   * family, so it should not block. A selector naming a label the family
+   * does not have matches nothing.
+   */
+  void forEach(
+      const LabelSelector& selector,
+      folly::FunctionRef<
+          void(uint32_t, const std::vector<std::string>&, int64_t)> fn) const;
+
+  /**
+   * Adds the counters of the label sets matching selector to out, keyed by
+   * their legacy flat names.
+   */
+  void getCounters(
+      std::map<std::string, int64_t>& out,
+      const LabelSelector& selector = {}) const;
+
+  /** Returns the legacy flat name of a label set. */
+  std::string renderName(const std::vector<std::string>& labelValues) const;
+
+ private:
+  struct LabelSet {
+    explicit LabelSet(std::vector<std::string> v) : values(std::move(v)) {}
+
+    const std::vector<std::string> values;
+    std::atomic<int64_t> value{0};
+  };
+
+  struct State {
+    // label sets by id; a deque, so that handles stay valid as it grows
+    std::deque<LabelSet> labelSets;
+    // ids by the label values joined with '\0'
+    folly::F14FastMap<std::string, uint32_t> ids;
+    // for each label, the ids of the label sets by the label's value
+    std::vector<folly::F14FastMap<std::string, std::vector<uint32_t>>> index;
+    uint32_t overflowId{0};
+    bool hasOverflow{false};
+  };
+
+  static std::string joinValues(const std::vector<std::string_view>& values);
+  Handle addLabelSet(State& state, std::vector<std::string> values);
+
+  const std::string name_;
+  const std::vector<std::string> labelNames_;
+  const size_t maxLabelSets_;
+  std::atomic<uint64_t> overflows_{0};
+  folly::Synchronized<State, folly::SharedMutex> state_;
+};
+
+} // namespace facebook::fb303
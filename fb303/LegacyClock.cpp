@@ -20,7 +20,15 @@
 
 namespace facebook::fb303 {
 
+namespace {
+// 0 when not overridden
+thread_local time_t legacyStatsTimeOverride = 0;
+} // namespace
+
 time_t get_legacy_stats_time() {
+  if (legacyStatsTimeOverride != 0) {
+    return legacyStatsTimeOverride;
+  }
 #ifdef __APPLE__
   timespec ts;
   auto ret = clock_gettime(CLOCK_REALTIME, &ts);
@@ -33,4 +41,13 @@ time_t get_legacy_stats_time() {
 #endif
 }
 
+ScopedLegacyStatsTime::ScopedLegacyStatsTime(time_t now) noexcept
+    : previous_(legacyStatsTimeOverride) {
+  legacyStatsTimeOverride = now;
+}
+
+ScopedLegacyStatsTime::~ScopedLegacyStatsTime() {
+  legacyStatsTimeOverride = previous_;
+}
+
 } // namespace facebook::fb303
@@ -33,4 +33,22 @@ namespace facebook::fb303 {
  */
 time_t get_legacy_stats_time();
 
+/**
+ * While alive, makes get_legacy_stats_time() return the given time on the
+ * calling thread, so that all the stats it reads meanwhile are evaluated at
+ * the same second. Used by ServiceData::getCountersSnapshot(). Scopes may
+ * nest; the innermost wins.
+ */
+class ScopedLegacyStatsTime {
+ public:
+  explicit ScopedLegacyStatsTime(time_t now) noexcept;
+  ~ScopedLegacyStatsTime();
+
+  ScopedLegacyStatsTime(const ScopedLegacyStatsTime&) = delete;
+  ScopedLegacyStatsTime& operator=(const ScopedLegacyStatsTime&) = delete;
+
+ private:
+  time_t previous_;
+};
+
 } // namespace facebook::fb303
@@ -0,0 +1,405 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fb303/OpenMetricsExporter.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <iterator>
+#include <map>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <fb303/LegacyClock.h>
+#include <fb303/TimeseriesExporter.h>
+#include <fmt/core.h>
+#include <folly/FileUtil.h>
+#include <folly/container/F14Set.h>
+
+namespace facebook::fb303 {
+
+namespace {
+
+bool isMetricNameChar(char c, bool first) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' ||
+      c == ':' || (!first && c >= '0' && c <= '9');
+}
+
+// Whether name is a valid label name, which unlike a metric name may not
+// contain ':' nor start with the reserved "__".
+bool isLabelName(std::string_view name) {
+  if (name.empty() || name.starts_with("__")) {
+    return false;
+  }
+  for (size_t i = 0; i < name.size(); ++i) {
+    if (name[i] == ':' || !isMetricNameChar(name[i], i == 0)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void appendLabelValue(std::string& out, std::string_view value) {
+  for (auto c : value) {
+    switch (c) {
+      case '\\':
+        out += "\\\\";
+        break;
+      case '"':
+        out += "\\\"";
+        break;
+      case '\n':
+        out += "\\n";
+        break;
+      default:
+        out += c;
+    }
+  }
+}
+
+// Accumulates the output and hands it to the sink a chunk at a time.
+class ChunkWriter {
+ public:
+  ChunkWriter(OpenMetricsExporter::Sink sink, size_t chunkSize)
+      : sink_(sink), chunkSize_(std::max<size_t>(chunkSize, 1)) {
+    buf_.reserve(chunkSize_);
+  }
+
+  std::string& buf() {
+    return buf_;
+  }
+
+  void sample(std::string_view name, int64_t value) {
+    OpenMetricsExporter::appendMetricName(buf_, name);
+    fmt::format_to(std::back_inserter(buf_), " {}\n", value);
+  }
+
+  // Must not be called with any fb303 lock held, since the sink may block.
+  void maybeFlush() {
+    if (buf_.size() >= chunkSize_) {
+      flush();
+    }
+  }
+
+  void flush() {
+    if (!buf_.empty()) {
+      auto chunk = folly::IOBuf::fromString(std::move(buf_));
+      buf_ = std::string();
+      buf_.reserve(chunkSize_);
+      sink_(std::move(chunk));
+    }
+  }
+
+ private:
+  OpenMetricsExporter::Sink sink_;
+  const size_t chunkSize_;
+  std::string buf_;
+};
+
+struct HistogramSnapshot {
+  int64_t min;
+  int64_t max;
+  int64_t bucketSize;
+  std::vector<uint64_t> counts;
+  int64_t sum;
+  uint64_t count;
+};
+
+HistogramSnapshot snapshotHistogram(
+    ExportedHistogramMap::SyncHistogram& syncHist) {
+  auto hist = syncHist.wlock();
+  // make sure the histogram is up to date and data is decayed appropriately
+  hist->update(get_legacy_stats_time());
+
+  // All the buckets have the same levels, so we look at the first one.
+  const auto& levels = hist->getBucket(0);
+  size_t level = levels.numLevels() - 1;
+  for (size_t i = 0; i < levels.numLevels(); ++i) {
+    if (levels.getLevel(i).isAllTime()) {
+      level = i;
+      break;
+    }
+  }
+
+  HistogramSnapshot snapshot{
+      hist->getMin(),
+      hist->getMax(),
+      hist->getBucketSize(),
+      {},
+      hist->sum(level),
+      hist->count(level),
+  };
+  snapshot.counts.reserve(hist->getNumBuckets());
+  for (size_t i = 0; i < hist->getNumBuckets(); ++i) {
+    snapshot.counts.push_back(hist->getBucket(i).count(level));
+  }
+  return snapshot;
+}
+
+void writeHistogram(
+    ChunkWriter& writer,
+    std::string_view name,
+    const HistogramSnapshot& hist) {
+  auto& buf = writer.buf();
+  buf += "# TYPE ";
+  OpenMetricsExporter::appendMetricName(buf, name);
+  buf += " histogram\n";
+
+  // Bucket 0 is (-inf, min), bucket i in [1, n - 2] is
+  // [min + (i - 1) * bucketSize, min + i * bucketSize) capped at max, and
+  // bucket n - 1 is [max, +inf).
+  uint64_t cumulative = 0;
+  const auto numBuckets = hist.counts.size();
+  for (size_t i = 0; i + 1 < numBuckets; ++i) {
+    cumulative += hist.counts[i];
+    const auto upper =
+        std::min(hist.min + int64_t(i) * hist.bucketSize, hist.max);
+    OpenMetricsExporter::appendMetricName(buf, name);
+    fmt::format_to(
+        std::back_inserter(buf),
+        "_bucket{{le=\"{}\"}} {}\n",
+        upper - 1,
+        cumulative);
+  }
+  OpenMetricsExporter::appendMetricName(buf, name);
+  fmt::format_to(
+      std::back_inserter(buf), "_bucket{{le=\"+Inf\"}} {}\n", hist.count);
+  OpenMetricsExporter::appendMetricName(buf, name);
+  fmt::format_to(std::back_inserter(buf), "_sum {}\n", hist.sum);
+  OpenMetricsExporter::appendMetricName(buf, name);
+  fmt::format_to(std::back_inserter(buf), "_count {}\n", hist.count);
+}
+
+// Writes the counters of family as samples of a metric named after it, with
+// its labels, or under their rendered flat names if some label names are not
+// valid OpenMetrics label names.
+void writeLabeledCounters(
+    ChunkWriter& writer,
+    const LabeledCounterFamily& family) {
+  const auto& labelNames = family.getLabelNames();
+  const bool native = std::all_of(
+      labelNames.begin(), labelNames.end(), [](const std::string& name) {
+        return isLabelName(name);
+      });
+  family.forEach(
+      {},
+      [&](uint32_t, const std::vector<std::string>& values, int64_t value) {
+        if (!native) {
+          writer.sample(family.renderName(values), value);
+          return;
+        }
+        auto& buf = writer.buf();
+        OpenMetricsExporter::appendMetricName(buf, family.getName());
+        for (size_t i = 0; i < labelNames.size(); ++i) {
+          buf += i == 0 ? '{' : ',';
+          buf += labelNames[i];
+          buf += "=\"";
+          appendLabelValue(buf, values[i]);
+          buf += '"';
+        }
+        fmt::format_to(std::back_inserter(buf), "}} {}\n", value);
+      });
+}
+
+// Whether key is one of the "<name>.hist" or "<name>.hist.<duration>" bucket
+// exports of the given histograms.
+bool isHistogramExport(
+    std::string_view key,
+    const folly::F14FastSet<std::string_view>& histograms) {
+  const auto pos = key.rfind(".hist");
+  if (pos == std::string_view::npos) {
+    return false;
+  }
+  const auto suffix = key.substr(pos + 5);
+  if (!suffix.empty() &&
+      (suffix[0] != '.' ||
+       !std::all_of(suffix.begin() + 1, suffix.end(), [](char c) {
+         return c >= '0' && c <= '9';
+       }))) {
+    return false;
+  }
+  return histograms.contains(key.substr(0, pos));
+}
+
+bool isDigits(std::string_view s) {
+  return !s.empty() && std::all_of(s.begin(), s.end(), [](char c) {
+           return c >= '0' && c <= '9';
+         });
+}
+
+// Whether key is one of the percentile or stat counters which HistogramExporter
+// registers for the given histograms, e.g. "<name>.p99", "<name>.avg" or
+// "<name>.avg.60".
+bool isHistogramCounter(
+    std::string_view key,
+    const folly::F14FastSet<std::string_view>& histograms) {
+  const auto isExport = [&](std::string_view name) {
+    const auto pos = name.rfind('.');
+    if (pos == std::string_view::npos) {
+      return false;
+    }
+    const auto suffix = name.substr(pos + 1);
+    const auto types = TimeseriesExporter::getTypeString();
+    const bool exported =
+        (!suffix.empty() && suffix[0] == 'p' && isDigits(suffix.substr(1))) ||
+        std::find(types.begin(), types.end(), suffix) != types.end();
+    return exported && histograms.contains(name.substr(0, pos));
+  };
+  if (isExport(key)) {
+    return true;
+  }
+  const auto pos = key.rfind('.');
+  return pos != std::string_view::npos && isDigits(key.substr(pos + 1)) &&
+      isExport(key.substr(0, pos));
+}
+
+} // namespace
+
+/* static */
+void OpenMetricsExporter::appendMetricName(
+    std::string& out,
+    std::string_view name) {
+  if (name.empty()) {
+    out += '_';
+    return;
+  }
+  const auto start = out.size();
+  out += name;
+  for (auto i = start; i < out.size(); ++i) {
+    if (!isMetricNameChar(out[i], i == start)) {
+      out[i] = '_';
+    }
+  }
+}
+
+void OpenMetricsExporter::write(Sink sink) const {
+  ChunkWriter writer(sink, options_.chunkSize);
+
+  std::vector<std::pair<std::string, ExportedHistogramMap::HistogramPtr>>
+      histograms;
+  folly::F14FastSet<std::string_view> histogramNames;
+  if (options_.histograms) {
+    serviceData_.getHistogramMap()->getHistograms(histograms);
+    for (const auto& [name, _] : histograms) {
+      histogramNames.insert(name);
+    }
+  }
+
+  if (options_.counters) {
+    // Resume each batch from the least name greater than the last one.
+    std::string from;
+    const auto batch = std::max<size_t>(options_.countersPerBatch, 1);
+    while (true) {
+      size_t visited = 0;
+      auto const count = serviceData_.forEachCounter(
+          from, batch, [&](const std::string& name, int64_t value) {
+            writer.sample(name, value);
+            if (++visited == batch) {
+              from = name;
+              from += '\0';
+            }
+          });
+      writer.maybeFlush();
+      if (count < batch) {
+        break;
+      }
+    }
+
+    std::map<std::string, int64_t> quantiles;
+    serviceData_.getQuantileStatMap()->getValues(quantiles);
+    for (const auto& [name, value] : quantiles) {
+      writer.sample(name, value);
+      writer.maybeFlush();
+    }
+
+    for (const auto& family : serviceData_.getLabeledCounterFamilies()) {
+      // forEach holds the lock of the family, so flush only once it is done
+      writeLabeledCounters(writer, *family);
+      writer.maybeFlush();
+    }
+
+    if (auto arena = serviceData_.getSharedCounters()) {
+      std::map<std::string, int64_t> shared;
+      arena->getCounters(shared);
+      for (const auto& [name, value] : shared) {
+        writer.sample(name, value);
+        writer.maybeFlush();
+      }
+    }
+
+    // the counters of the histograms written natively would repeat them
+    const bool skipHistogramCounters =
+        !options_.histogramCounters && !histogramNames.empty();
+    serviceData_.getDynamicCounters()->forEachValue(
+        [&](const std::string& name, int64_t&& value) {
+          if (skipHistogramCounters &&
+              isHistogramCounter(name, histogramNames)) {
+            return;
+          }
+          writer.sample(name, value);
+          writer.maybeFlush();
+        });
+  }
+
+  for (const auto& [name, hist] : histograms) {
+    writeHistogram(writer, name, snapshotHistogram(*hist));
+    writer.maybeFlush();
+  }
+
+  if (options_.exportedValues) {
+    for (const auto& [key, value] : serviceData_.getExportedValues()) {
+      if (isHistogramExport(key, histogramNames)) {
+        continue;
+      }
+      auto& buf = writer.buf();
+      buf += "# TYPE ";
+      appendMetricName(buf, key);
+      buf += " info\n";
+      appendMetricName(buf, key);
+      buf += "_info{value=\"";
+      appendLabelValue(buf, value);
+      buf += "\"} 1\n";
+      writer.maybeFlush();
+    }
+  }
+
+  writer.buf() += "# EOF\n";
+  writer.flush();
+}
+
+std::unique_ptr<folly::IOBuf> OpenMetricsExporter::write() const {
+  std::unique_ptr<folly::IOBuf> head;
+  write([&](std::unique_ptr<folly::IOBuf> chunk) {
+    if (head) {
+      head->appendToChain(std::move(chunk));
+    } else {
+      head = std::move(chunk);
+    }
+  });
+  return head ? std::move(head) : folly::IOBuf::create(0);
+}
+
+void OpenMetricsExporter::write(int fd) const {
+  write([&](std::unique_ptr<folly::IOBuf> chunk) {
+    if (folly::writeFull(fd, chunk->data(), chunk->length()) < 0) {
+      throw std::system_error(
+          errno, std::generic_category(), "OpenMetricsExporter write failed");
+    }
+  });
+}
+
+} // namespace facebook::fb303
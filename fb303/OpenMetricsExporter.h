@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include <fb303/ServiceData.h>
+#include <folly/Function.h>
+#include <folly/io/IOBuf.h>
+
+namespace facebook::fb303 {
+
+/**
+ * Writes the stats of a ServiceData in the OpenMetrics text exposition format,
+ * for Prometheus-style scrapers, directly from the stat maps rather than from
+ * a copy of getCounters().
+ *
+ * The output is produced in chunks of roughly Options::chunkSize bytes, which
+ * are handed to a sink as they fill up: either appended to an IOBuf chain, or
+ * written to a file descriptor. No lock is held while a chunk is handed over.
+ *
+ * The output consists of:
+ *  - the flat, quantile, shared (see ServiceData::setSharedCounters()) and
+ *    dynamic counters, as samples of untyped metrics, except the percentile
+ *    and stat counters exported for the histograms written natively, e.g.
+ *    "<name>.p99.60" or "<name>.avg.60", unless Options::histogramCounters
+ *    is set;
+ *  - the labeled counter families, as untyped metrics named after the family
+ *    with a sample per label set, e.g. "requests{method="GET"} 3". A
+ *    family with label names OpenMetrics does not allow is instead written
+ *    under the rendered flat names of its counters;
+ *  - the histograms of the histogram map, as native histograms with
+ *    cumulative _bucket{le="..."}, _sum and _count samples from their
+ *    all-time level (or their longest level if none is all-time). Since the
+ *    values are integers, each bucket [lo, hi) is reported as le="hi - 1";
+ *  - the exported values, as info metrics, except the ".hist" bucket exports
+ *    of the histograms when these are written natively.
+ *
+ * Metric names have the characters not allowed by OpenMetrics replaced with
+ * '_', e.g. "foo.bar.avg.60" is written as "foo_bar_avg_60". Distinct fb303
+ * names may thus collide; fb303 does not guard against that.
+ */
+class OpenMetricsExporter {
+ public:
+  struct Options {
+    bool counters = true;
+    bool histograms = true;
+    bool exportedValues = true;
+    // also write the flattened counters of the histograms written natively
+    bool histogramCounters = false;
+    // the approximate size of each chunk of output
+    size_t chunkSize = 64 * 1024;
+    // the number of flat counters formatted per acquisition of their lock
+    size_t countersPerBatch = 4096;
+  };
+
+  using Sink = folly::FunctionRef<void(std::unique_ptr<folly::IOBuf>)>;
+
+  explicit OpenMetricsExporter(ServiceData& serviceData)
+      : OpenMetricsExporter(serviceData, Options()) {}
+  OpenMetricsExporter(ServiceData& serviceData, Options options)
+      : serviceData_(serviceData), options_(options) {}
+
+  /** Writes the exposition, passing each chunk to sink as it fills up. */
+  void write(Sink sink) const;
+
+  /** Returns the exposition as an IOBuf chain with a buffer per chunk. */
+  std::unique_ptr<folly::IOBuf> write() const;
+
+  /**
+   * Writes the exposition to fd, a chunk at a time. Throws std::system_error
+   * if a write fails.
+   */
+  void write(int fd) const;
+
+  /** Appends name to out, with the characters not allowed replaced by '_'. */
+  static void appendMetricName(std::string& out, std::string_view name);
+
+ private:
+  ServiceData& serviceData_;
+  const Options options_;
+};
+
+} // namespace facebook::fb303
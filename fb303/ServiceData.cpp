@@ -16,17 +16,30 @@
 
 #include <fb303/ServiceData.h>
 
+#include <algorithm>
+#include <array>
+#include <iterator>
+#include <mutex>
 #include <stdexcept>
 
 #include <boost/regex.hpp>
 #include <fb303/detail/RegexUtil.h>
+#include <fmt/core.h>
 #include <folly/Conv.h>
 #include <folly/Indestructible.h>
 #include <folly/MapUtil.h>
+#include <folly/ScopeGuard.h>
 #include <folly/String.h>
 #include <folly/container/Reserve.h>
 #include <gflags/gflags.h>
 
+DEFINE_uint32(
+    fb303_options_cache_ttl_ms,
+    0,
+    "Maximum age of the options returned by fb303 getOptions(), which are "
+    "otherwise only collected again when they are changed through fb303. "
+    "Zero, the default, to collect them on every call.");
+
 using folly::StringPiece;
 
 namespace facebook::fb303 {
@@ -68,7 +81,12 @@ void ServiceData::flushAllData() {
 
 void ServiceData::resetAllData() {
   options_.wlock()->clear();
-  detail::cachedClearStrings(*counters_.wlock());
+  invalidateOptions();
+  {
+    auto countersWLock = counters_.wlock();
+    detail::cachedClearStrings(*countersWLock);
+    ++countersWLock->epoch;
+  }
   exportedValues_.wlock()->clear();
 
   statsMap_.forgetAllStats();
@@ -107,6 +125,14 @@ void ServiceData::addStatExportType(
   statsMap_.exportStat(key, type, statPrototype, updateOnRead);
 }
 
+void ServiceData::addStatExportTypes(
+    folly::Range<const std::string*> keys,
+    folly::Range<const ExportType*> types,
+    const ExportedStat* statPrototype,
+    bool updateOnRead) {
+  statsMap_.exportStats(keys, types, statPrototype, updateOnRead);
+}
+
 void ServiceData::addStatExports(
     StringPiece key,
     StringPiece stats,
@@ -149,6 +175,7 @@ void ServiceData::addStatExports(
 }
 
 void ServiceData::addStatValue(StringPiece key, int64_t value, TimePoint now) {
+  sampleHotKey(key);
   statsMap_.addValue(key, now, value);
 }
 
@@ -157,6 +184,7 @@ void ServiceData::addStatValue(
     int64_t value,
     ExportType exportType,
     TimePoint now) {
+  sampleHotKey(key);
   statsMap_.addValue(key, now, value, exportType);
 }
 
@@ -165,6 +193,7 @@ void ServiceData::addStatValue(
     int64_t value,
     folly::Range<const ExportType*> exportTypes,
     TimePoint now) {
+  sampleHotKey(key);
   statsMap_.addValue(key, now, value, exportTypes);
 }
 
@@ -173,6 +202,7 @@ void ServiceData::addStatValueAggregated(
     int64_t sum,
     int64_t numSamples,
     TimePoint now) {
+  sampleHotKey(key);
   statsMap_.addValueAggregated(key, now, sum, numSamples);
 }
 
@@ -287,12 +317,19 @@ void ServiceData::addHistAndStatValues(
 }
 
 template <class F>
-int64_t ServiceData::modifyCounter(folly::StringPiece key, F f) {
+int64_t
+ServiceData::modifyCounter(folly::StringPiece key, CounterHandle* handle, F f) {
   {
     //  optimistically, the key is certainly present; update under rlock
     auto countersRLock = counters_.rlock();
     //  this mutation is safe: the lock protects the map structure only
-    if (auto ptr = folly::get_ptr(countersRLock.asNonConstUnsafe().map, key)) {
+    auto& counters = countersRLock.asNonConstUnsafe();
+    if (handle) {
+      if (handle->counter_ && handle->epoch_ == counters.epoch) {
+        return f(*handle->counter_);
+      }
+      // handles are only written under the exclusive lock
+    } else if (auto ptr = folly::get_ptr(counters.map, key)) {
       return f(*ptr);
     }
   }
@@ -300,18 +337,41 @@ int64_t ServiceData::modifyCounter(folly::StringPiece key, F f) {
   //  pessimistically, the key is possibly absent; upsert under wlock
   auto countersWLock = counters_.wlock();
   auto& ref = detail::cachedAddString(*countersWLock, key, 0).first->second;
+  if (handle) {
+    handle->counter_ = &ref;
+    handle->epoch_ = countersWLock->epoch;
+  }
 
   return f(ref);
 }
 
 int64_t ServiceData::incrementCounter(StringPiece key, int64_t amount) {
-  return modifyCounter(key, [amount](auto& ref) {
+  sampleHotKey(key);
+  return modifyCounter(key, nullptr, [amount](auto& ref) {
     return ref.fetch_add(amount, std::memory_order_relaxed) + amount;
   });
 }
 
 int64_t ServiceData::setCounter(StringPiece key, int64_t value) {
-  return modifyCounter(key, [value](auto& ref) {
+  return modifyCounter(key, nullptr, [value](auto& ref) {
+    ref.store(value, std::memory_order_relaxed);
+    return value;
+  });
+}
+
+int64_t ServiceData::incrementCounter(
+    CounterHandle& handle,
+    StringPiece key,
+    int64_t amount) {
+  sampleHotKey(key);
+  return modifyCounter(key, &handle, [amount](auto& ref) {
+    return ref.fetch_add(amount, std::memory_order_relaxed) + amount;
+  });
+}
+
+int64_t
+ServiceData::setCounter(CounterHandle& handle, StringPiece key, int64_t value) {
+  return modifyCounter(key, &handle, [value](auto& ref) {
     ref.store(value, std::memory_order_relaxed);
     return value;
   });
@@ -321,9 +381,223 @@ void ServiceData::clearCounter(StringPiece key) {
   auto countersWLock = counters_.wlock();
   if (auto it = countersWLock->map.find(key); it != countersWLock->map.end()) {
     detail::cachedEraseString(*countersWLock, it);
+    ++countersWLock->epoch;
+  }
+}
+
+void ServiceData::incrementCounters(
+    folly::Range<const CounterIncrement*> increments) {
+  std::vector<const CounterIncrement*> unresolved;
+  {
+    auto countersRLock = counters_.rlock();
+    //  this mutation is safe: the lock protects the map structure only
+    auto& counters = countersRLock.asNonConstUnsafe();
+    // Not sampled: each increment aggregates an unknown number of updates,
+    // which were sampled where they were made, if at all.
+    for (auto const& increment : increments) {
+      if (auto handle = increment.handle) {
+        if (handle->counter_ && handle->epoch_ == counters.epoch) {
+          handle->counter_->fetch_add(
+              increment.amount, std::memory_order_relaxed);
+        } else {
+          // handles are only written under the exclusive lock
+          unresolved.push_back(&increment);
+        }
+      } else if (auto ptr = folly::get_ptr(counters.map, increment.key)) {
+        ptr->fetch_add(increment.amount, std::memory_order_relaxed);
+      } else {
+        unresolved.push_back(&increment);
+      }
+    }
+  }
+  if (unresolved.empty()) {
+    return;
+  }
+
+  auto countersWLock = counters_.wlock();
+  for (auto const* increment : unresolved) {
+    auto& ref = detail::cachedAddString(*countersWLock, increment->key, 0)
+                    .first->second;
+    ref.fetch_add(increment->amount, std::memory_order_relaxed);
+    if (auto handle = increment->handle) {
+      handle->counter_ = &ref;
+      handle->epoch_ = countersWLock->epoch;
+    }
+  }
+}
+
+class ServiceData::CounterRateSamples {
+ public:
+  // enough to cover the longest window at the sampling interval
+  static constexpr size_t kCapacity =
+      kCounterRateWindows[std::size(kCounterRateWindows) - 1] /
+          kCounterRateSampleInterval +
+      2;
+
+  /**
+   * Records the current value of the counter, if the previous sample is old
+   * enough, and returns its per-second rate of increase over window.
+   */
+  int64_t addAndGetRate(time_t now, int64_t value, time_t window) {
+    std::lock_guard lock(mutex_);
+    if (size_ > 0) {
+      auto const& last = at(size_ - 1);
+      if (value < last.value || now < last.time) {
+        // counter reset or clock stepped back
+        size_ = 0;
+      }
+    }
+    if (size_ == 0 || now - at(size_ - 1).time >= kCounterRateSampleInterval) {
+      if (size_ == kCapacity) {
+        begin_ = (begin_ + 1) % kCapacity;
+        --size_;
+      }
+      samples_[(begin_ + size_) % kCapacity] = {now, value};
+      ++size_;
+    }
+
+    // the most recent sample at least window old, else the oldest one
+    size_t base = 0;
+    while (base + 1 < size_ && at(base + 1).time <= now - window) {
+      ++base;
+    }
+    auto const& sample = at(base);
+    if (now <= sample.time) {
+      return 0;
+    }
+    auto const elapsed = now - sample.time;
+    return (value - sample.value + elapsed / 2) / elapsed;
+  }
+
+ private:
+  struct Sample {
+    time_t time;
+    int64_t value;
+  };
+
+  const Sample& at(size_t i) const {
+    return samples_[(begin_ + i) % kCapacity];
+  }
+
+  std::mutex mutex_;
+  // a ring of size_ samples, oldest first, starting at begin_
+  std::array<Sample, kCapacity> samples_;
+  size_t begin_{0};
+  size_t size_{0};
+};
+
+void ServiceData::addCounterRateExport(StringPiece key) {
+  auto samples = std::make_shared<CounterRateSamples>();
+  if (!counterRates_.wlock()->emplace(key.str(), samples).second) {
+    return;
+  }
+  for (auto const window : kCounterRateWindows) {
+    dynamicCounters_.registerCallback(
+        fmt::format("{}.rate.{}", key, window),
+        [this, key = key.str(), samples, window] {
+          std::optional<int64_t> value;
+          {
+            auto countersRLock = counters_.rlock();
+            auto const& map = countersRLock->map;
+            if (auto it = map.find(key); it != map.end()) {
+              value = it->second.load(std::memory_order_relaxed);
+            }
+          }
+          if (!value) {
+            if (auto arena = getSharedCounters()) {
+              value = arena->getTotal(key);
+            }
+          }
+          return samples->addAndGetRate(
+              get_legacy_stats_time(), value.value_or(0), window);
+        });
   }
 }
 
+void ServiceData::removeCounterRateExport(StringPiece key) {
+  {
+    auto counterRates = counterRates_.wlock();
+    auto it = counterRates->find(key);
+    if (it == counterRates->end()) {
+      return;
+    }
+    counterRates->erase(it);
+  }
+  for (auto const window : kCounterRateWindows) {
+    dynamicCounters_.unregisterCallback(fmt::format("{}.rate.{}", key, window));
+  }
+}
+
+std::vector<HotKeySampler::HotKey> ServiceData::getHotKeys(size_t k) const {
+  auto& sampler = HotKeySampler::get();
+  sampler.merge();
+  return sampler.getHotKeys(k);
+}
+
+void ServiceData::exportHotKeys(size_t k) {
+  dynamicStrings_.registerCallback("fb303.hot_keys", [this, k] {
+    std::string _return;
+    for (auto const& hotKey : getHotKeys(k)) {
+      _return += fmt::format("{} {:.1f}\n", hotKey.key, hotKey.rate);
+    }
+    return _return;
+  });
+}
+
+void ServiceData::setSharedCounters(
+    std::shared_ptr<SharedCounterArena> arena) {
+  *sharedCounters_.wlock() = std::move(arena);
+}
+
+std::shared_ptr<SharedCounterArena> ServiceData::getSharedCounters() const {
+  return *sharedCounters_.rlock();
+}
+
+std::shared_ptr<LabeledCounterFamily> ServiceData::addLabeledCounterFamily(
+    std::string_view name,
+    std::vector<std::string> labelNames,
+    size_t maxLabelSets) {
+  auto families = labeledCounters_.wlock();
+  auto it = families->find(name);
+  if (it == families->end()) {
+    auto family = std::make_shared<LabeledCounterFamily>(
+        std::string(name), std::move(labelNames), maxLabelSets);
+    it = families->emplace(std::string(name), std::move(family)).first;
+  } else if (it->second->getLabelNames() != labelNames) {
+    throw std::invalid_argument(fmt::format(
+        "labeled counter family {} exists with other labels", name));
+  }
+  return it->second;
+}
+
+std::shared_ptr<LabeledCounterFamily> ServiceData::getLabeledCounterFamily(
+    std::string_view name) const {
+  auto families = labeledCounters_.rlock();
+  auto it = families->find(name);
+  return it == families->end() ? nullptr : it->second;
+}
+
+std::vector<std::shared_ptr<LabeledCounterFamily>>
+ServiceData::getLabeledCounterFamilies() const {
+  std::vector<std::shared_ptr<LabeledCounterFamily>> _return;
+  auto families = labeledCounters_.rlock();
+  _return.reserve(families->size());
+  for (auto const& [_, family] : *families) {
+    _return.push_back(family);
+  }
+  return _return;
+}
+
+std::map<std::string, int64_t> ServiceData::getLabeledCounters(
+    std::string_view family,
+    const LabelSelector& selector) const {
+  std::map<std::string, int64_t> _return;
+  if (auto labeled = getLabeledCounterFamily(family)) {
+    labeled->getCounters(_return, selector);
+  }
+  return _return;
+}
+
 folly::Optional<int64_t> ServiceData::getCounterIfExists(
     StringPiece key) const {
   int64_t ret;
@@ -353,6 +627,13 @@ int64_t ServiceData::getCounter(StringPiece key) const {
 }
 
 void ServiceData::getCounters(std::map<std::string, int64_t>& _return) const {
+  getCounters(_return, std::chrono::steady_clock::now());
+}
+
+void ServiceData::getCounters(
+    std::map<std::string, int64_t>& _return,
+    std::chrono::steady_clock::time_point quantilesNow) const {
+  detail::ReadCallTimer timer(readStats_.getCounters, _return);
   {
     auto countersRLock = counters_.rlock();
     for (auto const& [name, value] : countersRLock->map) {
@@ -360,11 +641,98 @@ void ServiceData::getCounters(std::map<std::string, int64_t>& _return) const {
     }
   }
 
-  quantileMap_.getValues(_return);
+  quantileMap_.getValues(_return, quantilesNow);
+
+  for (auto const& family : getLabeledCounterFamilies()) {
+    family->getCounters(_return);
+  }
+
+  if (auto arena = getSharedCounters()) {
+    arena->getCounters(_return);
+  }
 
   dynamicCounters_.getCounters(&_return);
 }
 
+ServiceData::CountersSnapshot ServiceData::getCountersSnapshot() const {
+  CountersSnapshot snapshot;
+  auto const now = std::chrono::system_clock::now();
+  auto const steadyNow = std::chrono::steady_clock::now();
+  auto const legacyNow = std::chrono::system_clock::to_time_t(now);
+  snapshot.time = std::chrono::system_clock::from_time_t(legacyNow);
+
+  // The timeseries and histogram exports are evaluated by the dynamic
+  // counter callbacks, which read the time on this thread.
+  ScopedLegacyStatsTime scopedTime(legacyNow);
+  getCounters(snapshot.counters, steadyNow);
+  return snapshot;
+}
+
+size_t ServiceData::forEachCounter(
+    std::string_view from,
+    size_t limit,
+    folly::FunctionRef<void(const std::string&, int64_t)> fn) const {
+  auto countersRLock = counters_.rlock();
+  auto const& map = countersRLock->map;
+  size_t visited = 0;
+  for (auto it = map.lower_bound(from); it != map.end() && visited < limit;
+       ++it, ++visited) {
+    fn(it->first, it->second.load(std::memory_order_relaxed));
+  }
+  return visited;
+}
+
+void ServiceData::forEachCounterValue(
+    folly::FunctionRef<void(const std::string&, int64_t)> fn,
+    size_t batchSize) const {
+  batchSize = std::max<size_t>(batchSize, 1);
+  // Resume each batch from the least name greater than the last one.
+  std::string from;
+  while (true) {
+    size_t visited = 0;
+    auto const count = forEachCounter(
+        from, batchSize, [&](const std::string& name, int64_t value) {
+          fn(name, value);
+          if (++visited == batchSize) {
+            from = name;
+            from += '\0';
+          }
+        });
+    if (count < batchSize) {
+      break;
+    }
+  }
+
+  std::map<std::string, int64_t> quantiles;
+  quantileMap_.getValues(quantiles);
+  for (const auto& [name, value] : quantiles) {
+    fn(name, value);
+  }
+
+  for (auto const& family : getLabeledCounterFamilies()) {
+    std::vector<std::pair<std::string, int64_t>> labeled;
+    family->forEach(
+        {},
+        [&](uint32_t, const std::vector<std::string>& values, int64_t value) {
+          labeled.emplace_back(family->renderName(values), value);
+        });
+    for (auto const& [name, value] : labeled) {
+      fn(name, value);
+    }
+  }
+
+  if (auto arena = getSharedCounters()) {
+    std::map<std::string, int64_t> shared;
+    arena->getCounters(shared);
+    for (auto const& [name, value] : shared) {
+      fn(name, value);
+    }
+  }
+
+  dynamicCounters_.forEachValue(
+      [&](const std::string& name, int64_t&& value) { fn(name, value); });
+}
+
 void ServiceData::getKeys(std::vector<std::string>& keys) const {
   auto countersRLock = counters_.rlock();
   keys.reserve(keys.size() + countersRLock->map.size());
@@ -405,6 +773,13 @@ std::map<std::string, int64_t> ServiceData::getCounters() const {
 void ServiceData::getSelectedCounters(
     std::map<std::string, int64_t>& output,
     const std::vector<std::string>& keys) const {
+  detail::ReadCallTimer timer(readStats_.getSelectedCounters, output);
+  getSelectedCountersImpl(output, keys);
+}
+
+void ServiceData::getSelectedCountersImpl(
+    std::map<std::string, int64_t>& output,
+    const std::vector<std::string>& keys) const {
   // lock once and grab all the flat counters in one go...
   {
     auto countersRLock = counters_.rlock();
@@ -438,13 +813,14 @@ std::map<std::string, int64_t> ServiceData::getSelectedCounters(
 void ServiceData::getRegexCounters(
     std::map<std::string, int64_t>& _return,
     const std::string& regex) const {
+  detail::ReadCallTimer timer(readStats_.getRegexCounters, _return);
   const auto key = folly::RegexMatchCache::regex_key_and_view(regex);
   const auto now = folly::RegexMatchCache::clock::now();
   std::vector<std::string> keys;
   detail::cachedFindMatches(keys, counters_, key, now);
   quantileMap_.getRegexKeys(keys, key, now);
   dynamicCounters_.getRegexKeys(keys, key, now);
-  getSelectedCounters(_return, keys);
+  getSelectedCountersImpl(_return, keys);
 }
 
 std::map<std::string, int64_t> ServiceData::getRegexCounters(
@@ -454,6 +830,48 @@ std::map<std::string, int64_t> ServiceData::getRegexCounters(
   return _return;
 }
 
+void ServiceData::getPrefixedCounters(
+    std::map<std::string, int64_t>& _return,
+    std::string_view prefix) const {
+  {
+    auto countersRLock = counters_.rlock();
+    auto const& map = countersRLock->map;
+    for (auto it = map.lower_bound(prefix);
+         it != map.end() && it->first.starts_with(prefix);
+         ++it) {
+      _return[it->first] = it->second.load(std::memory_order_relaxed);
+    }
+  }
+
+  // The hashed maps have no order to range over, so they are matched against
+  // the equivalent regex, whose cache makes the calls after the first cheap.
+  constexpr std::string_view kSpecial = ".^$|()[]{}*+?\\";
+  std::string regex;
+  regex.reserve(prefix.size() * 2 + 2);
+  for (auto c : prefix) {
+    if (kSpecial.find(c) != std::string_view::npos) {
+      regex += '\\';
+    }
+    regex += c;
+  }
+  regex += ".*";
+  const auto key = folly::RegexMatchCache::regex_key_and_view(regex);
+  const auto now = folly::RegexMatchCache::clock::now();
+  std::vector<std::string> keys;
+  quantileMap_.getRegexKeys(keys, key, now);
+  dynamicCounters_.getRegexKeys(keys, key, now);
+  if (!keys.empty()) {
+    getSelectedCountersImpl(_return, keys);
+  }
+}
+
+std::map<std::string, int64_t> ServiceData::getPrefixedCounters(
+    std::string_view prefix) const {
+  std::map<std::string, int64_t> _return;
+  getPrefixedCounters(_return, prefix);
+  return _return;
+}
+
 void ServiceData::trimRegexCache(const std::chrono::seconds maxstale) {
   const auto now = folly::RegexMatchCache::clock::now();
   const auto expiry = now - maxstale;
@@ -462,6 +880,185 @@ void ServiceData::trimRegexCache(const std::chrono::seconds maxstale) {
   dynamicCounters_.trimRegexCache(expiry);
 }
 
+detail::RegexMatchCacheStats ServiceData::getRegexCacheStats(
+    std::string_view kind) const {
+  if (kind == "counters") {
+    return detail::cachedGetStats(counters_);
+  } else if (kind == "dynamic_counters") {
+    return dynamicCounters_.getRegexCacheStats();
+  } else if (kind == "quantiles") {
+    return quantileMap_.getRegexCacheStats();
+  }
+  throw std::invalid_argument(
+      folly::to<std::string>("no such regex cache \"", kind, "\""));
+}
+
+std::map<std::string, detail::RegexMatchCacheStats>
+ServiceData::getRegexCacheStats() const {
+  std::map<std::string, detail::RegexMatchCacheStats> _return;
+  for (auto const kind : kRegexCacheKinds) {
+    _return.emplace(kind, getRegexCacheStats(kind));
+  }
+  return _return;
+}
+
+void ServiceData::exportRegexCacheStats() {
+  using Stats = detail::RegexMatchCacheStats;
+  static constexpr std::pair<std::string_view, uint64_t Stats::*> kFields[] = {
+      {"hits", &Stats::hits},
+      {"misses", &Stats::misses},
+      {"evictions", &Stats::evictions},
+      {"regexes", &Stats::regexes},
+      {"matches", &Stats::matches},
+  };
+  for (auto const kind : kRegexCacheKinds) {
+    for (auto const& [name, field] : kFields) {
+      dynamicCounters_.registerCallback(
+          fmt::format("fb303.regex_cache.{}.{}", kind, name),
+          [this, kind, field = field] {
+            return static_cast<int64_t>(getRegexCacheStats(kind).*field);
+          });
+    }
+  }
+}
+
+void ServiceData::exportSelfStats() {
+  detail::setSelfStatsEnabled(true);
+
+  using Stats = detail::ReadCallStats;
+  using Field = folly::relaxed_atomic<uint64_t> Stats::*;
+  static constexpr std::pair<std::string_view, Stats ReadStats::*> kCalls[] = {
+      {"getCounters", &ReadStats::getCounters},
+      {"getRegexCounters", &ReadStats::getRegexCounters},
+      {"getSelectedCounters", &ReadStats::getSelectedCounters},
+  };
+  static constexpr std::pair<std::string_view, Field> kCallFields[] = {
+      {"calls", &Stats::calls},
+      {"keys", &Stats::keys},
+      {"time_us", &Stats::timeUs},
+  };
+  for (auto const& [call, stats] : kCalls) {
+    for (auto const& [name, field] : kCallFields) {
+      dynamicCounters_.registerCallback(
+          fmt::format("fb303.{}.{}", call, name),
+          [this, stats = stats, field = field] {
+            return static_cast<int64_t>((readStats_.*stats).*field);
+          });
+    }
+  }
+
+  for (size_t i = 0; i < size_t(detail::LockSite::kNumSites); ++i) {
+    auto& wait = detail::lockSiteStats(detail::LockSite(i)).wait;
+    auto const site = detail::kLockSiteNames[i];
+    dynamicCounters_.registerCallback(
+        fmt::format("fb303.lock.{}.acquisitions", site),
+        [&wait] { return static_cast<int64_t>(wait.get().count); });
+    dynamicCounters_.registerCallback(
+        fmt::format("fb303.lock.{}.wait_ns", site),
+        [&wait] { return static_cast<int64_t>(wait.get().sumNs); });
+  }
+
+  dynamicCounters_.registerCallback("fb303.registrations.stats", [this] {
+    return static_cast<int64_t>(statsMap_.getNumStatsCreated());
+  });
+  dynamicCounters_.registerCallback("fb303.registrations.histograms", [this] {
+    return static_cast<int64_t>(histMap_.getNumHistogramsCreated());
+  });
+  dynamicCounters_.registerCallback("fb303.registrations.callbacks", [this] {
+    return static_cast<int64_t>(dynamicCounters_.getNumRegistrations());
+  });
+
+  exportRegexCacheStats();
+}
+
+void ServiceData::setLockProfilingEnabled(bool enabled) {
+  detail::setLockProfilingEnabled(enabled);
+}
+
+std::map<std::string, detail::LockSiteProfile> ServiceData::getLockProfile()
+    const {
+  std::map<std::string, detail::LockSiteProfile> _return;
+  for (size_t i = 0; i < size_t(detail::LockSite::kNumSites); ++i) {
+    auto const& stats = detail::lockSiteStats(detail::LockSite(i));
+    _return.emplace(
+        detail::kLockSiteNames[i],
+        detail::LockSiteProfile{stats.wait.get(), stats.hold.get()});
+  }
+  return _return;
+}
+
+std::string ServiceData::dumpLockProfile() const {
+  constexpr std::string_view kRow =
+      "{:<14}{:<6}{:>12}{:>14}{:>14}{:>14}{:>16}\n";
+  std::string out = fmt::format(
+      fmt::runtime(kRow),
+      "site",
+      "kind",
+      "count",
+      "p50_ns",
+      "p99_ns",
+      "p999_ns",
+      "sum_ns");
+  for (auto const& [site, profile] : getLockProfile()) {
+    for (auto const& [kind, times] :
+         {std::pair{"wait", &profile.wait}, std::pair{"hold", &profile.hold}}) {
+      out += fmt::format(
+          fmt::runtime(kRow),
+          site,
+          kind,
+          times->count,
+          times->getPercentileNs(50),
+          times->getPercentileNs(99),
+          times->getPercentileNs(99.9),
+          times->sumNs);
+    }
+  }
+  return out;
+}
+
+void ServiceData::resetLockProfile() {
+  for (size_t i = 0; i < size_t(detail::LockSite::kNumSites); ++i) {
+    auto& stats = detail::lockSiteStats(detail::LockSite(i));
+    stats.wait.clear();
+    stats.hold.clear();
+  }
+}
+
+void ServiceData::exportLockProfile() {
+  using Histogram = detail::LockTimeHistogram;
+  using Stats = detail::LockSiteStats;
+  static constexpr std::pair<std::string_view, Histogram Stats::*> kKinds[] = {
+      {"wait_ns", &Stats::wait},
+      {"hold_ns", &Stats::hold},
+  };
+  static constexpr std::pair<std::string_view, double> kPercentiles[] = {
+      {"p50", 50},
+      {"p99", 99},
+      {"p999", 99.9},
+  };
+  for (size_t i = 0; i < size_t(detail::LockSite::kNumSites); ++i) {
+    auto& stats = detail::lockSiteStats(detail::LockSite(i));
+    auto const site = detail::kLockSiteNames[i];
+    for (auto const& [kind, histogram] : kKinds) {
+      auto& hist = stats.*histogram;
+      for (auto const& [name, pct] : kPercentiles) {
+        dynamicCounters_.registerCallback(
+            fmt::format("fb303.lock.{}.{}.{}", site, kind, name),
+            [&hist, pct = pct] {
+              return static_cast<int64_t>(hist.get().getPercentileNs(pct));
+            });
+      }
+    }
+    auto& hold = stats.hold;
+    dynamicCounters_.registerCallback(
+        fmt::format("fb303.lock.{}.holds", site),
+        [&hold] { return static_cast<int64_t>(hold.get().count); });
+    dynamicCounters_.registerCallback(
+        fmt::format("fb303.lock.{}.hold_ns", site),
+        [&hold] { return static_cast<int64_t>(hold.get().sumNs); });
+  }
+}
+
 bool ServiceData::hasCounter(StringPiece key) const {
   if (dynamicCounters_.contains(key)) {
     return true;
@@ -598,6 +1195,7 @@ void ServiceData::setUseOptionsAsFlags(bool useOptionsAsFlags) {
                  << "configerator to set properties dynamically";
   }
   useOptionsAsFlags_.store(useOptionsAsFlags, std::memory_order_relaxed);
+  invalidateOptions();
 }
 
 bool ServiceData::getUseOptionsAsFlags() const {
@@ -611,6 +1209,11 @@ void ServiceData::setOption(StringPiece key, StringPiece value) {
 ServiceData::SetOptionResult ServiceData::setOptionWithResult(
     std::string_view key,
     std::string_view value) {
+  // even if setting the option fails, part of it may have been applied
+  SCOPE_EXIT {
+    invalidateOptions();
+  };
+
   // Check to see if a dynamic option is registered for this key
   {
     auto dynamicOptionsRLock = dynamicOptions_.rlock();
@@ -705,7 +1308,11 @@ std::string ServiceData::getOption(StringPiece key) const {
 
 void ServiceData::getOptions(
     std::map<std::string, std::string>& _return) const {
-  _return.clear();
+  _return = getOptionsSnapshot()->options;
+}
+
+void ServiceData::collectOptions(
+    std::map<std::string, std::string>& _return) const {
 
   options_.withRLock([&](auto const& options) {
     for (auto const& entry : options) {
@@ -755,6 +1362,115 @@ void ServiceData::registerDynamicOption(
     DynamicOptionSetter setter) {
   auto option = DynamicOption(std::move(getter), std::move(setter));
   std::swap((*dynamicOptions_.wlock())[name], option);
+  invalidateOptions();
+}
+
+void ServiceData::invalidateOptions() {
+  optionsInvalidations_.fetch_add(1, std::memory_order_acq_rel);
+}
+
+bool ServiceData::isOptionsCacheFresh(
+    const OptionsCache& cache,
+    uint64_t invalidations,
+    std::chrono::steady_clock::time_point now) const {
+  auto const ttl = std::chrono::milliseconds(FLAGS_fb303_options_cache_ttl_ms);
+  return cache.snapshot && cache.invalidations == invalidations &&
+      now - cache.collectedAt < ttl;
+}
+
+std::shared_ptr<const ServiceData::OptionsSnapshot>
+ServiceData::getOptionsSnapshot() const {
+  // read before collecting, so that an invalidation racing with the
+  // collection makes the next call collect again
+  auto const invalidations =
+      optionsInvalidations_.load(std::memory_order_acquire);
+  auto const now = std::chrono::steady_clock::now();
+  {
+    auto cache = optionsCache_.rlock();
+    if (isOptionsCacheFresh(*cache, invalidations, now)) {
+      return cache->snapshot;
+    }
+  }
+
+  // Collect without the lock: the dynamic option getters are user code,
+  // which may be slow, or call back into this ServiceData.
+  std::map<std::string, std::string> options;
+  collectOptions(options);
+
+  auto cache = optionsCache_.wlock();
+  // a concurrent caller may have installed options collected after ours
+  if (cache->snapshot &&
+      (cache->invalidations > invalidations ||
+       (cache->invalidations == invalidations && cache->collectedAt > now))) {
+    return cache->snapshot;
+  }
+
+  static const std::map<std::string, std::string> kNoOptions;
+  auto const& previous =
+      cache->snapshot ? cache->snapshot->options : kNoOptions;
+  auto const version = cache->snapshot ? cache->snapshot->version + 1 : 1;
+  bool changed = false;
+  for (auto const& [key, value] : options) {
+    auto it = previous.find(key);
+    if (it == previous.end() || it->second != value) {
+      cache->changedAt[key] = version;
+      cache->removedAt.erase(key);
+      changed = true;
+    }
+  }
+  for (auto const& [key, _] : previous) {
+    if (!options.count(key)) {
+      cache->changedAt.erase(key);
+      cache->removedAt[key] = version;
+      changed = true;
+    }
+  }
+  if (changed || !cache->snapshot) {
+    cache->snapshot = std::make_shared<const OptionsSnapshot>(
+        OptionsSnapshot{version, std::move(options)});
+  }
+  // forget the removals older than kOptionsDeltaHistory versions, so that
+  // churning option names do not accumulate; at most every
+  // kOptionsDeltaHistory versions, to amortize the walk
+  if (changed && version > cache->removedSince + 2 * kOptionsDeltaHistory) {
+    cache->removedSince = version - kOptionsDeltaHistory;
+    for (auto it = cache->removedAt.begin(); it != cache->removedAt.end();) {
+      if (it->second <= cache->removedSince) {
+        it = cache->removedAt.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+  cache->invalidations = invalidations;
+  cache->collectedAt = now;
+  return cache->snapshot;
+}
+
+ServiceData::OptionsDelta ServiceData::getOptionsSince(
+    uint64_t version) const {
+  getOptionsSnapshot();
+  auto cache = optionsCache_.rlock();
+  auto const& snapshot = *cache->snapshot;
+  OptionsDelta delta{snapshot.version, {}, {}};
+  if (version == 0 || version > snapshot.version ||
+      version < cache->removedSince) {
+    delta.changed = snapshot.options;
+    delta.full = true;
+    return delta;
+  }
+  for (auto const& [key, changedAt] : cache->changedAt) {
+    if (changedAt > version) {
+      delta.changed.emplace(key, snapshot.options.at(key));
+    }
+  }
+  for (auto const& [key, removedAt] : cache->removedAt) {
+    if (removedAt > version) {
+      delta.removed.push_back(key);
+    }
+  }
+  std::sort(delta.removed.begin(), delta.removed.end());
+  return delta;
 }
 
 } // namespace facebook::fb303
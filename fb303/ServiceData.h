@@ -18,16 +18,24 @@
 
 #include <fb303/ExportedHistogramMapImpl.h>
 #include <fb303/ExportedStatMapImpl.h>
+#include <fb303/HotKeySampler.h>
+#include <fb303/LabeledCounters.h>
+#include <fb303/SharedCounterArena.h>
 
 #include <fb303/DynamicCounters.h>
 #include <fb303/detail/QuantileStatMap.h>
+#include <fb303/detail/LockProfile.h>
+#include <fb303/detail/RegexUtil.h>
+#include <fb303/detail/SelfStats.h>
 #include <folly/Chrono.h>
+#include <folly/Function.h>
 #include <folly/Optional.h>
 #include <folly/Range.h>
 #include <folly/Synchronized.h>
 #include <folly/container/F14Map.h>
 #include <folly/container/RegexMatchCache.h>
 #include <folly/synchronization/RelaxedAtomic.h>
+#include <gflags/gflags.h>
 
 #include <fb303/LegacyClock.h>
 #include <atomic>
@@ -35,10 +43,13 @@
 #include <cinttypes>
 #include <functional>
 #include <map>
+#include <memory>
 #include <string>
 #include <string_view>
 #include <vector>
 
+DECLARE_uint32(fb303_options_cache_ttl_ms);
+
 namespace facebook::fb303 {
 
 /*
@@ -205,6 +216,19 @@ class ServiceData {
       const ExportedStat* statPrototype,
       bool updateOnRead);
 
+  /**
+   * Exports each of the given stats with each of the given export types, as-if
+   * by calling addStatExportType() for each pair, but registering all of the
+   * resulting counters at once. This is much cheaper for registering many
+   * stats at startup, since the locks are acquired and the regex-match-cache
+   * updated once per call rather than once per counter.
+   */
+  void addStatExportTypes(
+      folly::Range<const std::string*> keys,
+      folly::Range<const ExportType*> exportTypes,
+      const ExportedStat* statPrototype = nullptr,
+      bool updateOnRead = true);
+
   /**
    *  Convenience function for simultaneously adding and exporting stats and a
    *  histogram with several percentiles at once.  The 'stats' input string is a
@@ -446,6 +470,129 @@ class ServiceData {
   /*** Clear any flat counter with that name */
   void clearCounter(folly::StringPiece key);
 
+  /**
+   * Remembers where a flat counter lives, so that incrementCounters() can
+   * skip looking it up by name. It stays valid until a flat counter of the
+   * ServiceData it was resolved by is cleared, after which it is resolved
+   * again. Must only be used with that ServiceData.
+   */
+  class CounterHandle {
+   private:
+    friend class ServiceData;
+    // read under the shared lock of the counters, written under the
+    // exclusive one
+    std::atomic<int64_t>* counter_{nullptr};
+    uint64_t epoch_{0};
+  };
+
+  struct CounterIncrement {
+    folly::StringPiece key;
+    int64_t amount;
+    // resolved by the first increment, if not null
+    CounterHandle* handle{nullptr};
+  };
+
+  /**
+   * Applies many flat counter increments at once, under a single shared lock
+   * of the counters, plus a single exclusive one if some counters have to be
+   * created or handles resolved, instead of one lock and lookup per counter
+   * with incrementCounter(). Since each increment may aggregate any number
+   * of updates, they are not reported to HotKeySampler.
+   */
+  void incrementCounters(folly::Range<const CounterIncrement*> increments);
+
+  /**
+   * Like incrementCounter() and setCounter(), but go through handle, which
+   * is resolved on first use like those of incrementCounters(), instead of
+   * looking the counter up by name. Concurrent calls may share a handle.
+   */
+  int64_t incrementCounter(
+      CounterHandle& handle,
+      folly::StringPiece key,
+      int64_t amount);
+  int64_t
+  setCounter(CounterHandle& handle, folly::StringPiece key, int64_t value);
+
+  /**
+   * Exports "<key>.rate.60" and "<key>.rate.600": the per-second rate of
+   * increase of the flat counter key, rounded to an integer, over about the
+   * last minute and ten minutes, for cumulative counters maintained with
+   * incrementCounter().
+   *
+   * The rates are derived when they are read, from a bounded ring of
+   * (time, value) samples of the counter which the reads themselves record,
+   * at most one every kCounterRateSampleInterval seconds, so that
+   * incrementCounter() does no more work than before. Until a window is
+   * covered by the samples, the rate is over the time covered so far. A
+   * decrease of the counter, e.g. if it is cleared, restarts the samples.
+   *
+   * Calling this again for the same key has no effect.
+   */
+  void addCounterRateExport(folly::StringPiece key);
+  /*** Stops exporting the rates of the counter and drops its samples */
+  void removeCounterRateExport(folly::StringPiece key);
+
+  static constexpr time_t kCounterRateSampleInterval = 10;
+  static constexpr time_t kCounterRateWindows[] = {60, 600};
+
+  /**
+   * Returns the family of labeled counters with the given name, creating it
+   * if needed; see LabeledCounterFamily. Its counters are included in
+   * getCounters() and forEachCounterValue() under their rendered flat names,
+   * but not in the other read methods, which look counters up by name;
+   * select them by label with getLabeledCounters() instead.
+   *
+   * Throws std::invalid_argument if the family exists with other labels.
+   */
+  std::shared_ptr<LabeledCounterFamily> addLabeledCounterFamily(
+      std::string_view name,
+      std::vector<std::string> labelNames,
+      size_t maxLabelSets = kDefaultMaxLabelSets);
+  /*** Returns the family with the given name, or nullptr */
+  std::shared_ptr<LabeledCounterFamily> getLabeledCounterFamily(
+      std::string_view name) const;
+  /**
+   * Retrieves the counters of the family whose label sets match selector,
+   * keyed by their rendered flat names. Returns nothing if there is no such
+   * family.
+   */
+  std::map<std::string, int64_t> getLabeledCounters(
+      std::string_view family,
+      const LabelSelector& selector = {}) const;
+  /*** Returns all the families, in name order */
+  std::vector<std::shared_ptr<LabeledCounterFamily>>
+  getLabeledCounterFamilies() const;
+
+  static constexpr size_t kDefaultMaxLabelSets = 1000;
+
+  /**
+   * Returns the k keys whose stats were updated the most during the last
+   * window of HotKeySampler, hottest first, with their estimated update
+   * rates. Empty unless sampling was enabled with
+   * HotKeySampler::get().setSamplingPeriod(). Merges the samples first, so
+   * that the window ends on time even without
+   * ThreadCachedServiceData::publishStats().
+   */
+  std::vector<HotKeySampler::HotKey> getHotKeys(size_t k = 10) const;
+
+  /**
+   * Exports getHotKeys(k) as the exported value "fb303.hot_keys", with a
+   * "<key> <updates per second>" line per key.
+   */
+  void exportHotKeys(size_t k = 10);
+
+  /**
+   * Includes the totals of the counters of arena, which the processes forked
+   * from this one add to, in getCounters() and forEachCounterValue(), so that
+   * any of them reports the totals across the processes; see
+   * SharedCounterArena. addCounterRateExport() also works for them, but as
+   * with labeled counters, the other read methods do not see them. Passing
+   * nullptr stops including them.
+   */
+  void setSharedCounters(std::shared_ptr<SharedCounterArena> arena);
+  /*** Returns the arena set by setSharedCounters(), or nullptr */
+  std::shared_ptr<SharedCounterArena> getSharedCounters() const;
+
   /**
    * Retrieves a counter value for given key (could be regular or dynamic)
    *
@@ -472,6 +619,53 @@ class ServiceData {
   void getCounters(std::map<std::string, int64_t>& _return) const;
   std::map<std::string, int64_t> getCounters() const;
 
+  struct CountersSnapshot {
+    // the single time at which all the stats were evaluated, at the second
+    // precision of get_legacy_stats_time()
+    std::chrono::system_clock::time_point time;
+    std::map<std::string, int64_t> counters;
+  };
+
+  /**
+   * Like getCounters(), but evaluates all the timeseries, histogram and
+   * quantile exports as of a single time, returned along with the counters,
+   * so that related counters, such as "requests.sum.60" and "errors.sum.60",
+   * cover the same window even if the read is slow or straddles a second.
+   *
+   * No lock is held across the whole read: each stat is only read-locked
+   * while its own values are computed, as with getCounters(), so that writers
+   * block for no longer than they otherwise would. Values added meanwhile
+   * may or may not be included, and dynamic counters registered by the
+   * application are evaluated whenever their callbacks run.
+   */
+  CountersSnapshot getCountersSnapshot() const;
+
+  /**
+   * Passes the flat counters whose names are not less than 'from' to fn, in
+   * name order, stopping after 'limit' counters, and returns how many were
+   * passed. Returns less than limit once the end is reached.
+   *
+   * fn is invoked under the shared lock of the flat counters, so it should
+   * not block. Meant for streaming all the counters out in batches, resuming
+   * each batch after the last name of the previous one, without copying them
+   * into a map nor holding the lock across the whole traversal. Dynamic
+   * counters are not visited; see DynamicCounters::forEachValue().
+   */
+  size_t forEachCounter(
+      std::string_view from,
+      size_t limit,
+      folly::FunctionRef<void(const std::string&, int64_t)> fn) const;
+
+  /**
+   * Passes every counter that getCounters() would return, i.e. the flat,
+   * quantile and dynamic counters, to fn, without collecting them into a map.
+   * The flat counters are passed in batches of batchSize under their shared
+   * lock, as with forEachCounter(); the others without any lock held.
+   */
+  void forEachCounterValue(
+      folly::FunctionRef<void(const std::string&, int64_t)> fn,
+      size_t batchSize = 4096) const;
+
   /*** Retrieves a list of counter values (could be regular or dynamic) */
   void getSelectedCounters(
       std::map<std::string, int64_t>& _return,
@@ -484,8 +678,95 @@ class ServiceData {
       const std::string& regex) const;
   std::map<std::string, int64_t> getRegexCounters(
       const std::string& regex) const;
+  /**
+   * Retrieves the counters whose names start with prefix. The flat counters
+   * are read off a range of their ordered map. The quantile and dynamic
+   * counters are hashed, so they are matched like getRegexCounters() with
+   * the escaped prefix: the first call for a prefix scans all of their names,
+   * and the next ones only the names added since, until the regex is evicted.
+   */
+  void getPrefixedCounters(
+      std::map<std::string, int64_t>& _return,
+      std::string_view prefix) const;
+  std::map<std::string, int64_t> getPrefixedCounters(
+      std::string_view prefix) const;
 
   void trimRegexCache(std::chrono::seconds maxstale);
+
+  /**
+   * Returns counters describing the regex-match-caches which serve
+   * getRegexCounters(), keyed by the kind of counter they index: "counters",
+   * "dynamic_counters" and "quantiles".
+   *
+   * The single-kind form throws std::invalid_argument for any other kind.
+   */
+  std::map<std::string, fb303::detail::RegexMatchCacheStats>
+  getRegexCacheStats() const;
+  fb303::detail::RegexMatchCacheStats getRegexCacheStats(
+      std::string_view kind) const;
+
+  /**
+   * Exports getRegexCacheStats() as dynamic counters of the form
+   * "fb303.regex_cache.<kind>.{hits,misses,evictions,regexes,matches}".
+   *
+   * This is opt-in, since the exported counters are visible to all clients.
+   */
+  void exportRegexCacheStats();
+
+  /**
+   * Enables, for the whole process, the statistics fb303 keeps about its own
+   * operation, and exports them as dynamic counters under the "fb303." prefix:
+   *
+   * - "fb303.<call>.{calls,keys,time_us}": cumulative calls to, counters
+   *   returned by and time spent in getCounters(), getRegexCounters() and
+   *   getSelectedCounters();
+   * - "fb303.lock.<site>.{acquisitions,wait_ns}": cumulative blocking
+   *   acquisitions of, and time spent waiting for, the fb303 locks of each
+   *   site (see detail::LockSite), across all instances;
+   * - "fb303.registrations.{stats,histograms,callbacks}": cumulative
+   *   timeseries and histograms created and dynamic counters registered;
+   * - the regex-match-cache counters of exportRegexCacheStats().
+   *
+   * All are cumulative, to be turned into rates by the monitoring system.
+   * This is opt-in, since the exported counters are visible to all clients
+   * and recording them puts timing calls on the hot paths.
+   */
+  void exportSelfStats();
+
+  /**
+   * Switches, for the whole process, the profiling of the fb303 locks: the
+   * time spent waiting for and holding the locks of each site (see
+   * detail::LockSite), i.e. the flat counters map, the dynamic callback maps,
+   * the individual stats and histograms and the thread-local stats
+   * registries, is recorded into log2-bucketed histograms.
+   *
+   * Profiling adds clock reads and thread-local bookkeeping to every lock
+   * operation, so is meant to be enabled while investigating contention.
+   */
+  void setLockProfilingEnabled(bool enabled);
+
+  /**
+   * Returns the lock wait and hold time distributions, keyed by site, since
+   * the start of the process or the last resetLockProfile(). The dump form
+   * formats them as a table.
+   */
+  std::map<std::string, fb303::detail::LockSiteProfile> getLockProfile() const;
+  std::string dumpLockProfile() const;
+
+  /**
+   * Clears the lock profile, including the wait counts and times exported by
+   * exportSelfStats().
+   */
+  void resetLockProfile();
+
+  /**
+   * Exports getLockProfile() as dynamic counters of the form
+   * "fb303.lock.<site>.{wait_ns,hold_ns}.{p50,p99,p999}", along with
+   * "fb303.lock.<site>.{holds,hold_ns}" for the count and sum of hold times.
+   * Percentiles are upper bounds of log2 buckets, over the whole profile.
+   */
+  void exportLockProfile();
+
   /*** Returns true if a counter exists with the specified name */
   bool hasCounter(folly::StringPiece key) const;
 
@@ -556,9 +837,64 @@ class ServiceData {
    * Throws std::invalid_argument if no option with this name exists.
    */
   std::string getOption(folly::StringPiece key) const;
+  /**
+   * Retrieves the options from getOptionsSnapshot(), so they may be up to
+   * --fb303_options_cache_ttl_ms stale when it is set.
+   */
   void getOptions(std::map<std::string, std::string>& _return) const;
   std::map<std::string, std::string> getOptions() const;
 
+  struct OptionsSnapshot {
+    // incremented each time an option changes, starting from 1
+    uint64_t version;
+    std::map<std::string, std::string> options;
+  };
+
+  /**
+   * Returns all the options: the static ones, the values of the dynamic
+   * option getters and, with useOptionsAsFlags, all the gflags.
+   *
+   * They are collected on every call by default. Collecting them can be
+   * expensive, so setting --fb303_options_cache_ttl_ms caches them until
+   * setOption(), registerDynamicOption(), setUseOptionsAsFlags(),
+   * resetAllData() or invalidateOptions() is called, or for at most that
+   * long. The TTL bounds how long changes made elsewhere, e.g. flags set
+   * directly or values the getters return, go unnoticed.
+   *
+   * The getters are called without the lock of the cache held, so a slow
+   * one does not block the callers served from the cache.
+   */
+  std::shared_ptr<const OptionsSnapshot> getOptionsSnapshot() const;
+
+  struct OptionsDelta {
+    uint64_t version;
+    // the options which were added or changed since the given version
+    std::map<std::string, std::string> changed;
+    // the options which were removed since the given version
+    std::vector<std::string> removed;
+    // whether changed holds all the options, instead of the changes, in which
+    // case the options missing from it were removed
+    bool full{false};
+  };
+
+  // how many versions back getOptionsSince() remembers the removed options
+  static constexpr uint64_t kOptionsDeltaHistory = 256;
+
+  /**
+   * Returns the changes of the options since the given version of
+   * getOptionsSnapshot(), or all the options if version is 0, newer than the
+   * current one, or more than kOptionsDeltaHistory versions old. Versions are
+   * specific to this instance, so callers should start over when
+   * getAliveSince() changes.
+   */
+  OptionsDelta getOptionsSince(uint64_t version) const;
+
+  /**
+   * Makes the next getOptionsSnapshot() collect the options again, e.g.
+   * after setting flags without going through setOption().
+   */
+  void invalidateOptions();
+
   void mergeOptionsWithGflags(
       std::map<std::string, std::string>& _return) const;
 
@@ -591,10 +927,22 @@ class ServiceData {
   template <typename Mapped>
   using StringKeyedMap = folly::F14FastMap<std::string, Mapped>;
 
+  static constexpr std::string_view kRegexCacheKinds[] = {
+      "counters",
+      "dynamic_counters",
+      "quantiles",
+  };
+
   void getKeys(std::vector<std::string>& keys) const;
+  void getCounters(
+      std::map<std::string, int64_t>& _return,
+      std::chrono::steady_clock::time_point quantilesNow) const;
+  void getSelectedCountersImpl(
+      std::map<std::string, int64_t>& output,
+      const std::vector<std::string>& keys) const;
 
   template <class F>
-  int64_t modifyCounter(folly::StringPiece key, F f);
+  int64_t modifyCounter(folly::StringPiece key, CounterHandle* handle, F f);
 
   const std::chrono::seconds aliveSince_;
 
@@ -606,9 +954,22 @@ class ServiceData {
   template <typename Mapped>
   struct MapWithKeyCache {
     std::map<std::string, Mapped, std::less<>> map;
-    folly::RegexMatchCache matches; // requires map to have reference stability
+    // requires map to have reference stability
+    fb303::detail::DeferredRegexMatchCache matches;
+    // incremented when entries are erased, invalidating the CounterHandles
+    uint64_t epoch{0};
+  };
+  folly::Synchronized<
+      MapWithKeyCache<Counter>,
+      fb303::detail::ProfiledSharedMutex<fb303::detail::LockSite::kCounters>>
+      counters_;
+
+  struct ReadStats {
+    fb303::detail::ReadCallStats getCounters;
+    fb303::detail::ReadCallStats getRegexCounters;
+    fb303::detail::ReadCallStats getSelectedCounters;
   };
-  folly::Synchronized<MapWithKeyCache<Counter>> counters_;
+  mutable ReadStats readStats_;
 
   folly::Synchronized<StringKeyedMap<folly::Synchronized<std::string>>>
       exportedValues_;
@@ -628,6 +989,40 @@ class ServiceData {
     DynamicOptionSetter setter;
   };
   folly::Synchronized<StringKeyedMap<DynamicOption>> dynamicOptions_;
+
+  struct OptionsCache {
+    // the value of optionsInvalidations_ snapshot was collected at
+    uint64_t invalidations{0};
+    std::chrono::steady_clock::time_point collectedAt;
+    std::shared_ptr<const OptionsSnapshot> snapshot;
+    // the versions each option last changed, or was removed, at
+    StringKeyedMap<uint64_t> changedAt;
+    StringKeyedMap<uint64_t> removedAt;
+    // removedAt only holds the removals after this version
+    uint64_t removedSince{0};
+  };
+  void collectOptions(std::map<std::string, std::string>& _return) const;
+  bool isOptionsCacheFresh(
+      const OptionsCache& cache,
+      uint64_t invalidations,
+      std::chrono::steady_clock::time_point now) const;
+
+  std::atomic<uint64_t> optionsInvalidations_{0};
+  mutable folly::Synchronized<OptionsCache> optionsCache_;
+
+  // Samples of the counters exported by addCounterRateExport(); shared with
+  // the callbacks computing the rates.
+  class CounterRateSamples;
+  folly::Synchronized<StringKeyedMap<std::shared_ptr<CounterRateSamples>>>
+      counterRates_;
+
+  folly::Synchronized<std::map<
+      std::string,
+      std::shared_ptr<LabeledCounterFamily>,
+      std::less<>>>
+      labeledCounters_;
+
+  folly::Synchronized<std::shared_ptr<SharedCounterArena>> sharedCounters_;
 };
 
 // A "pseudo-pointer" to the ServiceData singleton.
@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fb303/ServiceDataView.h>
+
+#include <utility>
+
+#include <fb303/LegacyClock.h>
+
+namespace facebook::fb303 {
+
+ServiceDataView::ServiceDataView(
+    ServiceData& serviceData,
+    std::string_view prefix)
+    : state_(std::make_shared<State>(serviceData, std::string(prefix))) {}
+
+ServiceDataView ServiceDataView::subView(std::string_view prefix) const {
+  std::string full;
+  full.reserve(getPrefix().size() + prefix.size());
+  full += getPrefix();
+  full += prefix;
+  return ServiceDataView(getServiceData(), full);
+}
+
+std::string ServiceDataView::makeKey(std::string_view key) const {
+  std::string full;
+  full.reserve(getPrefix().size() + key.size());
+  full += getPrefix();
+  full += key;
+  return full;
+}
+
+ServiceDataView::Entry& ServiceDataView::getOrAddEntry(
+    EntryMap& entries,
+    std::string_view key) const {
+  auto it = entries.find(key);
+  if (it == entries.end()) {
+    it = entries.try_emplace(std::string(key), makeKey(key)).first;
+  }
+  return it->second;
+}
+
+const ServiceDataView::Entry& ServiceDataView::getEntry(
+    std::string_view key) const {
+  {
+    auto entries = state_->entries.rlock();
+    if (auto it = entries->find(key); it != entries->end()) {
+      // entries are never erased, and their keys never change
+      return it->second;
+    }
+  }
+  return getOrAddEntry(*state_->entries.wlock(), key);
+}
+
+const std::string& ServiceDataView::getKey(std::string_view key) const {
+  return getEntry(key).key;
+}
+
+const ExportedStatMapImpl::LockableStat& ServiceDataView::getStat(
+    std::string_view key,
+    const ExportType* exportType) const {
+  {
+    auto entries = state_->entries.rlock();
+    if (auto it = entries->find(key);
+        it != entries->end() && !it->second.stat.isNull()) {
+      return it->second.stat;
+    }
+  }
+  auto entries = state_->entries.wlock();
+  auto& entry = getOrAddEntry(*entries, key);
+  if (entry.stat.isNull()) {
+    entry.stat =
+        getServiceData().getStatMap()->getLockableStat(entry.key, exportType);
+  }
+  return entry.stat;
+}
+
+const ExportedHistogramMapImpl::LockableHistogram*
+ServiceDataView::getHistogram(std::string_view key) const {
+  {
+    auto entries = state_->entries.rlock();
+    if (auto it = entries->find(key);
+        it != entries->end() && !it->second.histogram.isNull()) {
+      return &it->second.histogram;
+    }
+  }
+  auto entries = state_->entries.wlock();
+  auto& entry = getOrAddEntry(*entries, key);
+  if (entry.histogram.isNull()) {
+    // not cached until the histogram is added
+    entry.histogram =
+        getServiceData().getHistogramMap()->getLockableHistogram(entry.key);
+  }
+  return entry.histogram.isNull() ? nullptr : &entry.histogram;
+}
+
+int64_t ServiceDataView::incrementCounter(
+    std::string_view key,
+    int64_t amount) const {
+  auto& entry = getEntry(key);
+  return getServiceData().incrementCounter(entry.counter, entry.key, amount);
+}
+
+int64_t ServiceDataView::setCounter(std::string_view key, int64_t value)
+    const {
+  auto& entry = getEntry(key);
+  return getServiceData().setCounter(entry.counter, entry.key, value);
+}
+
+void ServiceDataView::clearCounter(std::string_view key) const {
+  getServiceData().clearCounter(getKey(key));
+}
+
+folly::Optional<int64_t> ServiceDataView::getCounterIfExists(
+    std::string_view key) const {
+  return getServiceData().getCounterIfExists(getKey(key));
+}
+
+int64_t ServiceDataView::getCounter(std::string_view key) const {
+  return getServiceData().getCounter(getKey(key));
+}
+
+std::map<std::string, int64_t> ServiceDataView::getCounters() const {
+  auto const& prefix = getPrefix();
+  std::map<std::string, int64_t> _return;
+  for (auto& [name, value] : getServiceData().getPrefixedCounters(prefix)) {
+    _return.emplace_hint(_return.end(), name.substr(prefix.size()), value);
+  }
+  return _return;
+}
+
+void ServiceDataView::addStatExportType(
+    std::string_view key,
+    ExportType type,
+    const ExportedStat* statPrototype) const {
+  getServiceData().addStatExportType(getKey(key), type, statPrototype);
+}
+
+void ServiceDataView::addStatValue(std::string_view key, int64_t value)
+    const {
+  getStat(key, nullptr).addValue(get_current_time(), value);
+}
+
+void ServiceDataView::addStatValue(
+    std::string_view key,
+    int64_t value,
+    ExportType exportType) const {
+  getStat(key, &exportType).addValue(get_current_time(), value);
+}
+
+bool ServiceDataView::addHistogram(
+    std::string_view key,
+    const ExportedHistogram& prototype) const {
+  return getServiceData().addHistogram(getKey(key), prototype);
+}
+
+void ServiceDataView::exportHistogramPercentile(std::string_view key, int pct)
+    const {
+  getServiceData().exportHistogramPercentile(getKey(key), pct);
+}
+
+void ServiceDataView::addHistogramValue(std::string_view key, int64_t value)
+    const {
+  if (auto hist = getHistogram(key)) {
+    hist->addValue(get_legacy_stats_time(), value);
+  }
+}
+
+void ServiceDataView::setExportedValue(
+    std::string_view key,
+    std::string value) const {
+  getServiceData().setExportedValue(getKey(key), std::move(value));
+}
+
+std::string ServiceDataView::getExportedValue(std::string_view key) const {
+  return getServiceData().getExportedValue(getKey(key));
+}
+
+} // namespace facebook::fb303
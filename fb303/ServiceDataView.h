@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include <fb303/ServiceData.h>
+#include <folly/Optional.h>
+#include <folly/SharedMutex.h>
+#include <folly/Synchronized.h>
+#include <folly/container/F14Map.h>
+
+namespace facebook::fb303 {
+
+/**
+ * A view of a ServiceData under which every key is implicitly prefixed, for
+ * libraries that namespace their stats, e.g.
+ *
+ *   static ServiceDataView stats("mylib.");
+ *   stats.incrementCounter("requests"); // increments "mylib.requests"
+ *
+ * Each key is concatenated with the prefix the first time it is used, and
+ * the full key, along with the flat counter, stat or histogram it names, is
+ * remembered for the lifetime of the view. Later calls only look the key up
+ * in the view's cache, without allocating, and go straight to the counter,
+ * stat or histogram instead of looking it up in the ServiceData maps. The
+ * cache is never pruned, so a view is meant for a bounded set of keys.
+ *
+ * Like the LockableStat and LockableHistogram handles of ThreadLocalStats, a
+ * cached stat or histogram stays attached to the view even if the
+ * ServiceData forgets it, e.g. in resetAllData(). Cached flat counters are
+ * instead resolved again once cleared, like any ServiceData::CounterHandle.
+ *
+ * Views are cheap to copy; copies share the prefix and the cache.
+ */
+class ServiceDataView {
+ public:
+  ServiceDataView(ServiceData& serviceData, std::string_view prefix);
+  explicit ServiceDataView(std::string_view prefix)
+      : ServiceDataView(*ServiceData::get(), prefix) {}
+
+  /** Returns a view of the keys prefixed with getPrefix() + prefix. */
+  ServiceDataView subView(std::string_view prefix) const;
+
+  const std::string& getPrefix() const {
+    return state_->prefix;
+  }
+
+  ServiceData& getServiceData() const {
+    return state_->serviceData;
+  }
+
+  /*** Flat counters; see the ServiceData methods of the same name */
+  int64_t incrementCounter(std::string_view key, int64_t amount = 1) const;
+  int64_t setCounter(std::string_view key, int64_t value) const;
+  void clearCounter(std::string_view key) const;
+  folly::Optional<int64_t> getCounterIfExists(std::string_view key) const;
+  int64_t getCounter(std::string_view key) const;
+
+  /**
+   * Retrieves all the counters under the prefix, keyed by their names
+   * without the prefix; see ServiceData::getPrefixedCounters() for its cost.
+   */
+  std::map<std::string, int64_t> getCounters() const;
+
+  /*** Timeseries; see the ServiceData methods of the same name */
+  void addStatExportType(
+      std::string_view key,
+      ExportType type = AVG,
+      const ExportedStat* statPrototype = nullptr) const;
+  void addStatValue(std::string_view key, int64_t value = 1) const;
+  void addStatValue(
+      std::string_view key,
+      int64_t value,
+      ExportType exportType) const;
+
+  /*** Histograms; see the ServiceData methods of the same name */
+  bool addHistogram(std::string_view key, const ExportedHistogram& prototype)
+      const;
+  void exportHistogramPercentile(std::string_view key, int pct) const;
+  void addHistogramValue(std::string_view key, int64_t value) const;
+
+  /*** Exported values; see the ServiceData methods of the same name */
+  void setExportedValue(std::string_view key, std::string value) const;
+  std::string getExportedValue(std::string_view key) const;
+
+ private:
+  struct Entry {
+    explicit Entry(std::string k) : key(std::move(k)) {}
+
+    const std::string key;
+    // resolved under the lock of the ServiceData counters
+    mutable ServiceData::CounterHandle counter;
+    // set once resolved, and never changed afterwards
+    ExportedStatMapImpl::LockableStat stat;
+    ExportedHistogramMapImpl::LockableHistogram histogram;
+  };
+  using EntryMap = folly::F14NodeMap<std::string, Entry>;
+
+  struct State {
+    State(ServiceData& sd, std::string p)
+        : serviceData(sd), prefix(std::move(p)) {}
+
+    ServiceData& serviceData;
+    const std::string prefix;
+    folly::Synchronized<EntryMap, folly::SharedMutex> entries;
+  };
+
+  Entry& getOrAddEntry(EntryMap& entries, std::string_view key) const;
+  const Entry& getEntry(std::string_view key) const;
+  const std::string& getKey(std::string_view key) const;
+  std::string makeKey(std::string_view key) const;
+  const ExportedStatMapImpl::LockableStat& getStat(
+      std::string_view key,
+      const ExportType* exportType) const;
+  const ExportedHistogramMapImpl::LockableHistogram* getHistogram(
+      std::string_view key) const;
+
+  std::shared_ptr<State> state_;
+};
+
+} // namespace facebook::fb303
@@ -0,0 +1,308 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fb303/SharedCounterArena.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <system_error>
+
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <fmt/core.h>
+#include <folly/lang/Align.h>
+
+namespace facebook::fb303 {
+
+namespace {
+// the pid of a slot being retired, so that only one process retires it
+constexpr pid_t kRetiringPid = -1;
+
+size_t alignUp(size_t size) {
+  constexpr auto kAlign = folly::hardware_destructive_interference_size;
+  return (size + kAlign - 1) / kAlign * kAlign;
+}
+} // namespace
+
+struct SharedCounterArena::Header {
+  // the number of key entries handed out, possibly more than maxKeys_
+  std::atomic<uint32_t> numKeys{0};
+};
+
+struct SharedCounterArena::KeyEntry {
+  // set once name is written; entries of processes that died before that
+  // stay unready and are skipped
+  std::atomic<bool> ready{false};
+  uint8_t length{0};
+  char name[kMaxKeyLength];
+
+  std::string_view getName() const {
+    return std::string_view(name, length);
+  }
+};
+
+struct SharedCounterArena::ProcessSlot {
+  // 0 while the slot is free
+  std::atomic<pid_t> pid{0};
+};
+
+static_assert(std::atomic<int64_t>::is_always_lock_free);
+static_assert(std::atomic<pid_t>::is_always_lock_free);
+static_assert(SharedCounterArena::kMaxKeyLength <= UINT8_MAX);
+
+std::shared_ptr<SharedCounterArena> SharedCounterArena::create(
+    size_t maxKeys,
+    size_t maxProcesses) {
+  if (maxKeys == 0 || maxKeys > UINT32_MAX || maxProcesses == 0) {
+    throw std::invalid_argument(fmt::format(
+        "invalid shared counter arena capacity: {} keys, {} processes",
+        maxKeys,
+        maxProcesses));
+  }
+  auto const size = alignUp(sizeof(Header)) +
+      alignUp(sizeof(KeyEntry) * maxKeys) +
+      alignUp(sizeof(ProcessSlot) * maxProcesses) +
+      alignUp(sizeof(std::atomic<int64_t>) * maxKeys) +
+      sizeof(std::atomic<int64_t>) * maxKeys * maxProcesses;
+  auto mapping = mmap(
+      nullptr,
+      size,
+      PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS,
+      -1,
+      0);
+  if (mapping == MAP_FAILED) {
+    throw std::system_error(
+        errno, std::generic_category(), "mmap of shared counter arena");
+  }
+  std::shared_ptr<SharedCounterArena> arena(
+      new SharedCounterArena(mapping, size, maxKeys, maxProcesses));
+  arena->attach();
+  return arena;
+}
+
+namespace {
+template <typename T>
+T* carve(char*& cursor, size_t count) {
+  auto const begin = cursor;
+  for (size_t i = 0; i < count; ++i) {
+    new (begin + i * sizeof(T)) T();
+  }
+  cursor += alignUp(sizeof(T) * count);
+  return reinterpret_cast<T*>(begin);
+}
+} // namespace
+
+SharedCounterArena::SharedCounterArena(
+    void* mapping,
+    size_t mappingSize,
+    size_t maxKeys,
+    size_t maxProcesses)
+    : mapping_(mapping),
+      mappingSize_(mappingSize),
+      maxKeys_(maxKeys),
+      maxProcesses_(maxProcesses),
+      header_([&] {
+        auto cursor = static_cast<char*>(mapping);
+        return carve<Header>(cursor, 1);
+      }()),
+      keys_([&] {
+        auto cursor = static_cast<char*>(mapping) + alignUp(sizeof(Header));
+        return carve<KeyEntry>(cursor, maxKeys);
+      }()),
+      processes_([&] {
+        auto cursor = reinterpret_cast<char*>(keys_) +
+            alignUp(sizeof(KeyEntry) * maxKeys);
+        return carve<ProcessSlot>(cursor, maxProcesses);
+      }()),
+      retired_([&] {
+        auto cursor = reinterpret_cast<char*>(processes_) +
+            alignUp(sizeof(ProcessSlot) * maxProcesses);
+        return carve<std::atomic<int64_t>>(cursor, maxKeys);
+      }()),
+      values_([&] {
+        auto cursor = reinterpret_cast<char*>(retired_) +
+            alignUp(sizeof(std::atomic<int64_t>) * maxKeys);
+        return carve<std::atomic<int64_t>>(cursor, maxKeys * maxProcesses);
+      }()) {}
+
+SharedCounterArena::~SharedCounterArena() {
+  munmap(mapping_, mappingSize_);
+}
+
+std::atomic<int64_t>* SharedCounterArena::slotValues(size_t slot) const {
+  return values_ + slot * maxKeys_;
+}
+
+void SharedCounterArena::attach() {
+  auto const pid = getpid();
+  for (size_t slot = 0; slot < maxProcesses_; ++slot) {
+    pid_t expected = 0;
+    if (processes_[slot].pid.compare_exchange_strong(
+            expected, pid, std::memory_order_acq_rel)) {
+      slot_.store(slot, std::memory_order_release);
+      return;
+    }
+  }
+  throw std::length_error(fmt::format(
+      "all {} shared counter arena process slots are taken", maxProcesses_));
+}
+
+void SharedCounterArena::detach() {
+  auto const slot = slot_.load(std::memory_order_acquire);
+  auto pid = getpid();
+  if (processes_[slot].pid.compare_exchange_strong(
+          pid, kRetiringPid, std::memory_order_acq_rel)) {
+    retire(slot);
+  }
+}
+
+void SharedCounterArena::retire(size_t slot) {
+  auto const values = slotValues(slot);
+  for (size_t i = 0; i < maxKeys_; ++i) {
+    auto const value = values[i].exchange(0, std::memory_order_acq_rel);
+    if (value != 0) {
+      retired_[i].fetch_add(value, std::memory_order_relaxed);
+    }
+  }
+  processes_[slot].pid.store(0, std::memory_order_release);
+}
+
+size_t SharedCounterArena::reapDeadProcesses() {
+  size_t reaped = 0;
+  for (size_t slot = 0; slot < maxProcesses_; ++slot) {
+    auto pid = processes_[slot].pid.load(std::memory_order_acquire);
+    if (pid <= 0 || kill(pid, 0) == 0 || errno != ESRCH) {
+      continue;
+    }
+    if (processes_[slot].pid.compare_exchange_strong(
+            pid, kRetiringPid, std::memory_order_acq_rel)) {
+      retire(slot);
+      ++reaped;
+    }
+  }
+  return reaped;
+}
+
+size_t SharedCounterArena::getNumAttachedProcesses() const {
+  size_t count = 0;
+  for (size_t slot = 0; slot < maxProcesses_; ++slot) {
+    if (processes_[slot].pid.load(std::memory_order_relaxed) != 0) {
+      ++count;
+    }
+  }
+  return count;
+}
+
+uint32_t SharedCounterArena::getKeyIndex(std::string_view key) {
+  {
+    auto indices = indices_.rlock();
+    if (auto it = indices->find(key); it != indices->end()) {
+      return it->second;
+    }
+  }
+  if (key.size() > kMaxKeyLength) {
+    throw std::invalid_argument(fmt::format(
+        "shared counter key is longer than {} characters: {}",
+        kMaxKeyLength,
+        key));
+  }
+
+  auto indices = indices_.wlock();
+  if (auto it = indices->find(key); it != indices->end()) {
+    return it->second;
+  }
+  // another process may have added the key
+  auto const numKeys = getNumKeys();
+  for (uint32_t i = 0; i < numKeys; ++i) {
+    if (keys_[i].ready.load(std::memory_order_acquire) &&
+        keys_[i].getName() == key) {
+      indices->emplace(key, i);
+      return i;
+    }
+  }
+  auto const index = header_->numKeys.fetch_add(1, std::memory_order_acq_rel);
+  if (index >= maxKeys_) {
+    throw std::length_error(fmt::format(
+        "shared counter arena is full ({} keys), cannot add {}",
+        maxKeys_,
+        key));
+  }
+  auto& entry = keys_[index];
+  std::memcpy(entry.name, key.data(), key.size());
+  entry.length = static_cast<uint8_t>(key.size());
+  entry.ready.store(true, std::memory_order_release);
+  indices->emplace(key, index);
+  return index;
+}
+
+void SharedCounterArena::incrementCounter(
+    std::string_view key,
+    int64_t amount) {
+  getCounter(key).increment(amount);
+}
+
+SharedCounterArena::Counter SharedCounterArena::getCounter(
+    std::string_view key) {
+  auto const index = getKeyIndex(key);
+  return Counter(slotValues(slot_.load(std::memory_order_acquire)), index);
+}
+
+size_t SharedCounterArena::getNumKeys() const {
+  return std::min<size_t>(
+      header_->numKeys.load(std::memory_order_acquire), maxKeys_);
+}
+
+int64_t SharedCounterArena::getKeyTotal(size_t index) const {
+  int64_t total = retired_[index].load(std::memory_order_relaxed);
+  for (size_t slot = 0; slot < maxProcesses_; ++slot) {
+    total += slotValues(slot)[index].load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+void SharedCounterArena::getCounters(
+    std::map<std::string, int64_t>& out) const {
+  auto const numKeys = getNumKeys();
+  std::map<std::string, int64_t> totals;
+  for (size_t i = 0; i < numKeys; ++i) {
+    if (keys_[i].ready.load(std::memory_order_acquire)) {
+      // entries added concurrently by different processes share a name
+      totals[std::string(keys_[i].getName())] += getKeyTotal(i);
+    }
+  }
+  out.insert(totals.begin(), totals.end());
+}
+
+std::optional<int64_t> SharedCounterArena::getTotal(
+    std::string_view key) const {
+  std::optional<int64_t> total;
+  auto const numKeys = getNumKeys();
+  for (size_t i = 0; i < numKeys; ++i) {
+    if (keys_[i].ready.load(std::memory_order_acquire) &&
+        keys_[i].getName() == key) {
+      total = total.value_or(0) + getKeyTotal(i);
+    }
+  }
+  return total;
+}
+
+} // namespace facebook::fb303
@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include <folly/Synchronized.h>
+#include <folly/container/F14Map.h>
+
+namespace facebook::fb303 {
+
+/**
+ * Flat counters kept in an anonymous shared memory mapping, so that the
+ * processes forked from the one which created it, e.g. the workers of a
+ * pre-forking server, all add to the same counters, and any of them can read
+ * the totals across the processes without polling the others.
+ *
+ * Each process gets a slot of its own, with one value per key that only its
+ * threads add to. The keys are appended to a shared table without locks; two
+ * processes adding the same key at once may get distinct entries, which are
+ * summed when reading. Only increments are supported, since the totals are
+ * sums over the processes.
+ *
+ * A process must call attach() after it is forked to get its own slot;
+ * until then it keeps adding to its parent's, which is still accounted for
+ * in the totals. When a process exits, whether it called detach() or
+ * crashed, reapDeadProcesses(), e.g. called by the parent when it reaps its
+ * children, moves the values of its slot to retired totals, so that the
+ * counters never go backwards, and frees the slot for a new worker.
+ *
+ * The capacities are fixed at creation. Reads racing with a process being
+ * reaped may briefly count its values twice or not at all.
+ */
+class SharedCounterArena {
+ public:
+  static constexpr size_t kMaxKeyLength = 119;
+
+  class Counter {
+   public:
+    Counter() = default;
+
+    void increment(int64_t amount = 1) const {
+      values_[index_].fetch_add(amount, std::memory_order_relaxed);
+    }
+
+   private:
+    friend class SharedCounterArena;
+    Counter(std::atomic<int64_t>* values, uint32_t index)
+        : values_(values), index_(index) {}
+
+    // the values of the process slot at the time the handle was resolved
+    std::atomic<int64_t>* values_{nullptr};
+    uint32_t index_{0};
+  };
+
+  /**
+   * Maps a new arena for up to maxKeys keys and maxProcesses concurrently
+   * attached processes, and attaches the calling process to it. Throws
+   * std::system_error if the mapping fails.
+   */
+  static std::shared_ptr<SharedCounterArena> create(
+      size_t maxKeys,
+      size_t maxProcesses);
+
+  ~SharedCounterArena();
+
+  SharedCounterArena(const SharedCounterArena&) = delete;
+  SharedCounterArena& operator=(const SharedCounterArena&) = delete;
+
+  /**
+   * Claims a free process slot for the calling process. To be called by each
+   * process right after it is forked, before resolving any Counter. Throws
+   * std::length_error if all the slots are taken.
+   */
+  void attach();
+
+  /**
+   * Retires the values of the calling process and frees its slot. The arena
+   * must not be updated by the process afterwards.
+   */
+  void detach();
+
+  /**
+   * Adds amount to the key. Throws std::invalid_argument if the key is
+   * longer than kMaxKeyLength and std::length_error if there is no room
+   * left for a new key.
+   */
+  void incrementCounter(std::string_view key, int64_t amount = 1);
+
+  /**
+   * Returns a handle which increments the key directly, without looking it
+   * up, for the slot of the calling process at the time of the call. Throws
+   * as incrementCounter() does.
+   */
+  Counter getCounter(std::string_view key);
+
+  /**
+   * Adds the totals of all the keys across the processes to out, leaving
+   * the keys already in out unchanged.
+   */
+  void getCounters(std::map<std::string, int64_t>& out) const;
+
+  /** Returns the total of the key across the processes, if it exists. */
+  std::optional<int64_t> getTotal(std::string_view key) const;
+
+  /**
+   * Retires the slots of the processes which no longer exist, and returns
+   * their number.
+   */
+  size_t reapDeadProcesses();
+
+  /** Returns the number of processes currently holding a slot. */
+  size_t getNumAttachedProcesses() const;
+
+ private:
+  struct Header;
+  struct KeyEntry;
+  struct ProcessSlot;
+
+  SharedCounterArena(
+      void* mapping,
+      size_t mappingSize,
+      size_t maxKeys,
+      size_t maxProcesses);
+
+  uint32_t getKeyIndex(std::string_view key);
+  size_t getNumKeys() const;
+  int64_t getKeyTotal(size_t index) const;
+  std::atomic<int64_t>* slotValues(size_t slot) const;
+  void retire(size_t slot);
+
+  void* const mapping_;
+  const size_t mappingSize_;
+  const size_t maxKeys_;
+  const size_t maxProcesses_;
+  Header* const header_;
+  KeyEntry* const keys_;
+  ProcessSlot* const processes_;
+  std::atomic<int64_t>* const retired_;
+  std::atomic<int64_t>* const values_;
+
+  // the slot of this process
+  std::atomic<size_t> slot_{0};
+  // indices of the keys already looked up by this process
+  folly::Synchronized<folly::F14FastMap<std::string, uint32_t>> indices_;
+};
+
+} // namespace facebook::fb303
@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fb303/StaticStatRegistry.h>
+
+#include <algorithm>
+#include <utility>
+
+#include <folly/Indestructible.h>
+#include <glog/logging.h>
+
+namespace facebook::fb303 {
+
+StaticStatRegistry& StaticStatRegistry::get() {
+  // leaked, since the stats may be updated during static destruction
+  static folly::Indestructible<StaticStatRegistry> registry;
+  return *registry;
+}
+
+uint32_t StaticStatRegistry::registerTimeseries(std::string_view key) {
+  auto indices = indices_.wlock();
+  if (auto it = indices->byKey.find(key); it != indices->byKey.end()) {
+    ++it->second.refs;
+    return it->second.index;
+  }
+  uint32_t index;
+  if (!indices->free.empty()) {
+    index = indices->free.back();
+    indices->free.pop_back();
+    indices->keys[index] = key;
+  } else if (indices->keys.size() < kMaxStats) {
+    index = uint32_t(indices->keys.size());
+    indices->keys.emplace_back(key);
+    size_.store(index + 1, std::memory_order_release);
+  } else {
+    return kNoIndex;
+  }
+  indices->byKey.emplace(std::string(key), Registration{index, 1});
+  return index;
+}
+
+void StaticStatRegistry::unregisterTimeseries(uint32_t index) {
+  auto indices = indices_.wlock();
+  auto it = indices->byKey.find(indices->keys.at(index));
+  DCHECK(it != indices->byKey.end());
+  if (--it->second.refs == 0) {
+    indices->byKey.erase(it);
+    indices->released.push_back(index);
+  }
+}
+
+std::string StaticStatRegistry::getKey(uint32_t index) const {
+  return indices_.rlock()->keys.at(index);
+}
+
+StaticStatRegistry::Chunk* StaticStatRegistry::Accumulators::addChunk(
+    size_t chunkIndex) {
+  auto chunk = new Chunk();
+  // publish() may read the chunk from another thread as soon as it is stored
+  chunks_[chunkIndex].store(chunk, std::memory_order_release);
+  if (chunkIndex >= chunksEnd_.load(std::memory_order_relaxed)) {
+    chunksEnd_.store(chunkIndex + 1, std::memory_order_release);
+  }
+  return chunk;
+}
+
+void StaticStatRegistry::Accumulators::collect(Totals& totals) {
+  auto const end = chunksEnd_.load(std::memory_order_acquire);
+  for (size_t c = 0; c < end; ++c) {
+    auto chunk = chunks_[c].load(std::memory_order_acquire);
+    if (!chunk) {
+      continue;
+    }
+    auto const base = c << kChunkBits;
+    if (totals.size() < base + kChunkSize) {
+      totals.resize(base + kChunkSize);
+    }
+    for (size_t i = 0; i < kChunkSize; ++i) {
+      auto& slot = chunk->slots[i];
+      auto const sum = slot.sum.load(std::memory_order_relaxed);
+      auto const count = slot.count.load(std::memory_order_relaxed);
+      // Either may be ahead of the other by a sample, which is caught up on
+      // the next call.
+      if (sum != slot.publishedSum || count != slot.publishedCount) {
+        totals[base + i].first += sum - slot.publishedSum;
+        totals[base + i].second += count - slot.publishedCount;
+        slot.publishedSum = sum;
+        slot.publishedCount = count;
+      }
+    }
+  }
+}
+
+StaticStatRegistry::Accumulators::~Accumulators() {
+  {
+    // Threads cannot exit while publish() holds its accessAllThreads()
+    // accessor, which it takes before the mutex.
+    std::lock_guard lock(registry_.publishMutex_);
+    collect(registry_.orphans_);
+  }
+  auto const end = chunksEnd_.load(std::memory_order_relaxed);
+  for (size_t c = 0; c < end; ++c) {
+    delete chunks_[c].load(std::memory_order_relaxed);
+  }
+}
+
+void StaticStatRegistry::publish(ServiceData& serviceData, TimePoint now) {
+  auto accessor = accumulators_.accessAllThreads();
+  std::lock_guard lock(publishMutex_);
+
+  if (statsOwner_ != &serviceData) {
+    stats_.clear();
+    statsOwner_ = &serviceData;
+  }
+  // Taken before collecting, so that the slots of these are final.
+  auto released = std::exchange(indices_.wlock()->released, {});
+  totals_.swap(orphans_);
+  orphans_.clear();
+  for (auto& accumulators : accessor) {
+    accumulators.collect(totals_);
+  }
+
+  auto const n = std::min(totals_.size(), size());
+  if (stats_.size() < n) {
+    stats_.resize(n);
+  }
+  for (size_t i = 0; i < n; ++i) {
+    auto const [sum, count] = totals_[i];
+    if (sum == 0 && count == 0) {
+      continue;
+    }
+    if (stats_[i].isNull()) {
+      stats_[i] = serviceData.getStatMap()->getLockableStat(getKey(i));
+    }
+    stats_[i].addValueAggregated(now, sum, count);
+  }
+  totals_.clear();
+
+  if (!released.empty()) {
+    for (auto index : released) {
+      if (index < stats_.size()) {
+        stats_[index] = ExportedStatMapImpl::LockableStat();
+      }
+    }
+    auto indices = indices_.wlock();
+    indices->free.insert(indices->free.end(), released.begin(), released.end());
+  }
+}
+
+} // namespace facebook::fb303
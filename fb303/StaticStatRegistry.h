@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <fb303/ServiceData.h>
+#include <folly/CPortability.h>
+#include <folly/Likely.h>
+#include <folly/Synchronized.h>
+#include <folly/ThreadLocal.h>
+#include <folly/container/F14Map.h>
+
+namespace facebook::fb303 {
+
+/**
+ * Assigns each statically defined timeseries, i.e. each DEFINE_timeseries
+ * key, a dense index, so that the per-thread accumulation is a flat array
+ * instead of a TLTimeseries object per stat and thread, found through a
+ * ThreadLocalPtr and aggregated by walking an F14 set.
+ *
+ * Each thread lazily allocates small chunks of (sum, count) slots, which
+ * only that thread writes, with plain relaxed loads and stores rather than
+ * atomic read-modify-writes. The values are cumulative: publish() reads the
+ * slots of all the threads, chunk by chunk, and adds the difference with
+ * what it read the previous time to the ServiceData timeseries, so that the
+ * writers never have to synchronize with it. When a thread exits, what it
+ * accumulated since the last publish() is carried over to the next one.
+ *
+ * Registering the same key twice returns the same index, so the indices are
+ * bounded by the number of distinct live keys. Once all the registrations of
+ * a key are released, its index is reused after the next publish(), which
+ * publishes what was left in its slots under the old key. Past kMaxStats
+ * live keys, registerTimeseries() returns kNoIndex, and the callers keep
+ * using a TLTimeseries.
+ */
+class StaticStatRegistry {
+ public:
+  static constexpr size_t kChunkBits = 6;
+  static constexpr size_t kChunkSize = size_t(1) << kChunkBits;
+  static constexpr size_t kMaxChunks = 256;
+  static constexpr size_t kMaxStats = kChunkSize * kMaxChunks;
+  static constexpr uint32_t kNoIndex = ~uint32_t(0);
+
+  static StaticStatRegistry& get();
+
+  StaticStatRegistry() = default;
+  StaticStatRegistry(const StaticStatRegistry&) = delete;
+  StaticStatRegistry& operator=(const StaticStatRegistry&) = delete;
+
+  /**
+   * Returns the index of the timeseries with the given key, assigning a free
+   * one on first use, or kNoIndex if all kMaxStats are taken. Each
+   * registration must be released by unregisterTimeseries().
+   */
+  uint32_t registerTimeseries(std::string_view key);
+
+  /**
+   * Releases a registration. The index must no longer be added to; it is
+   * reused once all the registrations of its key are released and the next
+   * publish() has collected its slots.
+   */
+  void unregisterTimeseries(uint32_t index);
+
+  /** Returns the number of indices ever assigned, including the free ones. */
+  size_t size() const {
+    return size_.load(std::memory_order_acquire);
+  }
+
+  /** Returns the key of a registered timeseries. */
+  std::string getKey(uint32_t index) const;
+
+  FOLLY_ALWAYS_INLINE void addValue(uint32_t index, int64_t value) {
+    addValueAggregated(index, value, 1);
+  }
+
+  FOLLY_ALWAYS_INLINE void
+  addValueAggregated(uint32_t index, int64_t sum, int64_t numSamples) {
+    auto& slot = accumulators_->getSlot(index);
+    // single writer: no need for atomic read-modify-writes
+    slot.sum.store(
+        slot.sum.load(std::memory_order_relaxed) + sum,
+        std::memory_order_relaxed);
+    slot.count.store(
+        slot.count.load(std::memory_order_relaxed) + numSamples,
+        std::memory_order_relaxed);
+  }
+
+  /**
+   * Adds what all the threads accumulated since the previous call to the
+   * timeseries of serviceData, creating them with the default export types
+   * if they do not exist. Called by ThreadCachedServiceData::publishStats().
+   */
+  void publish(ServiceData& serviceData, TimePoint now = get_current_time());
+
+ private:
+  struct Slot {
+    // written by the owning thread only
+    std::atomic<int64_t> sum{0};
+    std::atomic<int64_t> count{0};
+    // what publish() read the previous time; guarded by publishMutex_
+    int64_t publishedSum{0};
+    int64_t publishedCount{0};
+  };
+
+  struct Chunk {
+    std::array<Slot, kChunkSize> slots;
+  };
+
+  using Totals = std::vector<std::pair<int64_t, int64_t>>;
+
+  class Accumulators {
+   public:
+    explicit Accumulators(StaticStatRegistry& registry)
+        : registry_(registry) {}
+    ~Accumulators();
+
+    FOLLY_ALWAYS_INLINE Slot& getSlot(uint32_t index) {
+      auto chunk = chunks_[index >> kChunkBits].load(std::memory_order_relaxed);
+      if (FOLLY_UNLIKELY(!chunk)) {
+        chunk = addChunk(index >> kChunkBits);
+      }
+      return chunk->slots[index & (kChunkSize - 1)];
+    }
+
+    // Adds the differences since the previous call to totals.
+    void collect(Totals& totals);
+
+   private:
+    FOLLY_NOINLINE Chunk* addChunk(size_t chunkIndex);
+
+    StaticStatRegistry& registry_;
+    // one past the highest chunk allocated, so that collect() only walks
+    // the chunks in use
+    std::atomic<size_t> chunksEnd_{0};
+    std::array<std::atomic<Chunk*>, kMaxChunks> chunks_{};
+  };
+
+  struct AccumulatorsTag {};
+
+  struct Registration {
+    uint32_t index;
+    uint32_t refs;
+  };
+
+  struct Indices {
+    folly::F14FastMap<std::string, Registration> byKey;
+    // the key of each index, kept until the index is reused
+    std::vector<std::string> keys;
+    // released, and waiting for a publish() to collect their slots
+    std::vector<uint32_t> released;
+    // ready to be reused
+    std::vector<uint32_t> free;
+  };
+
+  folly::Synchronized<Indices> indices_;
+  std::atomic<size_t> size_{0};
+
+  // guards the published values of the slots and the state below
+  std::mutex publishMutex_;
+  // accumulated by exited threads and not yet published
+  Totals orphans_;
+  Totals totals_;
+  std::vector<ExportedStatMapImpl::LockableStat> stats_;
+  ServiceData* statsOwner_{nullptr};
+
+  // last, since the accumulators of the remaining threads are collected into
+  // orphans_ when it is destroyed
+  folly::ThreadLocal<Accumulators, AccumulatorsTag, folly::AccessModeStrict>
+      accumulators_{[this] { return new Accumulators(*this); }};
+};
+
+} // namespace facebook::fb303
@@ -19,6 +19,7 @@
 #include <atomic>
 #include <thread>
 
+#include <fb303/detail/LockProfile.h>
 #include <folly/Portability.h>
 #include <folly/ScopeGuard.h>
 #include <folly/SharedMutex.h>
@@ -172,7 +173,8 @@ class TLStatsNoLocking {
  */
 class TLStatsThreadSafe {
  public:
-  using RegistryLock = folly::SharedMutex;
+  using RegistryLock =
+      detail::ProfiledSharedMutex<detail::LockSite::kTLRegistry>;
   using StatLock = folly::DistributedMutex;
 
   /**
@@ -16,6 +16,8 @@
 
 #include <fb303/ThreadCachedServiceData.h>
 
+#include <stdexcept>
+
 #include <folly/Indestructible.h>
 #include <folly/Singleton.h>
 
@@ -161,6 +163,8 @@ void ThreadCachedServiceData::publishStats() {
     totalAggregateCalls += tlsm.aggregate();
     mapsAggregated++;
   }
+  StaticStatRegistry::get().publish(*serviceData_);
+  HotKeySampler::get().merge();
   auto end = std::chrono::steady_clock::now();
   auto interval =
       std::chrono::duration_cast<std::chrono::microseconds>(end - start);
@@ -270,4 +274,46 @@ void ThreadCachedServiceData::addStatValue(
     ExportType exportType) {
   getThreadStats()->addStatValue(key, value, exportType);
 }
+
+namespace internal {
+
+RollupSpec::RollupSpec(
+    std::string keyFormat_,
+    std::vector<size_t> keptSubkeys_,
+    size_t numSubkeys)
+    : keyFormat(std::move(keyFormat_)), keptSubkeys(std::move(keptSubkeys_)) {
+  size_t placeholders = 0;
+  for (auto pos = keyFormat.find("{}"); pos != std::string::npos;
+       pos = keyFormat.find("{}", pos + 2)) {
+    ++placeholders;
+  }
+  if (placeholders != keptSubkeys.size()) {
+    throw std::invalid_argument(fmt::format(
+        "rollup key {} needs one placeholder per kept subkey", keyFormat));
+  }
+  for (auto const index : keptSubkeys) {
+    if (index >= numSubkeys) {
+      throw std::invalid_argument(
+          fmt::format("rollup key {} keeps no such subkey", keyFormat));
+    }
+  }
+}
+
+std::string RollupSpec::formatKey(
+    const std::vector<std::string>& subkeys) const {
+  std::string key;
+  size_t kept = 0;
+  size_t start = 0;
+  for (auto pos = keyFormat.find("{}"); pos != std::string::npos;
+       pos = keyFormat.find("{}", start)) {
+    key.append(keyFormat, start, pos - start);
+    key += subkeys[keptSubkeys[kept++]];
+    start = pos + 2;
+  }
+  key.append(keyFormat, start);
+  return key;
+}
+
+} // namespace internal
+
 } // namespace facebook::fb303
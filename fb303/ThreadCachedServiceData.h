@@ -22,15 +22,19 @@
 #include <cstdint>
 #include <functional>
 #include <memory>
+#include <optional>
 #include <string>
 #include <string_view>
 #include <utility>
 #include <variant>
+#include <vector>
 
 #include <fmt/format.h>
 
 #include <fb303/ExportType.h>
+#include <fb303/HotKeySampler.h>
 #include <fb303/SimpleLRUMap.h>
+#include <fb303/StaticStatRegistry.h>
 #include <fb303/ThreadLocalStatsMap.h>
 #include <folly/ConcurrentLazy.h>
 #include <folly/Format.h>
@@ -423,6 +427,27 @@ struct HistogramSpec {
   }
 };
 
+/**
+ * A rollup of a dynamic stat across its subkeys: the stat merging those of
+ * all the subkeys which agree on the keptSubkeys positions. keyFormat has a
+ * "{}" placeholder for each of the kept subkeys, in order.
+ */
+struct RollupSpec {
+  /**
+   * Throws std::invalid_argument unless keyFormat has one placeholder per
+   * kept subkey and they are all less than numSubkeys.
+   */
+  RollupSpec(
+      std::string keyFormat,
+      std::vector<size_t> keptSubkeys,
+      size_t numSubkeys);
+
+  std::string formatKey(const std::vector<std::string>& subkeys) const;
+
+  std::string keyFormat;
+  std::vector<size_t> keptSubkeys;
+};
+
 namespace detail {
 struct Nothing {};
 
@@ -666,6 +691,7 @@ class FormattedKeyHolder {
     if (FOLLY_LIKELY(
             local.last.key && keyhash == local.last.hash &&
             local.map.key_eq()(*local.last.key, keytup))) {
+      sampleHotKey(*local.last.value->key);
       return *local.last.value;
     }
     // calling outline folly::get_default would be a small perf hit, so call
@@ -679,6 +705,7 @@ class FormattedKeyHolder {
     // invalid ... but we reset them all to the just-found item anyway, so
     // we do not hold onto invalid references
     local.last = {keyhash, &it->first.get(), &it->second};
+    sampleHotKey(*it->second.key);
     return it->second;
   }
 
@@ -927,12 +954,26 @@ class TimeseriesWrapper {
     exportStats(nullptr, args...);
   }
 
+  ~TimeseriesWrapper() {
+    if (index_ != StaticStatRegistry::kNoIndex) {
+      StaticStatRegistry::get().unregisterTimeseries(index_);
+    }
+  }
+
   void add(int64_t value = 1) {
-    tcTimeseries()->addValue(value);
+    if (FOLLY_LIKELY(index_ != StaticStatRegistry::kNoIndex)) {
+      StaticStatRegistry::get().addValue(index_, value);
+    } else {
+      tcTimeseries()->addValue(value);
+    }
   }
 
   void addAggregated(int64_t sum, int64_t numSamples) {
-    tcTimeseries()->addValueAggregated(sum, numSamples);
+    if (FOLLY_LIKELY(index_ != StaticStatRegistry::kNoIndex)) {
+      StaticStatRegistry::get().addValueAggregated(index_, sum, numSamples);
+    } else {
+      tcTimeseries()->addValueAggregated(sum, numSamples);
+    }
   }
 
   const std::string getKey() const {
@@ -942,6 +983,11 @@ class TimeseriesWrapper {
  private:
   std::string key_;
 
+  //  The values are accumulated in the flat per-thread arrays of the
+  //  registry, and published by ThreadCachedServiceData::publishStats().
+  const uint32_t index_{StaticStatRegistry::get().registerTimeseries(key_)};
+
+  //  Once the registry is full, the values go through a TLTimeseries instead.
   //  Holds pointers directly to TLTimeseries, and holds deleters which hold
   //  copies of the owning shared_ptr objects.
   folly::ThreadLocalPtr<ThreadCachedServiceData::TLTimeseries> tlTimeseries_;
@@ -1373,7 +1419,7 @@ class DynamicTimeseriesWrapper {
       std::vector<ExportType> exportTypes)
       : key_(
             std::move(keyFormat),
-            [this](const std::string& key) { prepareKey(key); }),
+            [this](const std::string& key) { prepareKey(key, prototype()); }),
         exportTypes_(std::move(exportTypes)) {}
 
   // This overload is called from the DEFINE_dynamic_timeseries macro when the
@@ -1397,11 +1443,10 @@ class DynamicTimeseriesWrapper {
       std::string keyFormat,
       ExportedStat prototype,
       Args... exportTypes)
-      : key_(
+      : prototype_(std::move(prototype)),
+        key_(
             std::move(keyFormat),
-            [this, prototype = std::move(prototype)](const std::string& key) {
-              prepareKey(key, &prototype);
-            }),
+            [this](const std::string& key) { prepareKey(key, prototype()); }),
         exportTypes_({exportTypes...}) {}
 
   DynamicTimeseriesWrapper(DynamicTimeseriesWrapper&&) = delete;
@@ -1436,8 +1481,27 @@ class DynamicTimeseriesWrapper {
   //      addAggregated(48, 12, "red", 42);
   template <typename... Args>
   void addAggregated(int64_t sum, int64_t numSamples, Args&&... subkeys) {
-    auto const& key = key_.getFormattedKey(std::forward<Args>(subkeys)...);
-    tcData().addStatValueAggregated(key, sum, numSamples);
+    getTimeseries(cast(subkeys)...).addValueAggregated(sum, numSamples);
+  }
+
+  /**
+   * Declares a rollup: a timeseries with the same export types, summing the
+   * values of all the subkeys, or of those sharing the subkeys at the
+   * keptSubkeys positions, which fill the placeholders of keyFormat. E.g. for
+   * "rpc.{}.{}.latency":
+   *   addRollup("rpc.latency");         // across all the subkeys
+   *   addRollup("rpc.{}.latency", {0}); // across the second subkey
+   *
+   * Rollups are computed when ThreadCachedServiceData::publishStats()
+   * aggregates the thread-local values of each subkey, so add() does no extra
+   * work for them. They only apply to the subkeys which each thread uses
+   * for the first time after this call, so declare them at startup.
+   *
+   * Throws std::invalid_argument if keyFormat does not match keptSubkeys.
+   */
+  void addRollup(std::string keyFormat, std::vector<size_t> keptSubkeys = {}) {
+    rollups_.wlock()->emplace_back(
+        std::move(keyFormat), std::move(keptSubkeys), N);
   }
 
   // Exports a specific key without modifying the statistic. This ensures the
@@ -1481,14 +1545,50 @@ class DynamicTimeseriesWrapper {
 
   template <typename... Args>
   void addImpl(int64_t value, Args... subkeys) {
+    getTimeseries(subkeys...).addValue(value);
+  }
+
+  template <typename... Args>
+  ThreadCachedServiceData::TLTimeseries& getTimeseries(Args... subkeys) {
     auto key = key_.getFormattedKeyWithExtra(subkeys...);
     if (key.second.get() == nullptr) {
       ThreadCachedServiceData::ThreadLocalStatsMap& tcData =
           *ThreadCachedServiceData::getStatsThreadLocal();
       // Cache thread local counter
       key.second.get() = tcData.getTimeseriesSafe(key.first);
+      setRollups(*key.second.get(), subkeys...);
     }
-    key.second.get()->addValue(value);
+    return *key.second.get();
+  }
+
+  template <typename... Args>
+  FOLLY_NOINLINE void setRollups(
+      ThreadCachedServiceData::TLTimeseries& timeseries,
+      Args... subkeys) {
+    auto rollups = rollups_.rlock();
+    if (rollups->empty()) {
+      return;
+    }
+    std::vector<std::string> subkeyStrings{toString(subkeys)...};
+    std::vector<ExportedStatMapImpl::LockableStat> stats;
+    for (const auto& rollup : *rollups) {
+      auto const rollupKey = rollup.formatKey(subkeyStrings);
+      prepareKey(rollupKey, prototype());
+      stats.push_back(
+          ServiceData::get()->getStatMap()->getLockableStat(rollupKey));
+    }
+    timeseries.setRollups(std::move(stats));
+  }
+
+  static std::string toString(int64_t subkey) {
+    return std::to_string(subkey);
+  }
+  static std::string toString(std::string_view subkey) {
+    return std::string(subkey);
+  }
+
+  const ExportedStat* prototype() const {
+    return prototype_ ? &*prototype_ : nullptr;
   }
 
   inline ThreadCachedServiceData::ThreadLocalStatsMap& tcData() {
@@ -1503,8 +1603,10 @@ class DynamicTimeseriesWrapper {
     }
   }
 
+  const std::optional<ExportedStat> prototype_;
   KeyHolder key_;
   std::vector<ExportType> exportTypes_;
+  folly::Synchronized<std::vector<internal::RollupSpec>> rollups_;
 };
 
 template <int N>
@@ -1526,9 +1628,17 @@ class DynamicHistogramWrapper {
 
   template <typename... Args>
   void add(int64_t value, Args&&... subkeys) {
-    (*ThreadCachedServiceData::getStatsThreadLocal())
-        .addHistogramValue(
-            key_.getFormattedKey(std::forward<Args>(subkeys)...), value);
+    addImpl(value, cast(subkeys)...);
+  }
+
+  /**
+   * Declares a rollup: a histogram with the same spec, merging the values of
+   * all the subkeys, or of those sharing the subkeys at the keptSubkeys
+   * positions; see DynamicTimeseriesWrapper::addRollup().
+   */
+  void addRollup(std::string keyFormat, std::vector<size_t> keptSubkeys = {}) {
+    rollups_.wlock()->emplace_back(
+        std::move(keyFormat), std::move(keptSubkeys), N);
   }
 
   // Exports a specific key without modifying the statistic. This ensures the
@@ -1545,12 +1655,65 @@ class DynamicHistogramWrapper {
   }
 
  private:
+  FOLLY_ERASE static int64_t cast(int64_t subkey) {
+    return subkey;
+  }
+  FOLLY_ERASE static std::string_view cast(std::string_view subkey) {
+    return subkey;
+  }
+
+  template <typename... Args>
+  void addImpl(int64_t value, Args... subkeys) {
+    auto key = key_.getFormattedKeyWithExtra(subkeys...);
+    if (key.second.get() == nullptr) {
+      // Cache thread local histogram; null if it was removed from fbData
+      key.second.get() =
+          ThreadCachedServiceData::getStatsThreadLocal()->getHistogramSafe(
+              key.first);
+      if (key.second.get() == nullptr) {
+        return;
+      }
+      setRollups(*key.second.get(), subkeys...);
+    }
+    key.second.get()->addValue(value);
+  }
+
+  template <typename... Args>
+  FOLLY_NOINLINE void setRollups(
+      ThreadCachedServiceData::TLHistogram& histogram,
+      Args... subkeys) {
+    auto rollups = rollups_.rlock();
+    if (rollups->empty()) {
+      return;
+    }
+    std::vector<std::string> subkeyStrings{toString(subkeys)...};
+    std::vector<ExportedHistogramMapImpl::LockableHistogram> histograms;
+    for (const auto& rollup : *rollups) {
+      auto const rollupKey = rollup.formatKey(subkeyStrings);
+      prepareKey(rollupKey);
+      histograms.push_back(
+          fbData->getHistogramMap()->getLockableHistogram(rollupKey));
+    }
+    histogram.setRollups(std::move(histograms));
+  }
+
+  static std::string toString(int64_t subkey) {
+    return std::to_string(subkey);
+  }
+  static std::string toString(std::string_view subkey) {
+    return std::string(subkey);
+  }
+
   void prepareKey(const std::string& key) {
     spec_.apply(key, fbData.ptr());
   }
 
-  internal::FormattedKeyHolder<N> key_;
+  internal::FormattedKeyHolder<
+      N,
+      std::shared_ptr<ThreadCachedServiceData::TLHistogram>>
+      key_;
   const internal::HistogramSpec spec_;
+  folly::Synchronized<std::vector<internal::RollupSpec>> rollups_;
 };
 
 /**
@@ -23,6 +23,8 @@
 
 #include <glog/logging.h>
 
+#include <tuple>
+
 namespace facebook {
 namespace fb303 {
 
@@ -236,7 +238,9 @@ TLTimeseriesT<LockTraits>::TLTimeseriesT(TLTimeseriesT&& other) noexcept(false)
       // used to protect count_ and sum_.  The caller is responsible for
       // providing their own synchronization around operations that change our
       // registration state.
-      globalStat_{std::move(other.globalStat_)} {
+      globalStat_{std::move(other.globalStat_)},
+      rollups_{std::move(other.rollups_)},
+      hasRollups_{other.hasRollups_.load(std::memory_order_relaxed)} {
   // We don't need to update count_ and sum_ here.
   // other.count_ and other.sum_ should always be 0 since the TLStatT
   // SubclassMove constructor just called aggregate() on the other stat.
@@ -249,6 +253,10 @@ TLTimeseriesT<LockTraits>& TLTimeseriesT<LockTraits>::operator=(
     TLTimeseriesT&& other) noexcept(false) {
   this->moveAssignment(other, [&] {
     globalStat_.swap(other.globalStat_);
+    rollups_.swap(other.rollups_);
+    hasRollups_.store(!rollups_.empty(), std::memory_order_relaxed);
+    other.hasRollups_.store(
+        !other.rollups_.empty(), std::memory_order_relaxed);
     // We don't need to move sum_ or count_: moveAssignment() performs
     // aggregation before calling us, so they should be 0 in both ourself
     // and the other TLTimeseries now.
@@ -294,6 +302,12 @@ void TLTimeseriesT<LockTraits>::aggregate(TimePoint now) {
   if (currentCount == 0 && !update) {
     return;
   }
+  if (currentCount != 0 && hasRollups_.load(std::memory_order_acquire)) {
+    std::unique_lock g{this->statLock_};
+    for (auto& rollup : rollups_) {
+      rollup.addValueAggregated(now, currentSum, currentCount);
+    }
+  }
   auto lockedStatPtr = globalStat_.lock();
   if (currentCount != 0) {
     // Note that we record all of the data points since the last call to
@@ -310,6 +324,14 @@ void TLTimeseriesT<LockTraits>::aggregate(TimePoint now) {
   }
 }
 
+template <class LockTraits>
+void TLTimeseriesT<LockTraits>::setRollups(
+    std::vector<ExportedStatMapImpl::LockableStat> rollups) {
+  std::unique_lock g{this->statLock_};
+  rollups_ = std::move(rollups);
+  hasRollups_.store(!rollups_.empty(), std::memory_order_release);
+}
+
 template <class LockTraits>
 void TLTimeseriesT<LockTraits>::init(ThreadLocalStatsT<LockTraits>* stats) {
   globalStat_ = stats->getStatsMap()->getLockableStatNoExport(this->name());
@@ -376,7 +398,8 @@ TLHistogramT<LockTraits>::TLHistogramT(TLHistogramT&& other) noexcept(false)
       simpleHistogram_{
           other.simpleHistogram_.getBucketSize(),
           other.simpleHistogram_.getMin(),
-          other.simpleHistogram_.getMax()} {
+          other.simpleHistogram_.getMax()},
+      rollups_{std::move(other.rollups_)} {
   // We don't need to copy the simpleHistogram_ data:
   // The SubclassMove constructor just called other.aggregate(), so
   // other.simpleHistogram_ should be empty now.
@@ -390,6 +413,7 @@ TLHistogramT<LockTraits>& TLHistogramT<LockTraits>::operator=(
   this->moveAssignment(other, [&] {
     // Move globalStat_.
     globalStat_.swap(other.globalStat_);
+    rollups_.swap(other.rollups_);
 
     // Update simpleHistogram_ to have the desired parameters.
     // It should already be empty since the moveAssignment() call above will
@@ -448,15 +472,24 @@ void TLHistogramT<LockTraits>::aggregate(TimePoint now) {
   if (!dirty_) {
     return;
   }
-  globalStat_.addValues(
-      ExportedHistogramMap::TimePoint(
-          std::chrono::duration_cast<ExportedStatForHistogram::Duration>(
-              now.time_since_epoch())),
-      simpleHistogram_);
+  auto const time = ExportedHistogramMap::TimePoint(
+      std::chrono::duration_cast<ExportedStatForHistogram::Duration>(
+          now.time_since_epoch()));
+  globalStat_.addValues(time, simpleHistogram_);
+  for (auto& rollup : rollups_) {
+    rollup.addValues(time, simpleHistogram_);
+  }
   simpleHistogram_.clear();
   dirty_ = false;
 }
 
+template <class LockTraits>
+void TLHistogramT<LockTraits>::setRollups(
+    std::vector<ExportedHistogramMapImpl::LockableHistogram> rollups) {
+  std::unique_lock g{this->statLock_};
+  rollups_ = std::move(rollups);
+}
+
 template <class LockTraits>
 void TLHistogramT<LockTraits>::initGlobalStat(
     ThreadLocalStatsT<LockTraits>* stats) {
@@ -477,6 +510,124 @@ ExportedHistogramMapImpl* TLHistogramT<LockTraits>::getHistogramMap(
   });
 }
 
+/*
+ * TLMultiStatT
+ */
+
+template <class LockTraits>
+TLMultiStatT<LockTraits>::TLMultiStatT(
+    ThreadLocalStatsT<LockTraits>* stats,
+    folly::StringPiece name,
+    std::vector<ExportedStatMapImpl::LockableStat> timeseries,
+    std::vector<ExportedHistogramMapImpl::LockableHistogram> histograms)
+    : TLStatT<LockTraits>(stats, name),
+      timeseries_(std::move(timeseries)),
+      histograms_(std::move(histograms)) {
+  for (auto const& stat : timeseries_) {
+    DCHECK(!stat.isNull());
+  }
+  if (!histograms_.empty()) {
+    // The layouts are fixed once a TimeseriesHistogram is created.
+    auto const& first = histograms_.front();
+    histogram_.emplace(first.getBucketSize(), first.getMin(), first.getMax());
+    for (auto const& hist : histograms_) {
+      sameLayout_.push_back(
+          hist.getBucketSize() == histogram_->getBucketSize() &&
+          hist.getMin() == histogram_->getMin() &&
+          hist.getMax() == histogram_->getMax());
+    }
+  }
+  this->postInit();
+}
+
+template <class LockTraits>
+TLMultiStatT<LockTraits>::TLMultiStatT(TLMultiStatT&& other) noexcept(false)
+    : TLStatT<
+          LockTraits>{typename TLStatT<LockTraits>::SubclassMoveTag{}, other},
+      timeseries_{std::move(other.timeseries_)},
+      histograms_{std::move(other.histograms_)},
+      sameLayout_{std::move(other.sameLayout_)},
+      // The SubclassMove constructor just called other.aggregate(), so
+      // other.histogram_ should be empty now.
+      histogram_{std::move(other.histogram_)} {
+  this->finishMove();
+}
+
+template <class LockTraits>
+TLMultiStatT<LockTraits>& TLMultiStatT<LockTraits>::operator=(
+    TLMultiStatT&& other) noexcept(false) {
+  this->moveAssignment(other, [&] {
+    timeseries_.swap(other.timeseries_);
+    histograms_.swap(other.histograms_);
+    sameLayout_.swap(other.sameLayout_);
+    // Both histograms are empty, since moveAssignment() aggregated them.
+    std::unique_lock g{this->statLock_};
+    histogram_.swap(other.histogram_);
+  });
+  return *this;
+}
+
+template <class LockTraits>
+TLMultiStatT<LockTraits>::~TLMultiStatT() {
+  this->preDestroy();
+}
+
+template <class LockTraits>
+void TLMultiStatT<LockTraits>::aggregate(TimePoint now) {
+  fb303::CounterType count = 0;
+  fb303::CounterType sum = 0;
+  if (histogram_) {
+    std::unique_lock g{this->statLock_};
+    if (dirty_) {
+      auto const time = ExportedHistogramMap::TimePoint(
+          std::chrono::duration_cast<ExportedStatForHistogram::Duration>(
+              now.time_since_epoch()));
+      auto const seconds =
+          std::chrono::duration_cast<std::chrono::seconds>(
+              now.time_since_epoch())
+              .count();
+      for (size_t i = 0; i < histograms_.size(); ++i) {
+        if (sameLayout_[i]) {
+          histograms_[i].addValues(time, *histogram_);
+        }
+      }
+      for (size_t b = 0; b < histogram_->getNumBuckets(); ++b) {
+        auto const& bucket = histogram_->getBucketByIndex(b);
+        if (bucket.count == 0) {
+          continue;
+        }
+        auto const bucketCount = static_cast<fb303::CounterType>(bucket.count);
+        count += bucketCount;
+        sum += bucket.sum;
+        for (size_t i = 0; i < histograms_.size(); ++i) {
+          if (!sameLayout_[i]) {
+            histograms_[i].addValue(
+                seconds, bucket.sum / bucketCount, bucketCount);
+          }
+        }
+      }
+      histogram_->clear();
+      dirty_ = false;
+    }
+  } else {
+    std::tie(count, sum) = value_.reset();
+  }
+
+  auto update = !this->shouldUpdateGlobalStatsOnRead();
+  if (count == 0 && !update) {
+    return;
+  }
+  for (auto& stat : timeseries_) {
+    auto lockedStatPtr = stat.lock();
+    if (count != 0) {
+      lockedStatPtr->addValueAggregated(now, sum, count);
+    }
+    if (update) {
+      lockedStatPtr->update(now);
+    }
+  }
+}
+
 /*
  * TLCounterT
  */
@@ -508,6 +659,8 @@ TLCounterT<LockTraits>& TLCounterT<LockTraits>::operator=(
     TLCounterT&& other) noexcept(false) {
   this->moveAssignment(other, [&] {
     serviceData_ = other.serviceData_;
+    // the handle may be resolved by another ServiceData
+    handle_ = ServiceData::CounterHandle();
     // We don't need to update value_ here.  Both value_ and other.value_
     // should have been reset to 0 by aggregating them in startMove().
   });
@@ -526,7 +679,20 @@ void TLCounterT<LockTraits>::aggregate() {
     return;
   }
 
-  serviceData_->incrementCounter(this->name(), delta);
+  ServiceData::CounterIncrement increment{this->name(), delta, &handle_};
+  serviceData_->incrementCounters({&increment, 1});
+}
+
+template <class LockTraits>
+void TLCounterT<LockTraits>::aggregateInto(
+    TimePoint /*now*/,
+    std::vector<ServiceData::CounterIncrement>& counters) {
+  auto delta = value_.reset();
+  if (delta == 0) {
+    return;
+  }
+
+  counters.push_back({this->name(), delta, &handle_});
 }
 
 /*
@@ -599,7 +765,13 @@ uint64_t ThreadLocalStatsT<LockTraits>::aggregate() {
 
   ExportedStat::TimePoint now{std::chrono::seconds(get_legacy_stats_time())};
   for (TLStatT<LockTraits>* stat : tlStats_) {
-    stat->aggregate(now);
+    stat->aggregateInto(now, counterIncrements_);
+  }
+  // The stats cannot be unlinked, which destroys their names and handles,
+  // while we hold the lock.
+  if (!counterIncrements_.empty()) {
+    serviceData_->incrementCounters(folly::range(counterIncrements_));
+    counterIncrements_.clear();
   }
 
   return tlStats_.size();
@@ -31,8 +31,10 @@
 #include <atomic>
 #include <chrono>
 #include <mutex>
+#include <optional>
 #include <shared_mutex>
 #include <string>
+#include <vector>
 
 namespace facebook::fb303 {
 
@@ -44,6 +46,8 @@ template <class LockTraits>
 class TLHistogramT;
 template <class LockTraits>
 class TLTimeseriesT;
+template <class LockTraits>
+class TLMultiStatT;
 
 namespace detail {
 
@@ -206,6 +210,7 @@ class ThreadLocalStatsT {
   using TLCounter = TLCounterT<LockTraits>;
   using TLHistogram = TLHistogramT<LockTraits>;
   using TLTimeseries = TLTimeseriesT<LockTraits>;
+  using TLMultiStat = TLMultiStatT<LockTraits>;
 
   /**
    * Create a new ThreadLocalStats container. Per default (NULL),
@@ -325,6 +330,12 @@ class ThreadLocalStatsT {
    */
   folly::Synchronized<std::vector<TLStat*>> linkPending_;
 
+  /**
+   * The flat counter increments collected by aggregate(), kept to reuse its
+   * capacity. Protected by link_->mutex.
+   */
+  std::vector<ServiceData::CounterIncrement> counterIncrements_;
+
   friend class TLStatT<LockTraits>;
   friend class detail::TLStatLink<LockTraits>;
 };
@@ -353,6 +364,17 @@ class TLStatT {
 
   virtual void aggregate(TimePoint now) = 0;
 
+  /**
+   * Called by the container instead of aggregate(). Flat counters append
+   * their increment to counters, for the container to apply those of all its
+   * stats at once, while other stats aggregate as usual.
+   */
+  virtual void aggregateInto(
+      TimePoint now,
+      std::vector<ServiceData::CounterIncrement>& /* counters */) {
+    aggregate(now);
+  }
+
  protected:
   struct SubclassMoveTag {};
 
@@ -583,6 +605,13 @@ class TLTimeseriesT : public TLStatT<LockTraits> {
 
   void aggregate(TimePoint now) override;
 
+  /**
+   * Makes aggregate() also add the values to each of rollups, e.g. stats
+   * summing several timeseries, so that they cost nothing when adding values.
+   * Replaces any previous rollups.
+   */
+  void setRollups(std::vector<ExportedStatMapImpl::LockableStat> rollups);
+
   /**
    * Unsafe to call concurrently with reset() or addValue(), only for testing
    */
@@ -628,6 +657,9 @@ class TLTimeseriesT : public TLStatT<LockTraits> {
 
   ExportedStatMapImpl::LockableStat globalStat_;
   ValueType value_;
+  // guarded by statLock_; hasRollups_ spares aggregate() the lock otherwise
+  std::vector<ExportedStatMapImpl::LockableStat> rollups_;
+  std::atomic<bool> hasRollups_{false};
 };
 
 /**
@@ -734,6 +766,14 @@ class TLHistogramT : public TLStatT<LockTraits> {
 
   void aggregate(TimePoint now) override;
 
+  /**
+   * Makes aggregate() also add the values to each of rollups, e.g.
+   * histograms merging several others, so that they cost nothing when adding
+   * values. Replaces any previous rollups.
+   */
+  void setRollups(
+      std::vector<ExportedHistogramMapImpl::LockableHistogram> rollups);
+
  private:
   using typename TLStatT<LockTraits>::Container;
 
@@ -744,6 +784,85 @@ class TLHistogramT : public TLStatT<LockTraits> {
   ExportedHistogramMapImpl::LockableHistogram globalStat_;
   folly::Histogram<fb303::CounterType> simpleHistogram_;
   bool dirty_{false};
+  // guarded by statLock_
+  std::vector<ExportedHistogramMapImpl::LockableHistogram> rollups_;
+};
+
+/**
+ * A thread-local stat recording a measurement once, and adding it to several
+ * global stats at aggregation, e.g. timeseries with different levels or
+ * export types and histograms, instead of one thread-local stat per global
+ * stat, each updated on every value.
+ *
+ * The cost of addValue() does not depend on the number of sinks. Without
+ * histogram sinks, it adds to a count and a sum, as TLTimeseries does. With
+ * them, it adds to a local histogram with the layout of the first one, from
+ * which the count and sum of the timeseries are computed. Histogram sinks
+ * with other layouts get the mean of each local bucket.
+ *
+ * The sinks are fixed at construction, and are obtained e.g. from
+ * ExportedStatMapImpl::getLockableStat() and
+ * ExportedHistogramMapImpl::getLockableHistogram().
+ */
+template <class LockTraits>
+class TLMultiStatT : public TLStatT<LockTraits> {
+ public:
+  TLMultiStatT(
+      ThreadLocalStatsT<LockTraits>* stats,
+      folly::StringPiece name,
+      std::vector<ExportedStatMapImpl::LockableStat> timeseries,
+      std::vector<ExportedHistogramMapImpl::LockableHistogram> histograms);
+  ~TLMultiStatT() override;
+
+  /**
+   * Move construction.
+   */
+  TLMultiStatT(TLMultiStatT&& other) noexcept(false);
+
+  /**
+   * Move assignment.
+   *
+   * The caller is responsible for synchronizing accesses around this call.  No
+   * other threads should be accessing either the moved-to or moved-from
+   * TLMultiStatT during this operation.
+   */
+  TLMultiStatT& operator=(TLMultiStatT&& other) noexcept(false);
+
+  void addValue(int64_t value) {
+    if (histogram_) {
+      std::unique_lock g{this->statLock_};
+      histogram_->addValue(value);
+      dirty_ = true;
+    } else {
+      value_.addValue(value);
+    }
+  }
+
+  void addRepeatedValue(int64_t value, int64_t nsamples) {
+    if (histogram_) {
+      std::unique_lock g{this->statLock_};
+      histogram_->addRepeatedValue(value, nsamples);
+      dirty_ = true;
+    } else {
+      value_.addValue(value * nsamples, nsamples);
+    }
+  }
+
+  void aggregate(TimePoint now) override;
+
+ private:
+  using ValueType =
+      typename LockTraits::template TimeSeriesType<fb303::CounterType>;
+
+  std::vector<ExportedStatMapImpl::LockableStat> timeseries_;
+  std::vector<ExportedHistogramMapImpl::LockableHistogram> histograms_;
+  // whether each of histograms_ has the layout of histogram_
+  std::vector<bool> sameLayout_;
+  // the values, if there are histogram sinks; guarded by statLock_
+  std::optional<folly::Histogram<fb303::CounterType>> histogram_;
+  bool dirty_{false};
+  // the values otherwise
+  ValueType value_;
 };
 
 /**
@@ -794,6 +913,9 @@ class TLCounterT : public TLStatT<LockTraits> {
 
   void aggregate(TimePoint now) override;
   void aggregate();
+  void aggregateInto(
+      TimePoint now,
+      std::vector<ServiceData::CounterIncrement>& counters) override;
 
   fb303::CounterType value() {
     return value_.value();
@@ -810,6 +932,12 @@ class TLCounterT : public TLStatT<LockTraits> {
    */
   ServiceData* serviceData_;
 
+  /**
+   * Where the global counter lives in serviceData_, so that aggregating
+   * only adds to it, without looking its name up.
+   */
+  ServiceData::CounterHandle handle_;
+
   /**
    * The current thread-local counter delta.
    *
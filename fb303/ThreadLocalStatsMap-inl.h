@@ -27,6 +27,7 @@ template <class LockTraits>
 void ThreadLocalStatsMapT<LockTraits>::addStatValue(
     folly::StringPiece name,
     int64_t value) {
+  sampleHotKey(name);
   auto state = state_.lock();
   getTimeseriesLocked(*state, name)->addValue(value);
 }
@@ -36,6 +37,7 @@ void ThreadLocalStatsMapT<LockTraits>::addStatValueAggregated(
     folly::StringPiece name,
     int64_t sum,
     int64_t numSamples) {
+  sampleHotKey(name);
   auto state = state_.lock();
   getTimeseriesLocked(*state, name)->addValueAggregated(sum, numSamples);
 }
@@ -45,6 +47,7 @@ void ThreadLocalStatsMapT<LockTraits>::addStatValue(
     folly::StringPiece name,
     int64_t value,
     ExportType exportType) {
+  sampleHotKey(name);
   auto state = state_.lock();
   getTimeseriesLocked(*state, name, exportType)->addValue(value);
 }
@@ -65,6 +68,7 @@ template <class LockTraits>
 void ThreadLocalStatsMapT<LockTraits>::addHistogramValue(
     folly::StringPiece name,
     int64_t value) {
+  sampleHotKey(name);
   auto state = state_.lock();
   TLHistogram* histogram = getHistogramLockedPtr(*state, name);
   if (histogram) {
@@ -76,6 +80,7 @@ template <class LockTraits>
 void ThreadLocalStatsMapT<LockTraits>::incrementCounter(
     folly::StringPiece name,
     int64_t amount) {
+  sampleHotKey(name);
   auto state = state_.lock();
   getCounterLocked(*state, name)->incrementValue(amount);
 }
@@ -201,10 +206,10 @@ typename ThreadLocalStatsMapT<LockTraits>::TLCounter* ThreadLocalStatsMapT<
 
 template <class LockTraits>
 void ThreadLocalStatsMapT<LockTraits>::resetAllData() {
-  auto state = state_.lock();
-  state->namedCounters_.clear();
-  state->namedHistograms_.clear();
-  state->namedTimeseries_.clear();
+  // Destroying the stats unregisters each of them, so do it after releasing
+  // the lock rather than blocking the lookups for the whole time.
+  State old;
+  std::swap(*state_.lock(), old);
 }
 
 template <class LockTraits>
@@ -17,7 +17,9 @@
 #pragma once
 
 #include <chrono>
+#include <utility>
 
+#include <fb303/HotKeySampler.h>
 #include <fb303/ThreadLocalStats.h>
 #include <folly/Range.h>
 #include <folly/ThreadLocal.h>
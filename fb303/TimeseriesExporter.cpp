@@ -110,6 +110,20 @@ void TimeseriesExporter::exportStat(
     StringPiece statName,
     DynamicCounters* counters,
     bool updateOnRead) {
+  // register the counter callbacks with the DynamicCounters obj, if they
+  // haven't already been registered.
+  ExportCallbacks callbacks;
+  appendExportCallbacks(callbacks, stat, type, statName, updateOnRead);
+  counters->registerCallbacks(std::move(callbacks), /* overwrite */ false);
+}
+
+/* static */
+void TimeseriesExporter::appendExportCallbacks(
+    ExportCallbacks& callbacks,
+    const StatPtr& stat,
+    ExportType type,
+    StringPiece statName,
+    bool updateOnRead) {
   CHECK_GE(type, 0);
   CHECK_LT(type, ExportTypeMeta::kNumExportTypes);
 
@@ -122,13 +136,9 @@ void TimeseriesExporter::exportStat(
   for (size_t lev = 0; lev < statObj.numLevels(); ++lev) {
     getCounterName(
         counterName.data(), kNameSize, &statObj, statName, type, lev);
-
-    // register the actual counter callback with the DynamicCounters obj, if it
-    // hasn't already been registered.
-    counters->registerCallback(
-        counterName.data(),
-        [=] { return getStatValue(*stat->rlock(), type, lev, updateOnRead); },
-        /* overwrite */ false);
+    callbacks.emplace_back(counterName.data(), [=] {
+      return getStatValue(*stat->rlock(), type, lev, updateOnRead);
+    });
   }
 }
 
@@ -18,8 +18,13 @@
 
 #include <fb303/ExportType.h>
 #include <fb303/Timeseries.h>
-#include <folly/Synchronized.h>
+#include <fb303/detail/LazilyClearedSynchronized.h>
+#include <fb303/detail/LockProfile.h>
 #include <chrono>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
 
 namespace facebook::fb303 {
 
@@ -29,7 +34,9 @@ using ExportedStat = MultiLevelTimeSeries<CounterType>;
 
 class TimeseriesExporter {
  public:
-  using StatPtr = std::shared_ptr<folly::Synchronized<ExportedStat>>;
+  using StatPtr = std::shared_ptr<detail::LazilyClearedSynchronized<
+      ExportedStat,
+      detail::ProfiledSharedMutex<detail::LockSite::kStat>>>;
 
   /**
    * Register the counter callback with the DynamicCounters object.
@@ -53,6 +60,21 @@ class TimeseriesExporter {
       DynamicCounters* counters,
       bool updateOnRead);
 
+  using ExportCallbacks =
+      std::vector<std::pair<std::string, std::function<CounterType()>>>;
+
+  /**
+   * Append the counter names and callbacks which exportStat() registers to
+   * callbacks, without registering them, so that callers can register the
+   * callbacks of many stats at once with DynamicCounters::registerCallbacks().
+   */
+  static void appendExportCallbacks(
+      ExportCallbacks& callbacks,
+      const StatPtr& stat,
+      ExportType type,
+      folly::StringPiece statName,
+      bool updateOnRead = true);
+
   /**
    * Unregister the counter callback from the DynamicCounters object.
    */
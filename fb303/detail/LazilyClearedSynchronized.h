@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+#include <folly/Likely.h>
+#include <folly/Synchronized.h>
+
+namespace facebook::fb303::detail {
+
+/**
+ * A folly::Synchronized over a value with a clear() method, which shares a
+ * generation with the other values of a registry. Bumping the generation
+ * resets all of them at once: each value calls clear() the next time it is
+ * locked, for reading or writing, instead of the registry walking them.
+ *
+ * Only wlock() and rlock() are exposed, since they are the ones checking the
+ * generation; unsafeGetUnlocked() must only be used for the parts of the
+ * value which clear() leaves alone.
+ */
+template <class T, class Mutex>
+class LazilyClearedSynchronized {
+  using Sync = folly::Synchronized<T, Mutex>;
+
+ public:
+  using Generation = std::atomic<uint64_t>;
+  using WLockedPtr = typename Sync::WLockedPtr;
+  using RLockedPtr = typename Sync::RLockedPtr;
+  using ConstRLockedPtr = typename Sync::ConstRLockedPtr;
+
+  /**
+   * Constructs the value from args. It is cleared whenever generation moves
+   * past its value at construction, or never if generation is null.
+   */
+  template <typename... Args>
+  explicit LazilyClearedSynchronized(
+      std::shared_ptr<const Generation> generation,
+      Args&&... args)
+      : sync_(std::forward<Args>(args)...),
+        generation_(std::move(generation)),
+        clearedAt_(load(generation_.get())) {}
+
+  WLockedPtr wlock() {
+    auto locked = sync_.wlock();
+    clearIfStale(*locked);
+    return locked;
+  }
+
+  RLockedPtr rlock() {
+    return rlockCleared(sync_);
+  }
+
+  ConstRLockedPtr rlock() const {
+    return rlockCleared(sync_);
+  }
+
+  const T& unsafeGetUnlocked() const {
+    return sync_.unsafeGetUnlocked();
+  }
+
+ private:
+  static uint64_t load(const Generation* generation) {
+    return generation ? generation->load(std::memory_order_acquire) : 0;
+  }
+
+  bool isStale() const {
+    return FOLLY_UNLIKELY(
+        load(generation_.get()) !=
+        clearedAt_.load(std::memory_order_relaxed));
+  }
+
+  // Checks the generation with the shared lock held, so that a reader never
+  // sees a value which a generation bumped before it got the lock should
+  // have cleared; a bump while the lock is held clears it for the next ones.
+  template <typename S>
+  auto rlockCleared(S& sync) const {
+    auto locked = sync.rlock();
+    while (isStale()) {
+      locked.unlock();
+      const_cast<LazilyClearedSynchronized*>(this)->wlock();
+      locked = sync.rlock();
+    }
+    return locked;
+  }
+
+  void clearIfStale(T& value) {
+    auto const generation = load(generation_.get());
+    if (FOLLY_UNLIKELY(
+            generation != clearedAt_.load(std::memory_order_relaxed))) {
+      value.clear();
+      clearedAt_.store(generation, std::memory_order_relaxed);
+    }
+  }
+
+  Sync sync_;
+  const std::shared_ptr<const Generation> generation_;
+  // the generation the value was last cleared at; only written while the
+  // value is locked for writing
+  std::atomic<uint64_t> clearedAt_;
+};
+
+} // namespace facebook::fb303::detail
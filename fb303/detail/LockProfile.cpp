@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fb303/detail/LockProfile.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include <folly/lang/Bits.h>
+#include <folly/small_vector.h>
+
+namespace facebook::fb303::detail {
+
+namespace {
+
+// Bumped whenever lock profiling is enabled, so that the locks a thread still
+// tracks from an earlier period of profiling are not accounted for.
+folly::relaxed_atomic<uint32_t> gLockProfilingGeneration{0};
+
+// Beyond this many, the tracked locks of a thread are assumed to be stale:
+// either released while profiling was disabled, or released by another thread.
+constexpr size_t kMaxHeldLocks = 64;
+
+struct HeldLock {
+  void const* mutex;
+  uint32_t generation;
+  std::chrono::steady_clock::time_point acquired;
+};
+
+folly::small_vector<HeldLock, 8>& heldLocks() noexcept {
+  thread_local folly::small_vector<HeldLock, 8> locks;
+  return locks;
+}
+
+} // namespace
+
+uint64_t LockTimeDistribution::getPercentileNs(double pct) const {
+  if (count == 0) {
+    return 0;
+  }
+  auto const rank = std::max<uint64_t>(
+      1, static_cast<uint64_t>(std::ceil(pct / 100.0 * double(count))));
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kNumBuckets; ++i) {
+    seen += buckets[i];
+    if (seen >= rank) {
+      return i == 0 ? 0 : (uint64_t(1) << i) - 1;
+    }
+  }
+  return (uint64_t(1) << (kNumBuckets - 1)) - 1;
+}
+
+void LockTimeHistogram::record(
+    std::chrono::steady_clock::duration elapsed) noexcept {
+  auto const ns = static_cast<uint64_t>(std::max<int64_t>(
+      0,
+      std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+  auto const bucket = std::min<size_t>(
+      folly::findLastSet(ns), LockTimeDistribution::kNumBuckets - 1);
+  buckets_[bucket] += 1;
+  count_ += 1;
+  sumNs_ += ns;
+}
+
+LockTimeDistribution LockTimeHistogram::get() const noexcept {
+  LockTimeDistribution distribution;
+  distribution.count = count_;
+  distribution.sumNs = sumNs_;
+  for (size_t i = 0; i < buckets_.size(); ++i) {
+    distribution.buckets[i] = buckets_[i];
+  }
+  return distribution;
+}
+
+void LockTimeHistogram::clear() noexcept {
+  for (auto& bucket : buckets_) {
+    bucket = 0;
+  }
+  count_ = 0;
+  sumNs_ = 0;
+}
+
+LockSiteStats& lockSiteStats(LockSite site) noexcept {
+  static LockSiteStats stats[size_t(LockSite::kNumSites)];
+  return stats[size_t(site)];
+}
+
+void setLockProfilingEnabled(bool enabled) noexcept {
+  if (enabled && !gLockProfilingEnabled) {
+    gLockProfilingGeneration += 1;
+  }
+  gLockProfilingEnabled = enabled;
+}
+
+void recordLockAcquired(void const* mutex) noexcept {
+  auto& locks = heldLocks();
+  if (locks.size() >= kMaxHeldLocks) {
+    locks.clear();
+  }
+  locks.push_back(
+      {mutex, gLockProfilingGeneration, std::chrono::steady_clock::now()});
+}
+
+void recordLockReleased(void const* mutex, LockSite site) noexcept {
+  auto& locks = heldLocks();
+  auto const it = std::find_if(locks.rbegin(), locks.rend(), [&](auto& held) {
+    return held.mutex == mutex;
+  });
+  if (it == locks.rend()) {
+    return;
+  }
+  if (it->generation == gLockProfilingGeneration) {
+    lockSiteStats(site).hold.record(
+        std::chrono::steady_clock::now() - it->acquired);
+  }
+  locks.erase(std::next(it).base());
+}
+
+} // namespace facebook::fb303::detail
@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <string_view>
+
+#include <fb303/detail/SelfStats.h>
+#include <folly/SharedMutex.h>
+#include <folly/synchronization/RelaxedAtomic.h>
+
+namespace facebook::fb303::detail {
+
+/**
+ * The sites of the fb303 locks whose acquisitions are profiled; see
+ * ProfiledSharedMutex. Each site aggregates all the locks of its kind, e.g.
+ * kStat covers the locks of every timeseries.
+ */
+enum class LockSite {
+  kCounters, // ServiceData::counters_
+  kStat, // each ExportedStat, locked through LockableStat
+  kHistogram, // each ExportedHistogram
+  kCallbackMap, // CallbackValuesMap::callbackMap_
+  kTLRegistry, // the ThreadLocalStatsT registry lock of TLStatsThreadSafe
+  kNumSites,
+};
+
+inline constexpr std::string_view kLockSiteNames[] = {
+    "counters",
+    "stat",
+    "histogram",
+    "callback_map",
+    "tl_registry",
+};
+static_assert(std::size(kLockSiteNames) == size_t(LockSite::kNumSites));
+
+/**
+ * A snapshot of a LockTimeHistogram.
+ *
+ * Bucket 0 counts durations of 0ns, and bucket i > 0 counts durations in
+ * [2^(i-1), 2^i) ns, the last bucket being unbounded.
+ */
+struct LockTimeDistribution {
+  static constexpr size_t kNumBuckets = 40;
+
+  uint64_t count{0};
+  uint64_t sumNs{0};
+  std::array<uint64_t, kNumBuckets> buckets{};
+
+  /// Returns the upper bound of the bucket holding the given percentile, in
+  /// [0, 100], of the durations; 0 if there are none.
+  uint64_t getPercentileNs(double pct) const;
+};
+
+/// A log2-bucketed histogram of lock wait or hold times, updated lock-free.
+class LockTimeHistogram {
+ public:
+  void record(std::chrono::steady_clock::duration elapsed) noexcept;
+  LockTimeDistribution get() const noexcept;
+  void clear() noexcept;
+
+ private:
+  folly::relaxed_atomic<uint64_t> count_{0};
+  folly::relaxed_atomic<uint64_t> sumNs_{0};
+  std::array<folly::relaxed_atomic<uint64_t>, LockTimeDistribution::kNumBuckets>
+      buckets_{};
+};
+
+struct LockSiteStats {
+  LockTimeHistogram wait;
+  LockTimeHistogram hold;
+};
+
+struct LockSiteProfile {
+  LockTimeDistribution wait;
+  LockTimeDistribution hold;
+};
+
+/// The statistics of every lock at the given site, across all instances.
+LockSiteStats& lockSiteStats(LockSite site) noexcept;
+
+/**
+ * Lock profiling records the wait and hold times of the profiled locks. It is
+ * process-wide, off by default, and may be switched at any time; locks held
+ * while it is switched are not accounted for.
+ *
+ * Wait times alone are also recorded while self stats are enabled, since
+ * ServiceData::exportSelfStats() exports their count and sum.
+ */
+void setLockProfilingEnabled(bool enabled) noexcept;
+
+inline folly::relaxed_atomic<bool> gLockProfilingEnabled{false};
+
+inline bool lockProfilingEnabled() noexcept {
+  return gLockProfilingEnabled;
+}
+
+/// Track the locks held by the current thread, to record their hold times.
+void recordLockAcquired(void const* mutex) noexcept;
+void recordLockReleased(void const* mutex, LockSite site) noexcept;
+
+/**
+ * A folly::SharedMutex which records its wait and hold times into
+ * lockSiteStats(Site) while lock profiling is enabled, and its wait times
+ * while self stats are enabled. Otherwise, each operation costs one extra
+ * check.
+ *
+ * Meant as the mutex of the folly::Synchronized containers of fb303, and so
+ * provides the upgrade operations used through ulock(). An upgrade lock and
+ * the exclusive lock it is converted to count as a single hold.
+ */
+template <LockSite Site>
+class ProfiledSharedMutex {
+ public:
+  void lock() {
+    acquire([this] { mutex_.lock(); });
+  }
+  bool try_lock() {
+    return tryAcquire(mutex_.try_lock());
+  }
+  void unlock() {
+    release();
+    mutex_.unlock();
+  }
+
+  void lock_shared() {
+    acquire([this] { mutex_.lock_shared(); });
+  }
+  bool try_lock_shared() {
+    return tryAcquire(mutex_.try_lock_shared());
+  }
+  void unlock_shared() {
+    release();
+    mutex_.unlock_shared();
+  }
+
+  void lock_upgrade() {
+    acquire([this] { mutex_.lock_upgrade(); });
+  }
+  bool try_lock_upgrade() {
+    return tryAcquire(mutex_.try_lock_upgrade());
+  }
+  void unlock_upgrade() {
+    release();
+    mutex_.unlock_upgrade();
+  }
+
+  void unlock_upgrade_and_lock() {
+    if (!lockProfilingEnabled() && !selfStatsEnabled()) {
+      mutex_.unlock_upgrade_and_lock();
+      return;
+    }
+    auto const start = std::chrono::steady_clock::now();
+    mutex_.unlock_upgrade_and_lock();
+    lockSiteStats(Site).wait.record(std::chrono::steady_clock::now() - start);
+  }
+  bool try_unlock_upgrade_and_lock() {
+    return mutex_.try_unlock_upgrade_and_lock();
+  }
+  void unlock_and_lock_upgrade() {
+    mutex_.unlock_and_lock_upgrade();
+  }
+  void unlock_and_lock_shared() {
+    mutex_.unlock_and_lock_shared();
+  }
+  void unlock_upgrade_and_lock_shared() {
+    mutex_.unlock_upgrade_and_lock_shared();
+  }
+
+ private:
+  template <typename LockFn>
+  void acquire(LockFn lockFn) {
+    auto const profiling = lockProfilingEnabled();
+    if (!profiling && !selfStatsEnabled()) {
+      lockFn();
+      return;
+    }
+    auto const start = std::chrono::steady_clock::now();
+    lockFn();
+    lockSiteStats(Site).wait.record(std::chrono::steady_clock::now() - start);
+    if (profiling) {
+      recordLockAcquired(this);
+    }
+  }
+
+  bool tryAcquire(bool acquired) {
+    if (acquired && lockProfilingEnabled()) {
+      recordLockAcquired(this);
+    }
+    return acquired;
+  }
+
+  void release() {
+    if (lockProfilingEnabled()) {
+      recordLockReleased(this, Site);
+    }
+  }
+
+  folly::SharedMutex mutex_;
+};
+
+} // namespace facebook::fb303::detail
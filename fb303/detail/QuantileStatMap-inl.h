@@ -81,8 +81,8 @@ folly::Optional<int64_t> BasicQuantileStatMap<ClockT>::getValue(
 
 template <typename ClockT>
 void BasicQuantileStatMap<ClockT>::getValues(
-    std::map<std::string, int64_t>& out) const {
-  auto now = ClockT::now();
+    std::map<std::string, int64_t>& out,
+    TimePoint now) const {
   // Processing the stats is expensive, so collect them first and process them
   // outside of the rlock.
   std::vector<std::pair<std::string, StatMapEntry>> counters;
@@ -66,7 +66,9 @@ class BasicQuantileStatMap {
   };
 
   folly::Optional<int64_t> getValue(folly::StringPiece key) const;
-  void getValues(std::map<std::string, int64_t>& out) const;
+  void getValues(
+      std::map<std::string, int64_t>& out,
+      TimePoint now = ClockT::now()) const;
   void getSelectedValues(
       std::map<std::string, int64_t>& out,
       const std::vector<std::string>& keys) const;
@@ -120,6 +122,10 @@ class BasicQuantileStatMap {
     detail::cachedTrimStale(counters_, expiry);
   }
 
+  RegexMatchCacheStats getRegexCacheStats() const {
+    return detail::cachedGetStats(counters_);
+  }
+
  private:
   struct CounterMapEntry {
     std::shared_ptr<stat_type> stat;
@@ -140,7 +146,8 @@ class BasicQuantileStatMap {
     folly::F14NodeMap<std::string, Mapped> map;
     // The key to this map is the base of the stat name, e.g. MyStat.
     folly::F14NodeMap<std::string, StatMapEntry> bases;
-    folly::RegexMatchCache matches; // requires map to have reference stability
+    // requires map to have reference stability
+    DeferredRegexMatchCache matches;
   };
   folly::Synchronized<MapWithKeyCache<CounterMapEntry>> counters_;
 
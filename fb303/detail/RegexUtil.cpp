@@ -16,8 +16,309 @@
 
 #include <fb303/detail/RegexUtil.h>
 
+#include <algorithm>
+#include <utility>
+
+DEFINE_uint64(
+    fb303_regex_cache_max_regexes,
+    10000,
+    "Maximum number of regexes kept in each fb303 regex-match-cache, after "
+    "which the least-recently-used regexes are evicted. Zero for no limit.");
+DEFINE_uint64(
+    fb303_regex_cache_max_matches,
+    10000000,
+    "Maximum total size of the match sets kept in each fb303 regex-match-"
+    "cache, after which the least-recently-used regexes are evicted. Zero for "
+    "no limit.");
+
 namespace facebook::fb303::detail {
 
+namespace {
+
+bool isRegexMetaChar(char const c) noexcept {
+  return std::string_view{".[]{}()\\*+?|^$"}.find(c) != std::string_view::npos;
+}
+
+bool isPlainChar(char const c) noexcept {
+  return c >= 0x20 && c < 0x7f && !isRegexMetaChar(c);
+}
+
+std::optional<LiteralRegex::Branch> parseLiteralBranch(std::string_view s) {
+  LiteralRegex::Branch branch;
+  std::string segment;
+  while (!s.empty()) {
+    if (s.starts_with(".*")) {
+      s.remove_prefix(2);
+      // lazy and possessive forms are not literal
+      if (s.starts_with('?') || s.starts_with('+')) {
+        return std::nullopt;
+      }
+      branch.segments.push_back(std::move(segment));
+      segment.clear();
+    } else if (s.front() == '\\') {
+      // only escaped metachars are plain literals; others, like `\d` or `\<`,
+      // have special meanings
+      if (s.size() < 2 || !isRegexMetaChar(s[1])) {
+        return std::nullopt;
+      }
+      segment.push_back(s[1]);
+      s.remove_prefix(2);
+    } else if (isPlainChar(s.front())) {
+      segment.push_back(s.front());
+      s.remove_prefix(1);
+    } else {
+      return std::nullopt;
+    }
+  }
+  branch.segments.push_back(std::move(segment));
+  return branch;
+}
+
+} // namespace
+
+bool LiteralRegex::Branch::matches(std::string_view str) const noexcept {
+  auto const& first = segments.front();
+  if (segments.size() == 1) {
+    return str == first;
+  }
+  auto const& last = segments.back();
+  if (str.size() < first.size() + last.size() || !str.starts_with(first) ||
+      !str.ends_with(last)) {
+    return false;
+  }
+  // leftmost matching of each middle segment is optimal, since `.*` on either
+  // side of a segment absorbs whatever precedes or follows it
+  str = str.substr(first.size(), str.size() - first.size() - last.size());
+  for (size_t i = 1; i + 1 < segments.size(); ++i) {
+    auto const pos = str.find(segments[i]);
+    if (pos == std::string_view::npos) {
+      return false;
+    }
+    str.remove_prefix(pos + segments[i].size());
+  }
+  return true;
+}
+
+std::optional<LiteralRegex> LiteralRegex::parse(std::string_view regex) {
+  // a single group enclosing the whole regex does not affect matching; any
+  // other parentheses are rejected when parsing the branches
+  if (regex.starts_with("(?:") && regex.ends_with(')')) {
+    regex = regex.substr(3, regex.size() - 4);
+  } else if (
+      regex.starts_with('(') && !regex.starts_with("(?") &&
+      regex.ends_with(')')) {
+    regex = regex.substr(1, regex.size() - 2);
+  }
+
+  LiteralRegex literal;
+  size_t begin = 0;
+  for (size_t i = 0; i <= regex.size(); ++i) {
+    if (i < regex.size() && regex[i] == '\\') {
+      if (i + 1 == regex.size()) {
+        return std::nullopt;
+      }
+      ++i; // skip the escaped char, which may be a `|`
+    } else if (i == regex.size() || regex[i] == '|') {
+      auto branch = parseLiteralBranch(regex.substr(begin, i - begin));
+      if (!branch) {
+        return std::nullopt;
+      }
+      literal.branches.push_back(std::move(*branch));
+      begin = i + 1;
+    }
+  }
+  return literal;
+}
+
+bool DeferredRegexMatchCache::hasString(string_pointer const str) const {
+  // release pending_ before locking state_, per the lock order
+  if (pending_.rlock()->contains(str)) {
+    return true;
+  }
+  return state_.rlock()->cache.hasString(str);
+}
+
+void DeferredRegexMatchCache::addString(string_pointer const str) {
+  pending_.wlock()->insert(str);
+}
+
+void DeferredRegexMatchCache::addStrings(
+    folly::Range<string_pointer const*> const strs) {
+  auto pending = pending_.wlock();
+  pending->reserve(pending->size() + strs.size());
+  pending->insert(strs.begin(), strs.end());
+}
+
+void DeferredRegexMatchCache::eraseString(string_pointer const str) {
+  if (pending_.wlock()->erase(str) == 0) {
+    state_.wlock()->cache.eraseString(str);
+  }
+}
+
+void DeferredRegexMatchCache::clear() {
+  auto state = state_.wlock();
+  pending_.wlock()->clear();
+  state->cache.clear();
+  state->regexes.clear();
+  state->lru.clear();
+  matches_ = 0;
+}
+
+void DeferredRegexMatchCache::foldPending() const {
+  if (!pending_.rlock()->empty()) {
+    foldPendingUnderLock(*state_.wlock());
+  }
+}
+
+void DeferredRegexMatchCache::foldPendingUnderLock(State& state) const {
+  auto const pending = std::exchange(*pending_.wlock(), {});
+  for (auto const str : pending) {
+    state.cache.addString(str);
+  }
+}
+
+DeferredRegexMatchCache::time_point::rep DeferredRegexMatchCache::nextUse(
+    time_point const now) const {
+  auto last = lastUse_.load();
+  while (true) {
+    auto const next = std::max(now.time_since_epoch().count(), last + 1);
+    if (lastUse_.compare_exchange_weak(last, next)) {
+      return next;
+    }
+  }
+}
+
+DeferredRegexMatchCache::RegexMap::iterator
+DeferredRegexMatchCache::leastRecentlyUsedUnderLock(State& state) const {
+  while (!state.lru.empty()) {
+    auto const front = state.lru.begin();
+    auto const entry = state.regexes.find(*front->second);
+    auto const lastUse = entry->second.lastUse.load();
+    if (lastUse == front->first) {
+      return entry;
+    }
+    // used since it was indexed
+    state.lru.erase(front);
+    entry->second.lruPos = state.lru.emplace(lastUse, &entry->first);
+  }
+  return state.regexes.end();
+}
+
+void DeferredRegexMatchCache::forgetUnderLock(
+    State& state,
+    RegexMap::iterator const entry) const {
+  matches_ -= entry->second.matches.load();
+  state.lru.erase(entry->second.lruPos);
+  state.regexes.erase(entry);
+}
+
+void DeferredRegexMatchCache::evictOverBudgetUnderLock(
+    State& state,
+    size_t incoming) const {
+  auto const maxRegexes = FLAGS_fb303_regex_cache_max_regexes;
+  auto const maxMatches = FLAGS_fb303_regex_cache_max_matches;
+  auto const overBudget = [&] {
+    return (maxRegexes && state.regexes.size() + incoming > maxRegexes) ||
+        (maxMatches && matches_.load() > maxMatches);
+  };
+
+  // The uses are unique, so purging the cache up to the last evicted regex
+  // evicts exactly the ones forgotten here.
+  time_point::rep lastEvicted = 0;
+  size_t evicted = 0;
+  while (overBudget()) {
+    auto const entry = leastRecentlyUsedUnderLock(state);
+    if (entry == state.regexes.end()) {
+      break;
+    }
+    lastEvicted = entry->second.lastUse.load();
+    forgetUnderLock(state, entry);
+    ++evicted;
+  }
+  if (evicted != 0) {
+    state.cache.purge(time_point{time_point::duration{lastEvicted + 1}});
+    evictions_ += evicted;
+  }
+}
+
+size_t DeferredRegexMatchCache::forgetUsedBeforeUnderLock(
+    State& state,
+    time_point::rep const expiry) const {
+  size_t forgotten = 0;
+  // the index is ordered by a lower bound of the uses
+  while (!state.lru.empty() && state.lru.begin()->first < expiry) {
+    auto const entry = leastRecentlyUsedUnderLock(state);
+    if (entry->second.lastUse.load() >= expiry) {
+      break;
+    }
+    forgetUnderLock(state, entry);
+    ++forgotten;
+  }
+  return forgotten;
+}
+
+void DeferredRegexMatchCache::findMatches(
+    std::vector<std::string>& out,
+    regex_key_and_view const& regex,
+    time_point const now) const {
+  auto const use = nextUse(now);
+  auto r = state_.rlock();
+  if (!r->cache.isReadyToFindMatches(regex) || !pending_.rlock()->empty()) {
+    r = {};
+    auto w = state_.wlock();
+    foldPendingUnderLock(*w);
+    if (!w->cache.isReadyToFindMatches(regex)) {
+      ++misses_;
+      // evict first, so that the regex being queried is never a candidate
+      evictOverBudgetUnderLock(*w, 1);
+      w->cache.prepareToFindMatches(regex);
+      auto [entry, created] = w->regexes.try_emplace(
+          std::string{static_cast<std::string_view>(regex)});
+      entry->second.lastUse = use;
+      if (created) {
+        entry->second.lruPos = w->lru.emplace(use, &entry->first);
+      }
+    } else {
+      ++hits_;
+    }
+    r = w.moveFromWriteToRead(); // atomic transition is required here
+  } else {
+    ++hits_;
+  }
+  auto const size = out.size();
+  cachedFindMatchesCopyUnderSharedLock(
+      out, r->cache, regex, time_point{time_point::duration{use}});
+  auto const entry = r->regexes.find(static_cast<std::string_view>(regex));
+  if (entry != r->regexes.end()) {
+    auto& [_, stats] = *entry;
+    // keep the latest of the concurrent uses, which the index relies on
+    auto last = stats.lastUse.load();
+    while (last < use && !stats.lastUse.compare_exchange_weak(last, use)) {
+    }
+    auto const matches = out.size() - size;
+    matches_ += matches - stats.matches.exchange(matches);
+  }
+}
+
+void DeferredRegexMatchCache::purge(time_point const expiry) const {
+  foldPending();
+  if (auto u = state_.ulock(); u->cache.hasItemsToPurge(expiry)) {
+    auto w = u.moveFromUpgradeToWrite();
+    w->cache.purge(expiry);
+    forgetUsedBeforeUnderLock(*w, expiry.time_since_epoch().count());
+  }
+}
+
+RegexMatchCacheStats DeferredRegexMatchCache::getStats() const {
+  RegexMatchCacheStats stats;
+  stats.hits = hits_;
+  stats.misses = misses_;
+  stats.evictions = evictions_;
+  stats.regexes = state_.rlock()->regexes.size();
+  stats.matches = matches_;
+  return stats;
+}
+
 void cachedFindMatchesCopyUnderSharedLock(
     std::vector<std::string>& out,
     folly::RegexMatchCache const& cache,
@@ -17,18 +17,137 @@
 #pragma once
 
 #include <chrono>
+#include <cstdint>
 #include <functional>
+#include <map>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <vector>
 
 #include <folly/Chrono.h>
 #include <folly/MapUtil.h>
+#include <folly/Range.h>
+#include <folly/Synchronized.h>
 #include <folly/container/F14Map.h>
+#include <folly/container/F14Set.h>
 #include <folly/container/RegexMatchCache.h>
 #include <folly/container/Reserve.h>
+#include <folly/synchronization/RelaxedAtomic.h>
+#include <gflags/gflags.h>
+
+DECLARE_uint64(fb303_regex_cache_max_regexes);
+DECLARE_uint64(fb303_regex_cache_max_matches);
 
 namespace facebook::fb303::detail {
 
+/// Counters describing a regex-match-cache. The regex and match counts are
+/// as of the last use of each regex.
+struct RegexMatchCacheStats {
+  uint64_t hits{};
+  uint64_t misses{};
+  uint64_t evictions{};
+  uint64_t regexes{};
+  uint64_t matches{};
+};
+
+/// A regex-match-cache which defers the work of adding strings, and which is
+/// bounded in size.
+///
+/// Adding a string to a folly::RegexMatchCache evaluates every cached regex
+/// against the string. Counter-maps add strings under their write-locks, so
+/// that work would block all readers and writers of the counter-map, e.g., on
+/// the first incrementCounter of each new key. Instead, added strings are kept
+/// in a pending set and are folded into the cache the next time matches are
+/// found or stale regexes are trimmed, which only require a shared lock on the
+/// counter-map.
+///
+/// The cache keeps a match set per distinct regex, so clients querying with
+/// ever-changing regexes could grow it without bound between trims. When a new
+/// regex is cached and the number of regexes exceeds
+/// --fb303_regex_cache_max_regexes, or the total size of the match sets
+/// exceeds --fb303_regex_cache_max_matches, the least-recently-used regexes
+/// are evicted. Zero disables the respective limit.
+///
+/// Callers must hold an exclusive lock on the counter-map to add, erase or
+/// clear strings, and must hold at least a shared lock on the counter-map for
+/// all other operations. Added strings must remain valid until erased.
+class DeferredRegexMatchCache {
+ public:
+  using string_pointer = std::string const*;
+  using regex_key_and_view = folly::RegexMatchCache::regex_key_and_view;
+  using time_point = folly::RegexMatchCache::time_point;
+
+  bool hasString(string_pointer str) const;
+
+  /// Adds the string to the pending set. Does no regex work.
+  void addString(string_pointer str);
+  /// Adds the strings to the pending set under a single lock acquisition.
+  void addStrings(folly::Range<string_pointer const*> strs);
+  void eraseString(string_pointer str);
+  void clear();
+
+  /// Folds all pending strings into the cache.
+  void foldPending() const;
+
+  /// Appends the strings matching the regex to out, preparing the cache for
+  /// the regex and folding pending strings first if need be.
+  void findMatches(
+      std::vector<std::string>& out,
+      regex_key_and_view const& regex,
+      time_point now) const;
+
+  /// Folds pending strings and removes the regexes not used since expiry.
+  void purge(time_point expiry) const;
+
+  RegexMatchCacheStats getStats() const;
+
+ private:
+  // The regexes by lastUse, as of when they were indexed, which is only done
+  // under the exclusive lock. An entry used since is at least as recent as
+  // its position, and is moved when it reaches the front.
+  using LruIndex = std::multimap<time_point::rep, std::string const*>;
+
+  // Tracks the regexes in the cache, for least-recently-used eviction. The
+  // atomic fields are updated under a shared lock.
+  struct RegexEntry {
+    mutable folly::relaxed_atomic<time_point::rep> lastUse{0};
+    mutable folly::relaxed_atomic<size_t> matches{0};
+    LruIndex::iterator lruPos;
+  };
+  using RegexMap = folly::F14NodeMap<std::string, RegexEntry>;
+
+  struct State {
+    folly::RegexMatchCache cache;
+    RegexMap regexes;
+    LruIndex lru;
+  };
+
+  // Returns a time no earlier than now and later than all the previous ones,
+  // so that evicting up to the time of a regex evicts no other.
+  time_point::rep nextUse(time_point now) const;
+  void foldPendingUnderLock(State& state) const;
+  // evicts until incoming more regexes fit in the budget
+  void evictOverBudgetUnderLock(State& state, size_t incoming) const;
+  // forgets the regexes last used before expiry, as purged from the cache
+  size_t forgetUsedBeforeUnderLock(State& state, time_point::rep expiry) const;
+  // returns the least-recently-used regex, or end if there is none
+  RegexMap::iterator leastRecentlyUsedUnderLock(State& state) const;
+  void forgetUnderLock(State& state, RegexMap::iterator entry) const;
+
+  // lock order: state_ before pending_
+  mutable folly::Synchronized<folly::F14FastSet<string_pointer>> pending_;
+  mutable folly::Synchronized<State> state_;
+
+  mutable folly::relaxed_atomic<time_point::rep> lastUse_{0};
+  // the sum of the matches of the regexes
+  mutable folly::relaxed_atomic<size_t> matches_{0};
+  mutable folly::relaxed_atomic<uint64_t> hits_{0};
+  mutable folly::relaxed_atomic<uint64_t> misses_{0};
+  mutable folly::relaxed_atomic<uint64_t> evictions_{0};
+};
+
 /// Gets the key-accessor from the map. If the map has a possibly-static data-
 /// member named fb303_key_accessor, returns that. Otherwise, returns a fallback
 /// key-accessor which simply picks the first of a pair, which is suitable for
@@ -107,35 +226,159 @@ void cachedClearStrings(Map& map) {
   map.map.clear();
 }
 
+/// A regex which may be evaluated without the regex engine.
+///
+/// Many regexes in getRegexCounters queries are really literal names, literal
+/// prefixes or suffixes, or alternations of these, like `foo\.bar\..*` or
+/// `(a|b|c)`. Such a regex is an alternation of branches, where each branch is
+/// a sequence of literal segments separated by `.*`. These are matched with
+/// plain string comparisons, and exact names and anchored prefixes may be
+/// looked up directly in the counter-map.
+///
+/// The matching semantics are those of boost::regex_match with the default
+/// perl syntax, under which `.` matches any character.
+struct LiteralRegex {
+  struct Branch {
+    /// The literal segments, split at each `.*`. The first and last segments
+    /// may be empty, e.g., `.*foo` is {"", "foo"} and `foo.*` is {"foo", ""}.
+    /// There is always at least one segment.
+    std::vector<std::string> segments;
+
+    /// Whether the branch matches exactly one string, the only segment.
+    bool isExact() const noexcept {
+      return segments.size() == 1;
+    }
+
+    /// The literal prefix which every match of the branch must start with.
+    std::string_view prefix() const noexcept {
+      return segments.front();
+    }
+
+    bool matches(std::string_view str) const noexcept;
+  };
+
+  std::vector<Branch> branches;
+
+  bool matches(std::string_view str) const noexcept {
+    return matchesAnyBefore(branches.size(), str);
+  }
+
+  /// Whether any of the first n branches matches. Used to avoid emitting a
+  /// string more than once when several branches match it.
+  bool matchesAnyBefore(size_t n, std::string_view str) const noexcept {
+    for (size_t i = 0; i < n; ++i) {
+      if (branches[i].matches(str)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /// Parses the regex. Returns none if the regex has any construct beyond
+  /// literals, `.*`, top-level alternation and a single enclosing group.
+  static std::optional<LiteralRegex> parse(std::string_view regex);
+};
+
+/// Whether literalFindMatches() answers the regex without visiting all the
+/// keys of the counter-map: every branch is an exact name, or has a literal
+/// prefix and the counter-map is ordered.
+template <typename Map>
+bool literalIsIndexed(LiteralRegex const& regex) noexcept {
+  constexpr bool ordered =
+      requires(Map const& map) { map.map.lower_bound(std::string_view{}); };
+  for (auto const& branch : regex.branches) {
+    if (!branch.isExact() && !(ordered && !branch.prefix().empty())) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/// Finds the strings in the counter-map matching the literal regex, without
+/// consulting the regex-match-cache. Exact names are looked up directly. When
+/// the counter-map is ordered and every branch has a literal prefix, only the
+/// ranges of keys with those prefixes are visited. Otherwise, all keys are
+/// scanned with plain string comparisons.
+template <typename Map>
+void literalFindMatches(
+    std::vector<std::string>& out,
+    Map const& map,
+    LiteralRegex const& regex) {
+  auto const key = cachedGetKeyAccessor(map);
+  constexpr bool ordered =
+      requires { map.map.lower_bound(std::string_view{}); };
+
+  if (!literalIsIndexed<Map>(regex)) {
+    for (auto const& entry : map.map) {
+      if (regex.matches(key(entry))) {
+        out.emplace_back(key(entry));
+      }
+    }
+    return;
+  }
+
+  for (size_t i = 0; i < regex.branches.size(); ++i) {
+    auto const& branch = regex.branches[i];
+    auto const prefix = branch.prefix();
+    if (branch.isExact()) {
+      auto const it = map.map.find(folly::StringPiece{prefix});
+      if (it != map.map.end() && !regex.matchesAnyBefore(i, prefix)) {
+        out.emplace_back(key(*it));
+      }
+    } else if constexpr (ordered) {
+      for (auto it = map.map.lower_bound(prefix);
+           it != map.map.end() && key(*it).starts_with(prefix);
+           ++it) {
+        auto const& name = key(*it);
+        if (branch.matches(name) && !regex.matchesAnyBefore(i, name)) {
+          out.emplace_back(name);
+        }
+      }
+    }
+  }
+}
+
 void cachedFindMatchesCopyUnderSharedLock(
     std::vector<std::string>& out,
     folly::RegexMatchCache const& cache,
     folly::RegexMatchCacheKeyAndView const& regex,
     folly::RegexMatchCache::time_point now);
 
+/// Finds the strings in the counter-map matching the regex. Literal regexes
+/// which need not visit all the keys are answered directly from the
+/// counter-map; all others are answered from the regex-match-cache, which is
+/// prepared for the regex if need be, so that repeating them only evaluates
+/// the keys added since.
 template <typename SyncMap>
 void cachedFindMatches(
     std::vector<std::string>& out,
     SyncMap& map,
     folly::RegexMatchCacheKeyAndView const& regex,
     folly::RegexMatchCache::time_point const now) {
-  auto r = map.rlock();
-  if (!r->matches.isReadyToFindMatches(regex)) {
-    r = {};
-    auto w = map.wlock();
-    const_cast<folly::RegexMatchCache&>(w->matches).prepareToFindMatches(regex);
-    r = w.moveFromWriteToRead(); // atomic transition is required here
+  using Map = std::remove_cvref_t<decltype(*map.rlock())>;
+  if (auto const literal =
+          LiteralRegex::parse(static_cast<std::string_view>(regex));
+      literal && literalIsIndexed<Map>(*literal)) {
+    literalFindMatches(out, *map.rlock(), *literal);
+    return;
   }
-  cachedFindMatchesCopyUnderSharedLock(out, r->matches, regex, now);
+
+  map.rlock()->matches.findMatches(out, regex, now);
 }
 
+/// Folds the strings added to the counter-map since the last call into its
+/// regex-match-cache, and removes the regexes not used since expiry. Meant to
+/// be called periodically, off the hot path.
 template <typename SyncMap>
 void cachedTrimStale(
     SyncMap& map,
     folly::RegexMatchCache::time_point const expiry) {
-  if (auto ulock = map.ulock(); ulock->matches.hasItemsToPurge(expiry)) {
-    ulock.moveFromUpgradeToWrite()->matches.purge(expiry);
-  }
+  map.rlock()->matches.purge(expiry);
+}
+
+template <typename SyncMap>
+RegexMatchCacheStats cachedGetStats(SyncMap& map) {
+  return map.rlock()->matches.getStats();
 }
 
 } // namespace facebook::fb303::detail
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include <folly/synchronization/RelaxedAtomic.h>
+
+namespace facebook::fb303::detail {
+
+/**
+ * Statistics fb303 keeps about its own operation, exported under the "fb303."
+ * prefix by ServiceData::exportSelfStats().
+ *
+ * Recording is process-wide and off by default: until it is enabled, the
+ * instrumented paths pay only for the check of selfStatsEnabled().
+ */
+inline folly::relaxed_atomic<bool> gSelfStatsEnabled{false};
+
+inline bool selfStatsEnabled() noexcept {
+  return gSelfStatsEnabled;
+}
+
+inline void setSelfStatsEnabled(bool enabled) noexcept {
+  gSelfStatsEnabled = enabled;
+}
+
+/// Cumulative cost of one kind of counter-read call, e.g. getCounters().
+struct ReadCallStats {
+  folly::relaxed_atomic<uint64_t> calls{0};
+  folly::relaxed_atomic<uint64_t> keys{0};
+  folly::relaxed_atomic<uint64_t> timeUs{0};
+
+  void record(std::chrono::steady_clock::duration elapsed, size_t numKeys) {
+    calls += 1;
+    keys += numKeys;
+    timeUs += std::chrono::duration_cast<std::chrono::microseconds>(elapsed)
+                  .count();
+  }
+};
+
+/**
+ * Records the call it spans into a ReadCallStats, with the number of entries
+ * the call added to its result, if self stats are enabled when it starts.
+ */
+template <typename Result>
+class ReadCallTimer {
+ public:
+  ReadCallTimer(ReadCallStats& stats, Result const& result)
+      : stats_(selfStatsEnabled() ? &stats : nullptr),
+        result_(result),
+        initialSize_(result.size()) {
+    if (stats_) {
+      start_ = std::chrono::steady_clock::now();
+    }
+  }
+
+  ~ReadCallTimer() {
+    if (stats_) {
+      stats_->record(
+          std::chrono::steady_clock::now() - start_,
+          result_.size() - initialSize_);
+    }
+  }
+
+  ReadCallTimer(ReadCallTimer const&) = delete;
+  ReadCallTimer& operator=(ReadCallTimer const&) = delete;
+
+ private:
+  ReadCallStats* const stats_;
+  Result const& result_;
+  size_t const initialSize_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+} // namespace facebook::fb303::detail
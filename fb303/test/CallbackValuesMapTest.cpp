@@ -16,8 +16,11 @@
 
 #include <fb303/CallbackValuesMap.h>
 
+#include <algorithm>
 #include <mutex>
 #include <thread>
+#include <utility>
+#include <vector>
 
 #include <boost/bind.hpp>
 #include <folly/synchronization/Baton.h>
@@ -121,6 +124,45 @@ TEST(CallbackValuesMapTest, GetCallback) {
   EXPECT_EQ(val2, 321);
 }
 
+TEST(CallbackValuesMapTest, RegisterCallbacks) {
+  TestCallbackValuesMap map;
+  map.registerCallback("key1", bind(echo, 1));
+
+  std::vector<std::pair<string, TestCallbackValuesMap::Callback>> callbacks;
+  callbacks.emplace_back("key1", bind(echo, 10));
+  callbacks.emplace_back("key2", bind(echo, 2));
+  callbacks.emplace_back("key2", bind(echo, 20));
+  callbacks.emplace_back("key3", bind(echo, 3));
+  map.registerCallbacks(callbacks, /* overwrite */ false);
+
+  TestCallbackValuesMap::ValuesMap values;
+  map.getValues(&values);
+  EXPECT_EQ((TestCallbackValuesMap::ValuesMap{
+                {"key1", 1}, {"key2", 2}, {"key3", 3}}),
+            values);
+  EXPECT_EQ(3, map.getNumRegistrations());
+
+  map.registerCallbacks(callbacks);
+  values.clear();
+  map.getValues(&values);
+  EXPECT_EQ((TestCallbackValuesMap::ValuesMap{
+                {"key1", 10}, {"key2", 20}, {"key3", 3}}),
+            values);
+  EXPECT_EQ(6, map.getNumRegistrations());
+
+  // the regex-match-cache sees each key once
+  std::vector<string> keys;
+  map.getRegexKeys(keys, "key.*");
+  std::sort(keys.begin(), keys.end());
+  EXPECT_EQ((std::vector<string>{"key1", "key2", "key3"}), keys);
+
+  EXPECT_TRUE(map.unregisterCallback("key2"));
+  keys.clear();
+  map.getRegexKeys(keys, "key.*");
+  std::sort(keys.begin(), keys.end());
+  EXPECT_EQ((std::vector<string>{"key1", "key3"}), keys);
+}
+
 TEST(CallbackValuesMapTest, DoubleDynamicCounterDeadlock) {
   TestCallbackValuesMap callbackMap;
   callbackMap.registerCallback("a", []() { return 42; });
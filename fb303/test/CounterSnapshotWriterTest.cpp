@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fb303/CounterSnapshotWriter.h>
+
+#include <limits>
+#include <map>
+#include <string>
+
+#include <fmt/core.h>
+#include <folly/FileUtil.h>
+#include <folly/testing/TestUtil.h>
+#include <gtest/gtest.h>
+
+using namespace facebook::fb303;
+
+namespace {
+
+using Counters = std::map<std::string, int64_t>;
+
+std::string pathPrefix(const folly::test::TemporaryDirectory& dir) {
+  return (dir.path() / "counters").string();
+}
+
+} // namespace
+
+TEST(CounterSnapshotWriterTest, RoundTrip) {
+  folly::test::TemporaryDirectory dir;
+  ServiceData data;
+  CounterSnapshotWriter::Options options;
+  options.pathPrefix = pathPrefix(dir);
+  CounterSnapshotWriter writer(data, options);
+
+  data.setCounter("a", 1);
+  data.setCounter("b", std::numeric_limits<int64_t>::max());
+  data.getDynamicCounters()->registerCallback("dyn", [] { return 7; });
+  writer.writeSnapshot();
+
+  // changed, unchanged, new and removed counters
+  data.setCounter("a", -5);
+  data.setCounter("b", std::numeric_limits<int64_t>::min());
+  data.setCounter("c", 3);
+  data.getDynamicCounters()->unregisterCallback("dyn");
+  writer.writeSnapshot();
+
+  data.clearCounter("a");
+  writer.writeSnapshot();
+  EXPECT_EQ(3, writer.getNumSnapshots());
+
+  auto const snapshots = CounterSnapshotReader::read(options.pathPrefix);
+  ASSERT_EQ(3, snapshots.size());
+  EXPECT_EQ(
+      (Counters{
+          {"a", 1},
+          {"b", std::numeric_limits<int64_t>::max()},
+          {"dyn", 7},
+      }),
+      snapshots[0].counters);
+  EXPECT_EQ(
+      (Counters{
+          {"a", -5},
+          {"b", std::numeric_limits<int64_t>::min()},
+          {"c", 3},
+      }),
+      snapshots[1].counters);
+  EXPECT_EQ(
+      (Counters{
+          {"b", std::numeric_limits<int64_t>::min()},
+          {"c", 3},
+      }),
+      snapshots[2].counters);
+  EXPECT_LE(snapshots[0].time, snapshots[1].time);
+  EXPECT_LE(snapshots[1].time, snapshots[2].time);
+  EXPECT_GE(std::chrono::system_clock::now(), snapshots[2].time);
+}
+
+TEST(CounterSnapshotWriterTest, Rotation) {
+  folly::test::TemporaryDirectory dir;
+  ServiceData data;
+  for (int i = 0; i < 100; ++i) {
+    data.setCounter(fmt::format("counter.{}", i), i);
+  }
+  CounterSnapshotWriter::Options options;
+  options.pathPrefix = pathPrefix(dir);
+  options.maxFileBytes = 2000;
+  options.maxFiles = 3;
+  {
+    CounterSnapshotWriter writer(data, options);
+    for (int i = 0; i < 20; ++i) {
+      data.setCounter("counter.0", i);
+      writer.writeSnapshot();
+    }
+  }
+
+  auto files = CounterSnapshotReader::listFiles(options.pathPrefix);
+  ASSERT_EQ(3, files.size());
+  EXPECT_NE(options.pathPrefix + ".0", files[0]) << "the oldest was deleted";
+
+  auto snapshots = CounterSnapshotReader::read(options.pathPrefix);
+  ASSERT_FALSE(snapshots.empty());
+  EXPECT_GT(20, snapshots.size());
+  EXPECT_EQ(100, snapshots.back().counters.size());
+  EXPECT_EQ(19, snapshots.back().counters.at("counter.0"));
+  EXPECT_EQ(99, snapshots.back().counters.at("counter.99"));
+
+  // a new writer continues after the existing files
+  CounterSnapshotWriter writer(data, options);
+  data.setCounter("counter.0", 20);
+  writer.writeSnapshot();
+  auto const last = CounterSnapshotReader::listFiles(options.pathPrefix);
+  ASSERT_EQ(3, last.size());
+  EXPECT_NE(files.back(), last.back());
+  EXPECT_EQ(
+      20,
+      CounterSnapshotReader::readFile(last.back())
+          .back()
+          .counters.at("counter.0"));
+}
+
+TEST(CounterSnapshotWriterTest, TruncatedFile) {
+  folly::test::TemporaryDirectory dir;
+  ServiceData data;
+  CounterSnapshotWriter::Options options;
+  options.pathPrefix = pathPrefix(dir);
+  CounterSnapshotWriter writer(data, options);
+  data.setCounter("a", 1);
+  writer.writeSnapshot();
+  data.setCounter("a", 2);
+  writer.writeSnapshot();
+
+  auto const files = CounterSnapshotReader::listFiles(options.pathPrefix);
+  ASSERT_EQ(1, files.size());
+  std::string contents;
+  ASSERT_TRUE(folly::readFile(files[0].c_str(), contents));
+
+  // a partially written last record is ignored
+  contents.pop_back();
+  ASSERT_TRUE(folly::writeFile(contents, files[0].c_str()));
+  auto const snapshots = CounterSnapshotReader::readFile(files[0]);
+  ASSERT_EQ(1, snapshots.size());
+  EXPECT_EQ((Counters{{"a", 1}}), snapshots[0].counters);
+
+  // but anything else is malformed
+  ASSERT_TRUE(folly::writeFile(std::string("FBXX"), files[0].c_str()));
+  EXPECT_THROW(CounterSnapshotReader::readFile(files[0]), std::runtime_error);
+}
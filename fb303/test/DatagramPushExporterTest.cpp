@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fb303/DatagramPushExporter.h>
+
+#include <map>
+#include <string>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include <folly/testing/TestUtil.h>
+#include <gtest/gtest.h>
+
+using namespace facebook::fb303;
+
+namespace {
+
+// A local agent receiving the datagrams.
+class Receiver {
+ public:
+  explicit Receiver(const folly::SocketAddress& address) {
+    fd_ = ::socket(address.getFamily(), SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    EXPECT_LE(0, fd_);
+    sockaddr_storage storage;
+    auto const len = address.getAddress(&storage);
+    EXPECT_EQ(0, ::bind(fd_, reinterpret_cast<sockaddr*>(&storage), len));
+  }
+
+  ~Receiver() {
+    ::close(fd_);
+  }
+
+  folly::SocketAddress getAddress() const {
+    folly::SocketAddress address;
+    address.setFromLocalAddress(folly::NetworkSocket::fromFd(fd_));
+    return address;
+  }
+
+  // Receives a datagram, waiting for up to timeoutMs for it.
+  bool receive(DatagramPushExporter::Packet& packet, int timeoutMs = 0) {
+    pollfd pfd{fd_, POLLIN, 0};
+    if (::poll(&pfd, 1, timeoutMs) != 1) {
+      return false;
+    }
+    char buf[65536];
+    auto const n = ::recv(fd_, buf, sizeof(buf), 0);
+    EXPECT_LT(0, n);
+    return DatagramPushExporter::decode(
+        folly::ByteRange(reinterpret_cast<unsigned char*>(buf), size_t(n)),
+        packet);
+  }
+
+  // Receives all the pending datagrams of a push.
+  std::map<std::string, int64_t> receiveAll(size_t* numPackets = nullptr) {
+    std::map<std::string, int64_t> counters;
+    DatagramPushExporter::Packet packet;
+    size_t packets = 0;
+    while (receive(packet)) {
+      ++packets;
+      counters.insert(packet.counters.begin(), packet.counters.end());
+    }
+    if (numPackets) {
+      *numPackets = packets;
+    }
+    return counters;
+  }
+
+ private:
+  int fd_{-1};
+};
+
+} // namespace
+
+class DatagramPushExporterTest : public testing::Test {
+ protected:
+  folly::test::TemporaryDirectory dir;
+  folly::SocketAddress address =
+      folly::SocketAddress::makeFromPath((dir.path() / "agent").string());
+  ServiceData data;
+};
+
+TEST_F(DatagramPushExporterTest, pushesChangedCounters) {
+  Receiver receiver(address);
+  data.setCounter("a", 1);
+  data.setCounter("b", -2);
+  data.getDynamicCounters()->registerCallback(
+      "dyn", [] { return int64_t(3); });
+
+  DatagramPushExporter exporter(data, address);
+  exporter.push();
+  auto counters = receiver.receiveAll();
+  EXPECT_EQ(1, counters["a"]);
+  EXPECT_EQ(-2, counters["b"]);
+  EXPECT_EQ(3, counters["dyn"]);
+  EXPECT_EQ(0, counters["fb303.push.pushes"]);
+
+  data.setCounter("b", 5);
+  exporter.push();
+  counters = receiver.receiveAll();
+  // b and the exporter's own counters changed
+  EXPECT_EQ(0, counters.count("a"));
+  EXPECT_EQ(0, counters.count("dyn"));
+  EXPECT_EQ(5, counters["b"]);
+  EXPECT_EQ(1, counters["fb303.push.pushes"]);
+
+  auto const stats = exporter.getStats();
+  EXPECT_EQ(2, stats.pushes);
+  EXPECT_EQ(0, stats.packetsDropped);
+}
+
+TEST_F(DatagramPushExporterTest, splitsPackets) {
+  Receiver receiver(address);
+  for (int i = 0; i < 100; ++i) {
+    data.setCounter("counter." + std::to_string(i), i);
+  }
+
+  DatagramPushExporter::Options options;
+  options.maxPacketSize = 64;
+  DatagramPushExporter exporter(data, address, options);
+  exporter.push();
+  size_t numPackets = 0;
+  auto const counters = receiver.receiveAll(&numPackets);
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_EQ(i, counters.at("counter." + std::to_string(i)));
+  }
+  EXPECT_LT(10, numPackets);
+  EXPECT_EQ(numPackets, exporter.getStats().packetsSent);
+}
+
+TEST_F(DatagramPushExporterTest, countsDropsAndResends) {
+  data.setCounter("a", 1);
+  DatagramPushExporter exporter(data, address);
+  // nobody is listening yet
+  exporter.push();
+  auto const stats = exporter.getStats();
+  EXPECT_LT(0, stats.packetsDropped);
+  EXPECT_LT(0, stats.countersDropped);
+  EXPECT_EQ(0, stats.packetsSent);
+
+  // the dropped counters are sent again, although unchanged
+  Receiver receiver(address);
+  exporter.push();
+  EXPECT_EQ(1, receiver.receiveAll()["a"]);
+}
+
+TEST_F(DatagramPushExporterTest, forgetsRemovedCounters) {
+  Receiver receiver(address);
+  data.setCounter("a", 1);
+  DatagramPushExporter::Options options;
+  options.fullPushInterval = 2;
+  DatagramPushExporter exporter(data, address, options);
+  exporter.push();
+  EXPECT_EQ(1, receiver.receiveAll()["a"]);
+
+  data.clearCounter("a");
+  exporter.push();
+  // the full push forgets a
+  exporter.push();
+  EXPECT_EQ(0, receiver.receiveAll().count("a"));
+
+  // so that it is sent again when it comes back, although unchanged
+  data.setCounter("a", 1);
+  exporter.push();
+  EXPECT_EQ(1, receiver.receiveAll()["a"]);
+}
+
+TEST_F(DatagramPushExporterTest, periodicUdp) {
+  Receiver receiver(folly::SocketAddress("127.0.0.1", 0));
+  data.setCounter("a", 42);
+
+  DatagramPushExporter::Options options;
+  options.interval = std::chrono::milliseconds(10);
+  options.fullPushInterval = 1;
+  DatagramPushExporter exporter(data, receiver.getAddress(), options);
+  exporter.start();
+
+  DatagramPushExporter::Packet packet;
+  ASSERT_TRUE(receiver.receive(packet, 5000));
+  EXPECT_TRUE(packet.full);
+  ASSERT_TRUE(receiver.receive(packet, 5000));
+  EXPECT_TRUE(packet.full);
+  exporter.stop();
+
+  std::map<std::string, int64_t> counters(
+      packet.counters.begin(), packet.counters.end());
+  EXPECT_EQ(42, counters["a"]);
+}
+
+TEST(DatagramPushExporter, decodeRejectsMalformed) {
+  DatagramPushExporter::Packet packet;
+  EXPECT_FALSE(DatagramPushExporter::decode(folly::ByteRange(), packet));
+  std::string bad(DatagramPushExporter::kHeaderSize, '\0');
+  EXPECT_FALSE(DatagramPushExporter::decode(
+      folly::ByteRange(folly::StringPiece(bad)), packet));
+}
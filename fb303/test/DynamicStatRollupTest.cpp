@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fb303/ThreadCachedServiceData.h>
+
+#include <stdexcept>
+#include <thread>
+
+#include <fb303/LegacyClock.h>
+#include <gtest/gtest.h>
+
+using namespace facebook::fb303;
+
+DEFINE_dynamic_timeseries(rollup_calls, "rollup_test.{}.{}.calls", SUM);
+DEFINE_dynamic_histogram(
+    rollup_latency,
+    "rollup_test.{}.latency",
+    10,
+    0,
+    100,
+    COUNT);
+
+TEST(DynamicStatRollupTest, RollupSpec) {
+  internal::RollupSpec spec("a.{}.b.{}", {1, 0}, 2);
+  EXPECT_EQ("a.y.b.x", spec.formatKey({"x", "y"}));
+  EXPECT_EQ("total", internal::RollupSpec("total", {}, 2).formatKey({"x"}));
+  EXPECT_THROW(internal::RollupSpec("a.{}", {}, 2), std::invalid_argument);
+  EXPECT_THROW(internal::RollupSpec("a.{}", {2}, 2), std::invalid_argument);
+}
+
+TEST(DynamicStatRollupTest, Timeseries) {
+  STATS_rollup_calls.addRollup("rollup_test.calls");
+  STATS_rollup_calls.addRollup("rollup_test.{}.calls", {0});
+  std::thread([] {
+    STATS_rollup_calls.add(1, "us", "get");
+    STATS_rollup_calls.add(2, "us", "put");
+    STATS_rollup_calls.addAggregated(4, 2, "eu", 7);
+  }).join();
+  STATS_rollup_calls.add(8, "us", "get");
+  ThreadCachedServiceData::get()->publishStats();
+
+  EXPECT_EQ(9, fbData->getCounter("rollup_test.us.get.calls.sum"));
+  EXPECT_EQ(2, fbData->getCounter("rollup_test.us.put.calls.sum"));
+  EXPECT_EQ(4, fbData->getCounter("rollup_test.eu.7.calls.sum"));
+  EXPECT_EQ(11, fbData->getCounter("rollup_test.us.calls.sum"));
+  EXPECT_EQ(4, fbData->getCounter("rollup_test.eu.calls.sum"));
+  EXPECT_EQ(15, fbData->getCounter("rollup_test.calls.sum"));
+}
+
+TEST(DynamicStatRollupTest, Histogram) {
+  STATS_rollup_latency.addRollup("rollup_test.latency");
+  std::thread([] {
+    STATS_rollup_latency.add(5, "get");
+    STATS_rollup_latency.add(15, "put");
+  }).join();
+  STATS_rollup_latency.add(25, "get");
+  ThreadCachedServiceData::get()->publishStats();
+
+  auto count = [](const char* key) {
+    auto hist = fbData->getHistogramMap()->getHistogram(key);
+    if (hist.isNull()) {
+      ADD_FAILURE() << "no histogram " << key;
+      return int64_t(-1);
+    }
+    hist->update(get_legacy_stats_time());
+    return hist->count(0);
+  };
+  EXPECT_EQ(2, count("rollup_test.get.latency"));
+  EXPECT_EQ(1, count("rollup_test.put.latency"));
+  EXPECT_EQ(3, count("rollup_test.latency"));
+}
@@ -18,8 +18,11 @@
 #include "common/stats/ServiceData.h"
 
 #include <gtest/gtest.h>
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <thread>
+#include <vector>
 
 using namespace std;
 using namespace facebook;
@@ -30,6 +33,7 @@ const std::string kCounterName = "generic.counter.name";
 std::atomic<int> currentSuffix(0);
 const int kMaxSuffix = 1024 * 32;
 const int kMaxThreads = 4;
+const size_t kMaxLatencySamples = 1 << 20;
 
 void addNewCounters() {
   int rounds = 0;
@@ -70,3 +74,58 @@ void testExportedNewCounters() {
 TEST(ExportedStatMapImplLoad, MultithreadedExport) {
   testExportedNewCounters();
 }
+
+TEST(ExportedStatMapImplLoad, LookupLatencyUnderChurn) {
+  stats::ServiceData data;
+  data.addStatValue("hot.stat");
+  data.addHistogram("hot.hist", 10, 0, 100);
+  auto const hotStat = data.getStatMap()->getStatPtr("hot.stat");
+  auto const hotHist = data.getHistogramMap()->getHistogramUnlocked("hot.hist");
+
+  const int keysPerThread = kMaxSuffix / kMaxThreads;
+  std::atomic<int> creatorsLeft(kMaxThreads);
+  std::vector<std::thread> creators;
+  for (int n = 0; n < kMaxThreads; ++n) {
+    creators.emplace_back([&, n] {
+      for (int i = 0; i < keysPerThread; ++i) {
+        auto const key = folly::to<std::string>("churn.", n, '.', i);
+        data.addStatValue(key);
+        data.addHistogram(key, 10, 0, 100);
+      }
+      --creatorsLeft;
+    });
+  }
+
+  // time the lookups of existing keys while new keys keep being created
+  std::vector<std::chrono::nanoseconds> latencies;
+  latencies.reserve(kMaxLatencySamples);
+  do {
+    auto const start = std::chrono::steady_clock::now();
+    auto const stat = data.getStatMap()->getStatPtr("hot.stat");
+    auto const hist = data.getHistogramMap()->getHistogramUnlocked("hot.hist");
+    auto const elapsed = std::chrono::steady_clock::now() - start;
+    if (latencies.size() < kMaxLatencySamples) {
+      latencies.push_back(elapsed);
+    }
+    EXPECT_EQ(hotStat, stat);
+    EXPECT_EQ(hotHist, hist);
+  } while (creatorsLeft > 0);
+
+  for (auto& thread : creators) {
+    thread.join();
+  }
+
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&](double pct) {
+    auto const index = static_cast<size_t>(latencies.size() * pct / 100);
+    return latencies[std::min(index, latencies.size() - 1)].count();
+  };
+  LOG(INFO) << "lookups of existing keys under churn: " << latencies.size()
+            << " samples, p50 " << percentile(50) << "ns, p99 "
+            << percentile(99) << "ns, p99.9 " << percentile(99.9)
+            << "ns, max " << latencies.back().count() << "ns";
+
+  const uint64_t numCreated = 1 + kMaxSuffix;
+  EXPECT_EQ(numCreated, data.getStatMap()->getNumStatsCreated());
+  EXPECT_EQ(numCreated, data.getHistogramMap()->getNumHistogramsCreated());
+}
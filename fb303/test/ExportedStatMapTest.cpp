@@ -174,6 +174,36 @@ TEST(ExportedStatMapImpl, MultithreadedExport) {
   EXPECT_EQ(numIters * numThreads * incrAmount, lockedObj->sum(0));
 }
 
+TEST(ExportedStatMapImpl, ExportStats) {
+  DynamicCounters dc;
+  ExportedStatMapImpl statMap(&dc);
+
+  statMap.addValue("existing", TimePoint{}, 5, SUM);
+  auto const existing = statMap.getStatPtr("existing");
+
+  const std::vector<string> names = {"a", "b", "existing", "a"};
+  const ExportType types[] = {SUM, COUNT};
+  statMap.exportStats(folly::range(names), folly::range(types));
+
+  EXPECT_EQ(3, statMap.getNumStatsCreated());
+  EXPECT_EQ(existing, statMap.getStatPtr("existing"));
+
+  map<string, int64_t> res;
+  dc.getCounters(&res);
+  // 3 stats of 4 levels each, for 2 types, with existing.sum already there
+  EXPECT_EQ(3 * 4 * 2, res.size());
+  EXPECT_EQ(5, res["existing.sum"]);
+  EXPECT_EQ(1, res["existing.count"]);
+
+  TimePoint now(std::chrono::seconds(::time(nullptr)));
+  statMap.addValue("a", now, 7);
+  res.clear();
+  dc.getCounters(&res);
+  EXPECT_EQ(7, res["a.sum"]);
+  EXPECT_EQ(1, res["a.count.60"]);
+  EXPECT_EQ(0, res["b.sum"]);
+}
+
 TEST(LockableStat, Swap) {
   using LockableStat = ExportedStatMapImpl::LockableStat;
   DynamicCounters dc;
@@ -0,0 +1,225 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+
+Measures the overhead TFunctionStatHandler adds to thrift calls, by driving its
+event-handler callbacks directly, without a server:
+
+  function_stat_handler_benchmark --threads=1,4,16,64 --methods=1,16,256
+
+For each thread count and method count, each thread runs the callbacks of a
+request, i.e. getContext, preRead, postRead, preWrite, postWrite and
+freeContext, cycling through the methods, and the mean time per request is
+reported for the sampled path, where every request is timed, and for the
+unsampled path, where none is.
+
+Then the threads stay alive with stats for every method while consolidate(),
+which the handler runs every 5 seconds, is timed, since its cost grows with
+threads x methods.
+
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iterator>
+#include <latch>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <fb303/DynamicCounters.h>
+#include <fb303/TFunctionStatHandler.h>
+#include <fmt/core.h>
+#include <folly/String.h>
+#include <folly/init/Init.h>
+#include <gflags/gflags.h>
+
+using namespace facebook::fb303;
+
+DEFINE_string(threads, "1,4,16,64", "Comma-separated thread counts");
+DEFINE_string(methods, "1,16,256", "Comma-separated method counts");
+DEFINE_uint64(requests_per_thread, 200000, "Requests run by each thread");
+DEFINE_uint32(consolidations, 10, "Number of consolidate() calls to time");
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Mirrors the stats of the standard handler for thrift servers.
+class BenchStatsPerThread : public TStatsPerThread {
+  void logContextDataProcessed(const TStatsRequestContext& context) override {
+    if (!context.writeBeginCalled_) {
+      return;
+    }
+    processed_++;
+    if (context.measureTime_) {
+      processTime_.addValue(
+          std::chrono::duration_cast<std::chrono::microseconds>(
+              context.writeBeginTime_ - context.readEndTime_)
+              .count());
+    }
+  }
+};
+
+// Does not start the consolidation thread, so that consolidate() runs only
+// when timed, and pins the sample rate until then.
+class BenchStatHandler : public TFunctionStatHandler {
+ public:
+  BenchStatHandler(DynamicCounters* counters, double sampleRate)
+      : TFunctionStatHandler{counters, "bench"}, sampleRate_(sampleRate) {}
+
+  std::shared_ptr<TStatsPerThread> createStatsPerThread(
+      std::string_view) override {
+    auto stats = std::make_shared<BenchStatsPerThread>();
+    stats->setSampleRate(sampleRate_);
+    return stats;
+  }
+
+ private:
+  double const sampleRate_;
+};
+
+std::vector<std::string> makeMethodNames(size_t count) {
+  std::vector<std::string> names;
+  for (size_t i = 0; i < count; ++i) {
+    names.push_back(fmt::format("method_{}", i));
+  }
+  return names;
+}
+
+void runRequest(TFunctionStatHandler& handler, std::string_view method) {
+  auto ctx = handler.getContext(method);
+  handler.preRead(ctx, method);
+  handler.postRead(ctx, method, nullptr, 128);
+  handler.preWrite(ctx, method);
+  handler.postWrite(ctx, method, 512);
+  handler.freeContext(ctx, method);
+}
+
+// Returns the mean time per request, in ns, across all threads.
+double measureRequests(
+    size_t numThreads,
+    std::vector<std::string> const& methods,
+    double sampleRate) {
+  DynamicCounters counters;
+  auto handler = std::make_shared<BenchStatHandler>(&counters, sampleRate);
+  std::vector<Clock::duration> elapsed(numThreads);
+  std::latch start(numThreads);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < numThreads; ++t) {
+    threads.emplace_back([&, t] {
+      // the first request of each method creates its per-thread stats
+      for (auto const& method : methods) {
+        runRequest(*handler, method);
+      }
+      start.arrive_and_wait();
+      auto const begin = Clock::now();
+      for (uint64_t i = 0; i < FLAGS_requests_per_thread; ++i) {
+        runRequest(*handler, methods[i % methods.size()]);
+      }
+      elapsed[t] = Clock::now() - begin;
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  Clock::duration total{};
+  for (auto const e : elapsed) {
+    total += e;
+  }
+  return double(std::chrono::duration_cast<std::chrono::nanoseconds>(total)
+                    .count()) /
+      (numThreads * FLAGS_requests_per_thread);
+}
+
+// Returns the mean time of consolidate(), in us, while numThreads threads hold
+// stats for every method.
+double measureConsolidate(
+    size_t numThreads,
+    std::vector<std::string> const& methods) {
+  DynamicCounters counters;
+  auto handler = std::make_shared<BenchStatHandler>(&counters, 1.0);
+  std::latch populated(numThreads + 1);
+  std::latch done(1);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < numThreads; ++t) {
+    threads.emplace_back([&] {
+      for (auto const& method : methods) {
+        runRequest(*handler, method);
+      }
+      populated.arrive_and_wait();
+      done.wait();
+    });
+  }
+  populated.arrive_and_wait();
+
+  // the first consolidation creates and exports the stats of each method
+  handler->consolidate();
+  Clock::duration total{};
+  for (uint32_t i = 0; i < FLAGS_consolidations; ++i) {
+    auto const begin = Clock::now();
+    handler->consolidate();
+    total += Clock::now() - begin;
+  }
+  done.count_down();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  return double(std::chrono::duration_cast<std::chrono::microseconds>(total)
+                    .count()) /
+      std::max<uint32_t>(FLAGS_consolidations, 1);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  folly::Init init(&argc, &argv, true);
+
+  std::vector<size_t> threadCounts;
+  folly::splitTo<size_t>(
+      ',', FLAGS_threads, std::back_inserter(threadCounts), true);
+  std::vector<size_t> methodCounts;
+  folly::splitTo<size_t>(
+      ',', FLAGS_methods, std::back_inserter(methodCounts), true);
+
+  fmt::print(
+      "{:>8}{:>10}{:>18}{:>20}{:>18}\n",
+      "threads",
+      "methods",
+      "sampled_ns/req",
+      "unsampled_ns/req",
+      "consolidate_us");
+  for (auto const numThreads : threadCounts) {
+    for (auto const numMethods : methodCounts) {
+      auto const methods = makeMethodNames(numMethods);
+      auto const sampled = measureRequests(numThreads, methods, 1.0);
+      auto const unsampled = measureRequests(numThreads, methods, 0.0);
+      auto const consolidate = measureConsolidate(numThreads, methods);
+      fmt::print(
+          "{:>8}{:>10}{:>18.1f}{:>20.1f}{:>18.1f}\n",
+          numThreads,
+          numMethods,
+          sampled,
+          unsampled,
+          consolidate);
+    }
+  }
+  return 0;
+}
@@ -64,6 +64,39 @@ BENCHMARK(GetRegexCountersBenchmarkOne, iters) {
   }
 }
 
+// Match an alternation of literal names, answered by direct lookups
+BENCHMARK(GetRegexCountersBenchmarkAlternation, iters) {
+  BenchmarkSuspender startup;
+  prepareData();
+  startup.dismiss();
+  for (int iter = 0; iter < iters; iter++) {
+    std::map<std::string, int64_t> counters = fb303Data.getRegexCounters(
+        "(matchingCounter1|matchingCounter2|counter3)");
+  }
+}
+
+// Match a literal suffix, answered by a scan without the regex engine
+BENCHMARK(GetRegexCountersBenchmarkSuffix, iters) {
+  BenchmarkSuspender startup;
+  prepareData();
+  startup.dismiss();
+  for (int iter = 0; iter < iters; iter++) {
+    std::map<std::string, int64_t> counters =
+        fb303Data.getRegexCounters(".*Counter1");
+  }
+}
+
+// Match a subset with a non-literal regex, answered by the regex-match-cache
+BENCHMARK(GetRegexCountersBenchmarkSubsetNonLiteral, iters) {
+  BenchmarkSuspender startup;
+  prepareData();
+  startup.dismiss();
+  for (int iter = 0; iter < iters; iter++) {
+    std::map<std::string, int64_t> counters =
+        fb303Data.getRegexCounters("matching[A-Z].*");
+  }
+}
+
 // Match all counters
 BENCHMARK(GetRegexCountersBenchmarkAll, iters) {
   BenchmarkSuspender startup;
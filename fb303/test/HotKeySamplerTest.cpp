@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fb303/HotKeySampler.h>
+
+#include <chrono>
+#include <thread>
+
+#include <fb303/ServiceData.h>
+#include <gtest/gtest.h>
+
+using namespace facebook::fb303;
+using namespace std::chrono_literals;
+
+TEST(HotKeySamplerTest, SpaceSavingSketch) {
+  SpaceSavingSketch sketch(2);
+  sketch.add("a", 5);
+  sketch.add("b", 2);
+  // replaces b, inheriting its count as the error
+  sketch.add("c");
+  auto entries = sketch.getEntries();
+  ASSERT_EQ(2, entries.size());
+  EXPECT_EQ("a", entries[0].key);
+  EXPECT_EQ(5, entries[0].count);
+  EXPECT_EQ(0, entries[0].error);
+  EXPECT_EQ("c", entries[1].key);
+  EXPECT_EQ(3, entries[1].count);
+  EXPECT_EQ(2, entries[1].error);
+
+  SpaceSavingSketch other(2);
+  other.add("a", 1);
+  other.merge(sketch);
+  EXPECT_EQ(6, other.getEntries()[0].count);
+}
+
+TEST(HotKeySamplerTest, Disabled) {
+  auto& sampler = HotKeySampler::get();
+  sampler.setSamplingPeriod(0);
+  ServiceData data;
+  data.incrementCounter("disabled");
+  sampler.merge(std::chrono::steady_clock::now() + 1h);
+  for (auto const& hotKey : data.getHotKeys()) {
+    EXPECT_NE("disabled", hotKey.key);
+  }
+}
+
+TEST(HotKeySamplerTest, HotKeys) {
+  auto& sampler = HotKeySampler::get();
+  sampler.setSamplingPeriod(1, 60s);
+  ServiceData data;
+  std::thread([&] {
+    for (int i = 0; i < 1000; ++i) {
+      data.incrementCounter("hot");
+    }
+  }).join();
+  for (int i = 0; i < 600; ++i) {
+    data.addStatValue("warm", 1, SUM);
+  }
+  data.incrementCounter("cold");
+
+  // nothing is published until the window is over
+  sampler.merge();
+  EXPECT_TRUE(data.getHotKeys().empty());
+  // the samples of the exited thread are merged too
+  sampler.merge(std::chrono::steady_clock::now() + 100s);
+  auto hotKeys = data.getHotKeys(3);
+  ASSERT_EQ(3, hotKeys.size());
+  EXPECT_EQ("hot", hotKeys[0].key);
+  EXPECT_EQ("warm", hotKeys[1].key);
+  EXPECT_EQ("cold", hotKeys[2].key);
+  EXPECT_NEAR(10, hotKeys[0].rate, 0.5);
+  EXPECT_NEAR(6, hotKeys[1].rate, 0.5);
+
+  data.exportHotKeys(1);
+  EXPECT_EQ("hot 10.0\n", data.getExportedValue("fb303.hot_keys"));
+  sampler.setSamplingPeriod(0);
+}
+
+TEST(HotKeySamplerTest, GetHotKeysMerges) {
+  auto& sampler = HotKeySampler::get();
+  sampler.setSamplingPeriod(1, 0s);
+  ServiceData data;
+  data.incrementCounter("merged");
+  // without a publishStats() or merge() call
+  auto hotKeys = data.getHotKeys(1);
+  ASSERT_EQ(1, hotKeys.size());
+  EXPECT_EQ("merged", hotKeys[0].key);
+  sampler.setSamplingPeriod(0);
+}
@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fb303/LabeledCounters.h>
+
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fb303/ServiceData.h>
+#include <gtest/gtest.h>
+
+using namespace facebook::fb303;
+
+using Counters = std::map<std::string, int64_t>;
+
+TEST(LabeledCountersTest, Handles) {
+  LabeledCounterFamily family("requests", {"region", "method"}, 10);
+  auto usGet = family.getHandle({"us", "get"});
+  auto euGet = family.getHandle({"eu", "get"});
+  EXPECT_EQ(0, usGet.getLabelSetId());
+  EXPECT_EQ(1, euGet.getLabelSetId());
+  EXPECT_EQ(0, family.getHandle({"us", "get"}).getLabelSetId());
+  EXPECT_THROW(family.getHandle({"us"}), std::invalid_argument);
+  EXPECT_THROW(
+      LabeledCounterFamily("bad", {"a", "a"}, 10), std::invalid_argument);
+
+  EXPECT_EQ(1, usGet.increment());
+  EXPECT_EQ(3, usGet.increment(2));
+  euGet.set(5);
+  EXPECT_EQ(5, family.getHandle({"eu", "get"}).get());
+
+  Counters counters;
+  family.getCounters(counters);
+  EXPECT_EQ(
+      (Counters{
+          {"requests.region=eu.method=get", 5},
+          {"requests.region=us.method=get", 3},
+      }),
+      counters);
+}
+
+TEST(LabeledCountersTest, Selection) {
+  LabeledCounterFamily family("requests", {"region", "method"}, 10);
+  family.getHandle({"us", "get"}).set(1);
+  family.getHandle({"us", "put"}).set(2);
+  family.getHandle({"eu", "get"}).set(3);
+
+  auto select = [&](const LabelSelector& selector) {
+    Counters counters;
+    family.getCounters(counters, selector);
+    return counters;
+  };
+  EXPECT_EQ(
+      (Counters{
+          {"requests.region=us.method=get", 1},
+          {"requests.region=us.method=put", 2},
+      }),
+      select({{"region", "us"}}));
+  EXPECT_EQ(
+      (Counters{{"requests.region=eu.method=get", 3}}),
+      select({{"method", "get"}, {"region", "eu"}}));
+  EXPECT_TRUE(select({{"region", "ap"}}).empty());
+  EXPECT_TRUE(select({{"host", "a"}}).empty());
+  EXPECT_EQ(3, select({}).size());
+}
+
+TEST(LabeledCountersTest, CardinalityLimit) {
+  LabeledCounterFamily family("requests", {"user"}, 2);
+  family.getHandle({"a"}).increment();
+  family.getHandle({"b"}).increment();
+  auto c = family.getHandle({"c"});
+  auto d = family.getHandle({"d"});
+  EXPECT_EQ(c.getLabelSetId(), d.getLabelSetId());
+  c.increment();
+  d.increment();
+  EXPECT_EQ(3, family.getNumLabelSets());
+  EXPECT_EQ(2, family.getNumOverflows());
+  // existing label sets are still resolved
+  EXPECT_EQ(1, family.getHandle({"a"}).get());
+
+  Counters counters;
+  family.getCounters(counters, {{"user", "__overflow__"}});
+  EXPECT_EQ((Counters{{"requests.user=__overflow__", 2}}), counters);
+}
+
+TEST(LabeledCountersTest, Concurrency) {
+  LabeledCounterFamily family("requests", {"shard"}, 100);
+  constexpr int kThreads = 4;
+  constexpr int kIters = 1000;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&] {
+      for (int i = 0; i < kIters; ++i) {
+        auto const shard = std::to_string(i % 10);
+        family.getHandle({shard}).increment();
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  Counters counters;
+  family.getCounters(counters);
+  ASSERT_EQ(10, counters.size());
+  for (auto const& [_, value] : counters) {
+    EXPECT_EQ(kThreads * kIters / 10, value);
+  }
+}
+
+TEST(LabeledCountersTest, ServiceData) {
+  ServiceData data;
+  auto family = data.addLabeledCounterFamily("requests", {"region"});
+  EXPECT_EQ(family, data.addLabeledCounterFamily("requests", {"region"}));
+  EXPECT_THROW(
+      data.addLabeledCounterFamily("requests", {"method"}),
+      std::invalid_argument);
+  EXPECT_EQ(family, data.getLabeledCounterFamily("requests"));
+  EXPECT_EQ(nullptr, data.getLabeledCounterFamily("missing"));
+
+  family->getHandle({"us"}).increment(2);
+  family->getHandle({"eu"}).increment(3);
+  data.setCounter("flat", 1);
+  EXPECT_EQ(
+      (Counters{
+          {"flat", 1},
+          {"requests.region=eu", 3},
+          {"requests.region=us", 2},
+      }),
+      data.getCounters());
+  EXPECT_EQ(
+      (Counters{{"requests.region=us", 2}}),
+      data.getLabeledCounters("requests", {{"region", "us"}}));
+  EXPECT_TRUE(data.getLabeledCounters("missing").empty());
+
+  Counters visited;
+  data.forEachCounterValue(
+      [&](const std::string& name, int64_t value) { visited[name] = value; });
+  EXPECT_EQ(data.getCounters(), visited);
+}
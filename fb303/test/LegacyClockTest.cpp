@@ -18,9 +18,11 @@
 
 #include <gtest/gtest.h>
 #include <chrono>
+#include <thread>
 
 using namespace std::chrono;
 using facebook::fb303::get_legacy_stats_time;
+using facebook::fb303::ScopedLegacyStatsTime;
 
 namespace {
 time_t get_system_clock_now() {
@@ -61,3 +63,20 @@ TEST(LegacyClockTest, system_seconds_clock_within_second_of_std_time) {
 
   EXPECT_LE(minimumDifference, kEpsilon);
 }
+
+TEST(LegacyClockTest, scoped_legacy_stats_time) {
+  {
+    ScopedLegacyStatsTime outer(1000);
+    EXPECT_EQ(1000, get_legacy_stats_time());
+    {
+      ScopedLegacyStatsTime inner(2000);
+      EXPECT_EQ(2000, get_legacy_stats_time());
+    }
+    EXPECT_EQ(1000, get_legacy_stats_time());
+    // other threads are not affected
+    time_t other = 0;
+    std::thread([&] { other = get_legacy_stats_time(); }).join();
+    EXPECT_LE(absdiff(std::time(nullptr), other), 1);
+  }
+  EXPECT_LE(absdiff(std::time(nullptr), get_legacy_stats_time()), 1);
+}
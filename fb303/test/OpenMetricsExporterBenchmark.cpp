@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+
+Compares writing the counters in the OpenMetrics text format with
+OpenMetricsExporter against the path taken by scraping side-cars, which call
+getCounters() and convert the resulting map:
+
+  open_metrics_exporter_benchmark --num_counters=1000000
+
+*/
+
+#include <iterator>
+#include <map>
+#include <string>
+
+#include <fb303/OpenMetricsExporter.h>
+#include <fmt/core.h>
+#include <folly/Benchmark.h>
+#include <folly/init/Init.h>
+#include <gflags/gflags.h>
+
+using namespace facebook::fb303;
+
+DEFINE_uint32(num_counters, 100000, "Number of flat counters");
+DEFINE_uint32(num_dynamic_counters, 10000, "Number of dynamic counters");
+
+namespace {
+
+ServiceData& getData() {
+  static auto* data = [] {
+    auto* sd = new ServiceData();
+    for (uint32_t i = 0; i < FLAGS_num_counters; ++i) {
+      sd->setCounter(
+          fmt::format("service.module_{}.counter_{}", i % 100, i), i);
+    }
+    for (uint32_t i = 0; i < FLAGS_num_dynamic_counters; ++i) {
+      sd->getDynamicCounters()->registerCallback(
+          fmt::format("service.dynamic_{}", i), [i] { return int64_t(i); });
+    }
+    return sd;
+  }();
+  return *data;
+}
+
+BENCHMARK(GetCountersAndConvert, iters) {
+  folly::BenchmarkSuspender setup;
+  auto& data = getData();
+  setup.dismiss();
+  for (size_t i = 0; i < iters; ++i) {
+    std::map<std::string, int64_t> counters;
+    data.getCounters(counters);
+    std::string out;
+    for (const auto& [name, value] : counters) {
+      OpenMetricsExporter::appendMetricName(out, name);
+      fmt::format_to(std::back_inserter(out), " {}\n", value);
+    }
+    out += "# EOF\n";
+    folly::doNotOptimizeAway(out);
+  }
+}
+
+BENCHMARK_RELATIVE(OpenMetricsExporterIOBuf, iters) {
+  folly::BenchmarkSuspender setup;
+  auto& data = getData();
+  OpenMetricsExporter::Options options;
+  options.histograms = false;
+  options.exportedValues = false;
+  setup.dismiss();
+  for (size_t i = 0; i < iters; ++i) {
+    auto out = OpenMetricsExporter(data, options).write();
+    folly::doNotOptimizeAway(out);
+  }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  folly::Init init(&argc, &argv, true);
+  getData();
+  folly::runBenchmarks();
+  return 0;
+}
@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fb303/OpenMetricsExporter.h>
+
+#include <string>
+
+#include <unistd.h>
+
+#include <folly/FileUtil.h>
+#include <gtest/gtest.h>
+
+using namespace facebook::fb303;
+
+class OpenMetricsExporterTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    data.setCounter("foo.bar", 1);
+    data.setCounter("9lives", 2);
+    data.getDynamicCounters()->registerCallback(
+        "dyn.counter", [] { return int64_t(3); });
+    data.addHistogram("lat", 10, 0, 30);
+    for (auto value : {-1, 5, 15, 100}) {
+      data.addHistogramValue("lat", value);
+    }
+    data.exportHistogram("lat", 50, AVG);
+    data.setExportedValue("build.rev", "a\"b");
+  }
+
+  ServiceData data;
+};
+
+TEST_F(OpenMetricsExporterTest, write) {
+  auto const out = OpenMetricsExporter(data).write()->moveToFbString();
+
+  EXPECT_NE(std::string::npos, out.find("foo_bar 1\n"));
+  EXPECT_NE(std::string::npos, out.find("_lives 2\n"));
+  EXPECT_NE(std::string::npos, out.find("dyn_counter 3\n"));
+
+  EXPECT_NE(
+      std::string::npos,
+      out.find("# TYPE lat histogram\n"
+               "lat_bucket{le=\"-1\"} 1\n"
+               "lat_bucket{le=\"9\"} 2\n"
+               "lat_bucket{le=\"19\"} 3\n"
+               "lat_bucket{le=\"29\"} 3\n"
+               "lat_bucket{le=\"+Inf\"} 4\n"
+               "lat_sum 119\n"
+               "lat_count 4\n"));
+  // the bucket exports of the histogram are not repeated as info metrics
+  EXPECT_EQ(std::string::npos, out.find("lat_hist"));
+  // nor are its percentile and stat counters
+  EXPECT_EQ(std::string::npos, out.find("lat_p50"));
+  EXPECT_EQ(std::string::npos, out.find("lat_avg"));
+
+  EXPECT_NE(
+      std::string::npos,
+      out.find("# TYPE build_rev info\n"
+               "build_rev_info{value=\"a\\\"b\"} 1\n"));
+
+  EXPECT_EQ("# EOF\n", out.substr(out.size() - 6));
+}
+
+TEST_F(OpenMetricsExporterTest, histogramCounters) {
+  OpenMetricsExporter::Options options;
+  options.histogramCounters = true;
+  auto const out = OpenMetricsExporter(data, options).write()->moveToFbString();
+
+  EXPECT_NE(std::string::npos, out.find("lat_p50 "));
+  EXPECT_NE(std::string::npos, out.find("lat_avg_60 "));
+  EXPECT_NE(std::string::npos, out.find("# TYPE lat histogram\n"));
+}
+
+TEST_F(OpenMetricsExporterTest, labeledAndSharedCounters) {
+  auto requests =
+      data.addLabeledCounterFamily("http.requests", {"method", "code"});
+  requests->getHandle({"GET", "200"}).increment(3);
+  requests->getHandle({"P\"UT", "500"}).increment();
+  // "a.b" is not a valid label name, so the rendered names are written
+  data.addLabeledCounterFamily("odd", {"a.b"})->getHandle({"x"}).increment();
+  auto arena = SharedCounterArena::create(4, 1);
+  arena->incrementCounter("shared.hits", 2);
+  data.setSharedCounters(arena);
+
+  auto const out = OpenMetricsExporter(data).write()->moveToFbString();
+
+  EXPECT_NE(
+      std::string::npos,
+      out.find("http_requests{method=\"GET\",code=\"200\"} 3\n"
+               "http_requests{method=\"P\\\"UT\",code=\"500\"} 1\n"));
+  EXPECT_NE(std::string::npos, out.find("\nodd_a_b_x 1\n"));
+  EXPECT_NE(std::string::npos, out.find("\nshared_hits 2\n"));
+}
+
+TEST_F(OpenMetricsExporterTest, chunks) {
+  for (int i = 0; i < 100; ++i) {
+    data.setCounter("counter." + std::to_string(i), i);
+  }
+  auto const whole = OpenMetricsExporter(data).write();
+
+  OpenMetricsExporter::Options options;
+  options.chunkSize = 64;
+  options.countersPerBatch = 7;
+  auto const chunked = OpenMetricsExporter(data, options).write();
+
+  EXPECT_EQ(1, whole->countChainElements());
+  EXPECT_LT(10, chunked->countChainElements());
+  EXPECT_EQ(whole->moveToFbString(), chunked->moveToFbString());
+}
+
+TEST_F(OpenMetricsExporterTest, writeToFd) {
+  int fds[2];
+  ASSERT_EQ(0, ::pipe(fds));
+  OpenMetricsExporter(data).write(fds[1]);
+  ::close(fds[1]);
+  std::string out;
+  ASSERT_TRUE(folly::readFile(fds[0], out));
+  ::close(fds[0]);
+
+  EXPECT_EQ(OpenMetricsExporter(data).write()->moveToFbString(), out);
+}
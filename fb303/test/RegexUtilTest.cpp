@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fb303/detail/RegexUtil.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/regex.hpp>
+#include <folly/container/F14Map.h>
+#include <gtest/gtest.h>
+
+using facebook::fb303::detail::LiteralRegex;
+using facebook::fb303::detail::literalFindMatches;
+using facebook::fb303::detail::literalIsIndexed;
+using std::string;
+using std::vector;
+
+namespace {
+
+const vector<string> kNames = {
+    "",
+    "a",
+    "b",
+    "ab",
+    "abc",
+    "aba",
+    "abba",
+    "a|b",
+    "foo.bar",
+    "fooxbar",
+    "foobar",
+    "foobarbar",
+    "baz",
+    "xbaz",
+    "axby",
+    "yx",
+    "requests.sum.60",
+    "requests.sum.600",
+    "errors.sum.60",
+};
+
+template <typename Mapped>
+struct OrderedMap {
+  std::map<string, Mapped, std::less<>> map;
+};
+
+template <typename Mapped>
+struct UnorderedMap {
+  folly::F14NodeMap<string, Mapped> map;
+};
+
+template <typename Map>
+vector<string> findSorted(Map const& map, LiteralRegex const& regex) {
+  vector<string> out;
+  literalFindMatches(out, map, regex);
+  std::sort(out.begin(), out.end());
+  return out;
+}
+
+vector<string> regexMatches(string const& regex) {
+  const boost::regex regexObject(regex);
+  vector<string> out;
+  for (auto const& name : kNames) {
+    if (boost::regex_match(name, regexObject)) {
+      out.push_back(name);
+    }
+  }
+  std::sort(out.begin(), out.end());
+  return out;
+}
+
+} // namespace
+
+TEST(RegexUtilTest, parseLiteral) {
+  for (auto const regex : {
+           "abc",
+           "a.*",
+           ".*a",
+           ".*a.*",
+           "a.*b.*a",
+           ".*",
+           "",
+           "()",
+           "(a|b|c)",
+           "(?:foo\\.bar|.*baz)",
+           "a\\|b",
+           "requests\\.sum\\..*",
+       }) {
+    EXPECT_TRUE(LiteralRegex::parse(regex).has_value()) << regex;
+  }
+}
+
+TEST(RegexUtilTest, parseNonLiteral) {
+  for (auto const regex : {
+           "a*",
+           "a+",
+           "a?",
+           "a.",
+           "a.+",
+           "a.*?",
+           "a.*+",
+           "[ab]",
+           "a{2}",
+           "\\d",
+           "\\<a",
+           "a\\",
+           "^a",
+           "a$",
+           "(a)|(b)",
+           "(?!a).*",
+           "a(b|c)",
+       }) {
+    EXPECT_FALSE(LiteralRegex::parse(regex).has_value()) << regex;
+  }
+}
+
+TEST(RegexUtilTest, matchesLikeRegex) {
+  OrderedMap<int> ordered;
+  UnorderedMap<int> unordered;
+  for (auto const& name : kNames) {
+    ordered.map.emplace(name, 0);
+    unordered.map.emplace(name, 0);
+  }
+
+  for (auto const regex : {
+           "abc",
+           "a.*",
+           ".*a",
+           ".*a.*",
+           "a.*b.*a",
+           "a.*a",
+           ".*",
+           "",
+           "(a|b|ab)",
+           "(a|a.*)",
+           "(?:foo\\.bar|.*baz)",
+           "foo.*bar",
+           "a\\|b",
+           "requests\\.sum\\..*",
+           ".*\\.sum\\.60",
+           "missing|.*x.*",
+       }) {
+    auto const literal = LiteralRegex::parse(regex);
+    ASSERT_TRUE(literal.has_value()) << regex;
+    auto const expected = regexMatches(regex);
+    EXPECT_EQ(expected, findSorted(ordered, *literal)) << regex;
+    EXPECT_EQ(expected, findSorted(unordered, *literal)) << regex;
+  }
+}
+
+TEST(RegexUtilTest, literalIsIndexed) {
+  auto const exact = *LiteralRegex::parse("(a|b)");
+  EXPECT_TRUE(literalIsIndexed<OrderedMap<int>>(exact));
+  EXPECT_TRUE(literalIsIndexed<UnorderedMap<int>>(exact));
+  // prefixes are only ranges of ordered maps
+  auto const prefix = *LiteralRegex::parse("(a|b.*)");
+  EXPECT_TRUE(literalIsIndexed<OrderedMap<int>>(prefix));
+  EXPECT_FALSE(literalIsIndexed<UnorderedMap<int>>(prefix));
+  auto const suffix = *LiteralRegex::parse(".*a");
+  EXPECT_FALSE(literalIsIndexed<OrderedMap<int>>(suffix));
+}
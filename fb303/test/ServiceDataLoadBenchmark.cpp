@@ -0,0 +1,463 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+
+This is a macro-benchmark which simulates the stats traffic of a real service,
+rather than isolating one component as the other benchmarks do.
+
+Writer threads update a mix of flat counters, timeseries, histograms, quantile
+stats and dynamic timeseries, picking keys with Zipfian popularity so that a
+few keys are hot and most are cold. Concurrently, a publisher thread
+aggregates the thread-local stats, and scraper threads call getCounters,
+getRegexCounters and getSelectedCounters the way monitoring agents do.
+
+It reports update latency percentiles (sampled), scrape latencies and sizes,
+publish times and the resident set size, and optionally writes the same as
+JSON for comparison across runs:
+
+  service_data_load_benchmark --writers=32 --scrapers=2 --keys=100000 \
+      --duration_s=30 --json_output=/tmp/before.json
+
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include <fb303/ServiceData.h>
+#include <fb303/ThreadCachedServiceData.h>
+#include <fmt/core.h>
+#include <folly/Conv.h>
+#include <folly/FileUtil.h>
+#include <folly/Random.h>
+#include <folly/String.h>
+#include <folly/init/Init.h>
+#include <folly/json/dynamic.h>
+#include <folly/json/json.h>
+#include <glog/logging.h>
+
+using namespace facebook::fb303;
+using Clock = std::chrono::steady_clock;
+
+DEFINE_uint32(writers, 16, "Number of writer threads");
+DEFINE_uint32(scrapers, 2, "Number of scraper threads");
+DEFINE_uint32(keys, 10000, "Number of distinct keys per stat type");
+DEFINE_double(zipf_exponent, 1.0, "Exponent of Zipfian key popularity");
+DEFINE_uint32(duration_s, 10, "Duration of the run in seconds");
+DEFINE_uint32(publish_interval_ms, 1000, "Interval between publishStats()");
+DEFINE_uint32(scrape_interval_ms, 100, "Pause between scrapes per scraper");
+DEFINE_uint32(
+    latency_sample_rate,
+    64,
+    "Measure the latency of one in this many updates");
+DEFINE_uint32(counter_weight, 40, "Relative weight of counter updates");
+DEFINE_uint32(timeseries_weight, 30, "Relative weight of timeseries updates");
+DEFINE_uint32(histogram_weight, 15, "Relative weight of histogram updates");
+DEFINE_uint32(quantile_weight, 5, "Relative weight of quantile stat updates");
+DEFINE_uint32(dynamic_weight, 10, "Relative weight of dynamic stat updates");
+DEFINE_uint32(selected_keys, 100, "Number of keys per getSelectedCounters");
+DEFINE_string(
+    scrape_regex,
+    "load\\.(ts|hist)\\.1[0-9]*\\..*",
+    "Regex passed to getRegexCounters");
+DEFINE_string(json_output, "", "If set, write the results as JSON here");
+
+DEFINE_dynamic_timeseries(load_dynamic, "load.dynamic.{}", SUM, COUNT);
+
+namespace {
+
+/// Samples integers in [0, n) with Zipfian popularity, via the inverse CDF.
+class ZipfSampler {
+ public:
+  ZipfSampler(size_t n, double exponent) : cdf_(n) {
+    double sum = 0;
+    for (size_t i = 0; i < n; ++i) {
+      sum += 1.0 / std::pow(double(i + 1), exponent);
+      cdf_[i] = sum;
+    }
+    for (auto& c : cdf_) {
+      c /= sum;
+    }
+  }
+
+  size_t operator()(folly::ThreadLocalPRNG& rng) const {
+    auto const u = folly::Random::randDouble01(rng);
+    auto const it = std::lower_bound(cdf_.begin(), cdf_.end(), u);
+    return std::min<size_t>(it - cdf_.begin(), cdf_.size() - 1);
+  }
+
+ private:
+  std::vector<double> cdf_;
+};
+
+enum class UpdateType {
+  kCounter,
+  kTimeseries,
+  kHistogram,
+  kQuantile,
+  kDynamic,
+  kNumTypes,
+};
+
+constexpr std::string_view kUpdateTypeNames[] = {
+    "counter",
+    "timeseries",
+    "histogram",
+    "quantile",
+    "dynamic",
+};
+
+struct Keys {
+  std::vector<std::string> counters;
+  std::vector<std::string> timeseries;
+  std::vector<std::string> histograms;
+  std::vector<std::shared_ptr<QuantileStat>> quantiles;
+};
+
+Keys registerKeys(ServiceData& serviceData) {
+  Keys keys;
+  for (uint32_t i = 0; i < FLAGS_keys; ++i) {
+    keys.counters.push_back(folly::to<std::string>("load.counter.", i));
+    keys.timeseries.push_back(folly::to<std::string>("load.ts.", i));
+    serviceData.addStatExportType(keys.timeseries.back(), SUM);
+    serviceData.addStatExportType(keys.timeseries.back(), AVG);
+    keys.histograms.push_back(folly::to<std::string>("load.hist.", i));
+    serviceData.addHistogram(keys.histograms.back(), 100, 0, 10000);
+    serviceData.exportHistogram(keys.histograms.back(), 50, 99, AVG);
+    keys.quantiles.push_back(
+        serviceData.getQuantileStat(folly::to<std::string>("load.qstat.", i)));
+  }
+  return keys;
+}
+
+struct WriterResult {
+  uint64_t updates{0};
+  std::vector<std::vector<int64_t>> latencyNs{size_t(UpdateType::kNumTypes)};
+};
+
+struct ScrapeResult {
+  std::vector<int64_t> latencyUs;
+  std::vector<int64_t> numKeys;
+};
+
+struct Scrapes {
+  ScrapeResult getCounters;
+  ScrapeResult getRegexCounters;
+  ScrapeResult getSelectedCounters;
+};
+
+UpdateType pickUpdateType(folly::ThreadLocalPRNG& rng) {
+  uint32_t const weights[] = {
+      FLAGS_counter_weight,
+      FLAGS_timeseries_weight,
+      FLAGS_histogram_weight,
+      FLAGS_quantile_weight,
+      FLAGS_dynamic_weight,
+  };
+  uint32_t total = 0;
+  for (auto const w : weights) {
+    total += w;
+  }
+  auto r = folly::Random::rand32(std::max(total, 1u), rng);
+  for (size_t i = 0; i < std::size(weights); ++i) {
+    if (r < weights[i]) {
+      return UpdateType(i);
+    }
+    r -= weights[i];
+  }
+  return UpdateType::kCounter;
+}
+
+void update(UpdateType type, size_t key, Keys const& keys) {
+  auto& tc = *ThreadCachedServiceData::get();
+  switch (type) {
+    case UpdateType::kCounter:
+      tc.incrementCounter(keys.counters[key]);
+      return;
+    case UpdateType::kTimeseries:
+      tc.addStatValue(keys.timeseries[key], int64_t(key));
+      return;
+    case UpdateType::kHistogram:
+      tc.addHistogramValue(keys.histograms[key], int64_t(key % 10000));
+      return;
+    case UpdateType::kQuantile:
+      keys.quantiles[key]->addValue(double(key));
+      return;
+    case UpdateType::kDynamic:
+      STATS_load_dynamic.add(1, int64_t(key));
+      return;
+    case UpdateType::kNumTypes:
+      break;
+  }
+  LOG(FATAL) << "Unknown update type";
+}
+
+void runWriter(
+    Keys const& keys,
+    ZipfSampler const& zipf,
+    std::atomic<bool> const& stop,
+    WriterResult& result) {
+  folly::ThreadLocalPRNG rng;
+  uint64_t n = 0;
+  while (!stop.load(std::memory_order_relaxed)) {
+    auto const type = pickUpdateType(rng);
+    auto const key = zipf(rng);
+    if (n++ % std::max(FLAGS_latency_sample_rate, 1u) == 0) {
+      auto const start = Clock::now();
+      update(type, key, keys);
+      auto const elapsed = Clock::now() - start;
+      result.latencyNs[size_t(type)].push_back(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed)
+              .count());
+    } else {
+      update(type, key, keys);
+    }
+  }
+  result.updates = n;
+}
+
+template <typename F>
+void timeScrape(ScrapeResult& result, F&& scrape) {
+  auto const start = Clock::now();
+  auto const numKeys = scrape();
+  auto const elapsed = Clock::now() - start;
+  result.latencyUs.push_back(
+      std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+  result.numKeys.push_back(int64_t(numKeys));
+}
+
+void runScraper(
+    ServiceData& serviceData,
+    Keys const& keys,
+    std::atomic<bool> const& stop,
+    Scrapes& result) {
+  folly::ThreadLocalPRNG rng;
+  for (uint64_t n = 0; !stop.load(std::memory_order_relaxed); ++n) {
+    switch (n % 3) {
+      case 0:
+        timeScrape(result.getCounters, [&] {
+          return serviceData.getCounters().size();
+        });
+        break;
+      case 1:
+        timeScrape(result.getRegexCounters, [&] {
+          return serviceData.getRegexCounters(FLAGS_scrape_regex).size();
+        });
+        break;
+      case 2: {
+        std::vector<std::string> selected;
+        for (uint32_t i = 0; i < FLAGS_selected_keys; ++i) {
+          auto const key = folly::Random::rand32(FLAGS_keys, rng);
+          selected.push_back(keys.counters[key]);
+          selected.push_back(keys.timeseries[key] + ".sum.60");
+        }
+        timeScrape(result.getSelectedCounters, [&] {
+          return serviceData.getSelectedCounters(selected).size();
+        });
+        break;
+      }
+    }
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(FLAGS_scrape_interval_ms));
+  }
+}
+
+void runPublisher(std::atomic<bool> const& stop, std::vector<int64_t>& out) {
+  auto next = Clock::now();
+  while (!stop.load(std::memory_order_relaxed)) {
+    next += std::chrono::milliseconds(FLAGS_publish_interval_ms);
+    std::this_thread::sleep_until(next);
+    auto const start = Clock::now();
+    ThreadCachedServiceData::get()->publishStats();
+    auto const elapsed = Clock::now() - start;
+    out.push_back(
+        std::chrono::duration_cast<std::chrono::microseconds>(elapsed)
+            .count());
+  }
+}
+
+int64_t getRssBytes() {
+  std::string statm;
+  if (!folly::readFile("/proc/self/statm", statm)) {
+    return 0;
+  }
+  // statm holds "size resident shared ..." in pages.
+  std::vector<folly::StringPiece> fields;
+  folly::split(' ', statm, fields);
+  if (fields.size() < 2) {
+    return 0;
+  }
+  auto const pages = folly::tryTo<int64_t>(fields[1]);
+  return pages.hasValue() ? *pages * sysconf(_SC_PAGESIZE) : 0;
+}
+
+folly::dynamic summarize(std::vector<int64_t> values) {
+  auto summary = folly::dynamic::object("count", int64_t(values.size()));
+  if (values.empty()) {
+    return summary;
+  }
+  std::sort(values.begin(), values.end());
+  auto const pct = [&](double p) {
+    return values[std::min(values.size() - 1, size_t(p * values.size()))];
+  };
+  summary["p50"] = pct(0.5);
+  summary["p90"] = pct(0.9);
+  summary["p99"] = pct(0.99);
+  summary["p999"] = pct(0.999);
+  summary["max"] = values.back();
+  return summary;
+}
+
+folly::dynamic summarizeScrapes(ScrapeResult const& result) {
+  auto summary = summarize(result.latencyUs);
+  auto const keys = summarize(result.numKeys);
+  summary["keys_p50"] = keys.getDefault("p50", 0);
+  return summary;
+}
+
+void print(std::string_view name, folly::dynamic const& summary) {
+  fmt::print(
+      "{:<28} count={:<10} p50={:<10} p90={:<10} p99={:<10} p999={:<10} "
+      "max={}\n",
+      name,
+      summary.getDefault("count", 0).asInt(),
+      summary.getDefault("p50", 0).asInt(),
+      summary.getDefault("p90", 0).asInt(),
+      summary.getDefault("p99", 0).asInt(),
+      summary.getDefault("p999", 0).asInt(),
+      summary.getDefault("max", 0).asInt());
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  folly::Init init(&argc, &argv, true);
+
+  auto& serviceData = *ServiceData::get();
+  auto const rssBefore = getRssBytes();
+  auto const keys = registerKeys(serviceData);
+  ZipfSampler const zipf(FLAGS_keys, FLAGS_zipf_exponent);
+  auto const rssRegistered = getRssBytes();
+
+  std::atomic<bool> stop{false};
+  std::vector<WriterResult> writerResults(FLAGS_writers);
+  std::vector<Scrapes> scraperResults(FLAGS_scrapers);
+  std::vector<int64_t> publishUs;
+
+  std::vector<std::thread> threads;
+  for (auto& result : writerResults) {
+    threads.emplace_back(
+        runWriter,
+        std::cref(keys),
+        std::cref(zipf),
+        std::cref(stop),
+        std::ref(result));
+  }
+  for (auto& result : scraperResults) {
+    threads.emplace_back(
+        runScraper,
+        std::ref(serviceData),
+        std::cref(keys),
+        std::cref(stop),
+        std::ref(result));
+  }
+  threads.emplace_back(runPublisher, std::cref(stop), std::ref(publishUs));
+
+  std::this_thread::sleep_for(std::chrono::seconds(FLAGS_duration_s));
+  stop = true;
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  auto const rssAfter = getRssBytes();
+
+  uint64_t updates = 0;
+  std::vector<std::vector<int64_t>> latencyNs(size_t(UpdateType::kNumTypes));
+  for (auto const& result : writerResults) {
+    updates += result.updates;
+    for (size_t i = 0; i < latencyNs.size(); ++i) {
+      latencyNs[i].insert(
+          latencyNs[i].end(),
+          result.latencyNs[i].begin(),
+          result.latencyNs[i].end());
+    }
+  }
+  Scrapes scrapes;
+  for (auto const& result : scraperResults) {
+    for (auto [from, to] : {
+             std::pair{&result.getCounters, &scrapes.getCounters},
+             std::pair{&result.getRegexCounters, &scrapes.getRegexCounters},
+             std::pair{
+                 &result.getSelectedCounters, &scrapes.getSelectedCounters},
+         }) {
+      to->latencyUs.insert(
+          to->latencyUs.end(), from->latencyUs.begin(), from->latencyUs.end());
+      to->numKeys.insert(
+          to->numKeys.end(), from->numKeys.begin(), from->numKeys.end());
+    }
+  }
+
+  folly::dynamic results = folly::dynamic::object;
+  results["config"] = folly::dynamic::object("writers", FLAGS_writers)(
+      "scrapers", FLAGS_scrapers)("keys", FLAGS_keys)(
+      "zipf_exponent", FLAGS_zipf_exponent)("duration_s", FLAGS_duration_s)(
+      "publish_interval_ms", FLAGS_publish_interval_ms)(
+      "scrape_interval_ms", FLAGS_scrape_interval_ms);
+  results["updates_per_s"] = double(updates) / FLAGS_duration_s;
+  results["update_latency_ns"] = folly::dynamic::object;
+  for (size_t i = 0; i < latencyNs.size(); ++i) {
+    results["update_latency_ns"][kUpdateTypeNames[i]] =
+        summarize(latencyNs[i]);
+  }
+  results["scrape_latency_us"] = folly::dynamic::object(
+      "getCounters", summarizeScrapes(scrapes.getCounters))(
+      "getRegexCounters", summarizeScrapes(scrapes.getRegexCounters))(
+      "getSelectedCounters", summarizeScrapes(scrapes.getSelectedCounters));
+  results["publish_us"] = summarize(publishUs);
+  results["rss_bytes"] = folly::dynamic::object("start", rssBefore)(
+      "registered", rssRegistered)("end", rssAfter);
+  results["num_counters"] = int64_t(serviceData.getNumCounters());
+
+  fmt::print("updates/s: {:.0f}\n", results["updates_per_s"].asDouble());
+  for (size_t i = 0; i < latencyNs.size(); ++i) {
+    print(
+        fmt::format("update_ns.{}", kUpdateTypeNames[i]),
+        results["update_latency_ns"][kUpdateTypeNames[i]]);
+  }
+  for (auto const& [name, summary] : results["scrape_latency_us"].items()) {
+    print(fmt::format("scrape_us.{}", name.asString()), summary);
+  }
+  print("publish_us", results["publish_us"]);
+  fmt::print(
+      "rss: start={} registered={} end={}\n",
+      rssBefore,
+      rssRegistered,
+      rssAfter);
+
+  if (!FLAGS_json_output.empty()) {
+    CHECK(folly::writeFile(
+        folly::toPrettyJson(results), FLAGS_json_output.c_str()))
+        << "Failed to write " << FLAGS_json_output;
+  }
+  return 0;
+}
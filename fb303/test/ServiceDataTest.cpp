@@ -16,6 +16,8 @@
 
 #include "common/stats/ServiceData.h"
 
+#include <fb303/LegacyClock.h>
+#include <folly/ScopeGuard.h>
 #include <gflags/gflags.h>
 #include <gtest/gtest.h>
 
@@ -56,6 +58,150 @@ TEST_F(ServiceDataTest, getRegexCounters_rvo_example) {
   EXPECT_TRUE(data.getRegexCounters("w.+").empty());
 }
 
+TEST_F(ServiceDataTest, getRegexCounters_keys_added_after_caching) {
+  data.setCounter("wiggle", 6);
+  auto expected = map<string, int64_t>{{"wiggle", 6}};
+  EXPECT_EQ(expected, data.getRegexCounters("w.+"));
+  // added keys are pending until the next query
+  data.setCounter("waggle", 7);
+  data.setCounter("wobble", 8);
+  data.clearCounter("wobble");
+  expected = map<string, int64_t>{{"wiggle", 6}, {"waggle", 7}};
+  EXPECT_EQ(expected, data.getRegexCounters("w.+"));
+  // or until trimming
+  data.setCounter("wubble", 9);
+  data.trimRegexCache(std::chrono::seconds(3600));
+  data.clearCounter("wiggle");
+  expected = map<string, int64_t>{{"waggle", 7}, {"wubble", 9}};
+  EXPECT_EQ(expected, data.getRegexCounters("w.+"));
+}
+
+TEST_F(ServiceDataTest, getPrefixedCounters) {
+  data.setCounter("lib.a", 1);
+  data.setCounter("lib.b", 2);
+  data.setCounter("lib", 3);
+  data.setCounter("libx.a", 4);
+  data.setCounter("other.a", 5);
+  data.getDynamicCounters()->registerCallback("lib.dyn", [] { return 6; });
+  data.getDynamicCounters()->registerCallback("lib+dyn", [] { return 7; });
+  auto expected = map<string, int64_t>{
+      {"lib.a", 1},
+      {"lib.b", 2},
+      {"lib.dyn", 6},
+  };
+  EXPECT_EQ(expected, data.getPrefixedCounters("lib."));
+  EXPECT_EQ(
+      (map<string, int64_t>{{"lib+dyn", 7}}), data.getPrefixedCounters("lib+"));
+  EXPECT_EQ(7, data.getPrefixedCounters("").size());
+  EXPECT_TRUE(data.getPrefixedCounters("nope.").empty());
+
+  // the dynamic counters are matched through the regex cache, which serves
+  // the repeated prefixes
+  auto const misses = data.getRegexCacheStats("dynamic_counters").misses;
+  data.getDynamicCounters()->registerCallback("lib.new", [] { return 8; });
+  EXPECT_EQ(8, data.getPrefixedCounters("lib.").at("lib.new"));
+  auto const stats = data.getRegexCacheStats("dynamic_counters");
+  EXPECT_EQ(misses, stats.misses);
+  EXPECT_LT(0, stats.hits);
+}
+
+TEST_F(ServiceDataTest, getCountersSnapshot) {
+  data.setCounter("flat", 1);
+  data.addStatValue("requests", 3, facebook::fb303::SUM);
+  // both callbacks see the same time, however long the read takes
+  data.getDynamicCounters()->registerCallback(
+      "first", [] { return facebook::fb303::get_legacy_stats_time(); });
+  data.getDynamicCounters()->registerCallback(
+      "second", [] { return facebook::fb303::get_legacy_stats_time(); });
+
+  auto snapshot = data.getCountersSnapshot();
+  auto const time = std::chrono::system_clock::to_time_t(snapshot.time);
+  EXPECT_EQ(1, snapshot.counters.at("flat"));
+  EXPECT_EQ(3, snapshot.counters.at("requests.sum"));
+  EXPECT_EQ(3, snapshot.counters.at("requests.sum.60"));
+  EXPECT_EQ(time, snapshot.counters.at("first"));
+  EXPECT_EQ(time, snapshot.counters.at("second"));
+  EXPECT_EQ(data.getCounters().size(), snapshot.counters.size());
+}
+
+TEST_F(ServiceDataTest, incrementCounters) {
+  ServiceData::CounterHandle handle;
+  data.setCounter("existing", 10);
+  std::vector<ServiceData::CounterIncrement> increments{
+      {"existing", 1}, {"new", 2}, {"handled", 3, &handle}};
+  data.incrementCounters(folly::range(increments));
+  data.incrementCounters(folly::range(increments));
+  EXPECT_EQ(12, data.getCounter("existing"));
+  EXPECT_EQ(4, data.getCounter("new"));
+  EXPECT_EQ(6, data.getCounter("handled"));
+
+  // clearing a counter invalidates the handles
+  data.clearCounter("handled");
+  data.incrementCounters(folly::range(increments));
+  EXPECT_EQ(3, data.getCounter("handled"));
+
+  // handles are shared with the single-counter overloads
+  EXPECT_EQ(4, data.incrementCounter(handle, "handled", 1));
+  EXPECT_EQ(7, data.setCounter(handle, "handled", 7));
+  data.resetAllData();
+  EXPECT_EQ(2, data.incrementCounter(handle, "handled", 2));
+  EXPECT_EQ(2, data.getCounter("handled"));
+}
+
+TEST_F(ServiceDataTest, counterRateExport) {
+  using facebook::fb303::ScopedLegacyStatsTime;
+  data.addCounterRateExport("requests");
+  data.addCounterRateExport("requests");
+  auto rate = [&](time_t now, const char* key) {
+    ScopedLegacyStatsTime scopedTime(now);
+    return data.getCounter(key);
+  };
+
+  data.incrementCounter("requests", 100);
+  EXPECT_EQ(0, rate(1000, "requests.rate.60"));
+  data.incrementCounter("requests", 300);
+  EXPECT_EQ(10, rate(1030, "requests.rate.60"));
+  data.incrementCounter("requests", 600);
+  // 600 over the 70s since the sample at 1030; 900 over 100s
+  EXPECT_EQ(9, rate(1100, "requests.rate.60"));
+  EXPECT_EQ(9, rate(1100, "requests.rate.600"));
+
+  // a reset restarts the samples
+  data.clearCounter("requests");
+  EXPECT_EQ(0, rate(1110, "requests.rate.60"));
+  data.incrementCounter("requests", 50);
+  EXPECT_EQ(5, rate(1120, "requests.rate.600"));
+
+  data.removeCounterRateExport("requests");
+  EXPECT_FALSE(data.getCounterIfExists("requests.rate.60").has_value());
+}
+
+TEST_F(ServiceDataTest, getRegexCounters_cache_budget) {
+  gflags::FlagSaver flagSaver;
+  FLAGS_fb303_regex_cache_max_regexes = 2;
+  data.setCounter("wiggle", 6);
+  data.setCounter("waggle", 7);
+  EXPECT_EQ(2, data.getRegexCounters("w.+").size());
+  EXPECT_EQ(1, data.getRegexCounters("wi.+").size());
+  EXPECT_EQ(1, data.getRegexCounters("wa.+").size());
+  EXPECT_EQ(2, data.getRegexCounters("w.+").size());
+
+  auto stats = data.getRegexCacheStats("counters");
+  EXPECT_EQ(0, stats.hits);
+  EXPECT_EQ(4, stats.misses);
+  EXPECT_EQ(2, stats.evictions);
+  EXPECT_EQ(2, stats.regexes);
+  EXPECT_EQ(3, stats.matches);
+
+  EXPECT_EQ(2, data.getRegexCounters("w.+").size());
+  EXPECT_EQ(1, data.getRegexCacheStats("counters").hits);
+
+  data.exportRegexCacheStats();
+  EXPECT_EQ(1, data.getCounter("fb303.regex_cache.counters.hits"));
+  EXPECT_EQ(2, data.getCounter("fb303.regex_cache.counters.regexes"));
+  EXPECT_THROW(data.getRegexCacheStats("nonesuch"), std::invalid_argument);
+}
+
 TEST_F(ServiceDataTest, getExportedValue_rvo_example) {
   data.setExportedValue("wiggle", "6");
   auto expected = "6";
@@ -130,6 +276,156 @@ TEST_F(ServiceDataTest, clearCounter) {
   EXPECT_TRUE(data.getCounters().empty());
 }
 
+TEST_F(ServiceDataTest, zeroStats) {
+  using facebook::fb303::COUNT;
+  using facebook::fb303::SUM;
+  data.setCounter("counter", 12);
+  data.addStatValue("stat", 5, SUM);
+  data.addHistogram("hist", 10, 0, 100);
+  data.exportHistogram("hist", COUNT);
+  data.addHistogramValue("hist", 15);
+  auto stat = data.getStatMap()->getLockableStat("stat");
+  EXPECT_EQ(5, data.getCounter("stat.sum"));
+  EXPECT_EQ(1, data.getCounter("hist.count"));
+
+  data.zeroStats();
+  EXPECT_EQ(0, data.getCounter("counter"));
+  EXPECT_EQ(0, data.getCounter("stat.sum"));
+  EXPECT_EQ(0, data.getCounter("hist.count"));
+  EXPECT_EQ(0, stat.lock()->sum(0));
+
+  // the stats keep working after being cleared, and are cleared only once
+  stat.addValue(facebook::fb303::get_current_time(), 3);
+  data.addHistogramValue("hist", 25);
+  EXPECT_EQ(3, data.getCounter("stat.sum"));
+  EXPECT_EQ(1, data.getCounter("hist.count"));
+
+  data.zeroStats();
+  stat.addValue(facebook::fb303::get_current_time(), 4);
+  EXPECT_EQ(4, data.getCounter("stat.sum"));
+  EXPECT_EQ(0, data.getCounter("hist.count"));
+}
+
+TEST_F(ServiceDataTest, exportSelfStats) {
+  data.exportSelfStats();
+  SCOPE_EXIT {
+    facebook::fb303::detail::setSelfStatsEnabled(false);
+  };
+
+  data.setCounter("key", 1);
+  data.addStatExportType("stat", facebook::fb303::SUM);
+  EXPECT_EQ(1, data.getSelectedCounters({"key", "missing"}).size());
+  EXPECT_EQ(1, data.getRegexCounters("k.*").size());
+
+  auto const counters = data.getCounters();
+  EXPECT_EQ(0, counters.at("fb303.getCounters.calls"));
+  EXPECT_EQ(1, counters.at("fb303.getSelectedCounters.calls"));
+  EXPECT_EQ(1, counters.at("fb303.getSelectedCounters.keys"));
+  EXPECT_EQ(1, counters.at("fb303.getRegexCounters.calls"));
+  EXPECT_EQ(1, counters.at("fb303.getRegexCounters.keys"));
+  EXPECT_EQ(1, counters.at("fb303.registrations.stats"));
+  EXPECT_LT(0, counters.at("fb303.registrations.callbacks"));
+  EXPECT_LT(0, counters.at("fb303.lock.counters.acquisitions"));
+  EXPECT_EQ(
+      static_cast<int64_t>(counters.size()),
+      data.getCounter("fb303.getCounters.keys"));
+}
+
+TEST_F(ServiceDataTest, lockProfile) {
+  data.resetLockProfile();
+  data.setLockProfilingEnabled(true);
+  SCOPE_EXIT {
+    data.setLockProfilingEnabled(false);
+  };
+
+  data.setCounter("key", 1);
+  data.addStatValue("stat", 1, facebook::fb303::SUM);
+  EXPECT_EQ(1, data.getCounter("key"));
+
+  auto const profile = data.getLockProfile();
+  EXPECT_LT(0, profile.at("counters").wait.count);
+  EXPECT_EQ(
+      profile.at("counters").wait.count, profile.at("counters").hold.count);
+  EXPECT_LT(0, profile.at("stat").hold.count);
+  EXPECT_NE(std::string::npos, data.dumpLockProfile().find("callback_map"));
+
+  data.exportLockProfile();
+  EXPECT_TRUE(data.hasCounter("fb303.lock.counters.hold_ns.p99"));
+  EXPECT_LT(0, data.getCounter("fb303.lock.counters.holds"));
+
+  data.resetLockProfile();
+  EXPECT_EQ(0, data.getLockProfile().at("stat").hold.count);
+}
+
+TEST_F(ServiceDataTest, optionsSnapshot) {
+  gflags::FlagSaver flagSaver;
+  FLAGS_fb303_options_cache_ttl_ms = 3600 * 1000;
+  std::string dynamicValue = "a";
+  data.registerDynamicOption(
+      "dynamic", [&] { return dynamicValue; }, nullptr);
+  data.setOption("static", "1");
+
+  auto snapshot = data.getOptionsSnapshot();
+  auto const expected =
+      map<string, string>{{"dynamic", "a"}, {"static", "1"}};
+  EXPECT_EQ(expected, snapshot->options);
+  EXPECT_EQ(expected, data.getOptions());
+  // the getter is not called again until the options are invalidated
+  dynamicValue = "b";
+  EXPECT_EQ(snapshot, data.getOptionsSnapshot());
+  data.invalidateOptions();
+  auto const version = snapshot->version;
+  snapshot = data.getOptionsSnapshot();
+  EXPECT_EQ("b", snapshot->options.at("dynamic"));
+  EXPECT_EQ(version + 1, snapshot->version);
+
+  // no new version when nothing changed
+  data.setOption("static", "1");
+  EXPECT_EQ(snapshot->version, data.getOptionsSnapshot()->version);
+
+  data.setOption("other", "x");
+  auto delta = data.getOptionsSince(snapshot->version);
+  EXPECT_EQ(snapshot->version + 1, delta.version);
+  EXPECT_EQ((map<string, string>{{"other", "x"}}), delta.changed);
+  EXPECT_TRUE(delta.removed.empty());
+  EXPECT_EQ(3, data.getOptionsSince(0).changed.size());
+  EXPECT_TRUE(data.getOptionsSince(delta.version).changed.empty());
+
+  data.resetAllData();
+  auto const removed = data.getOptionsSince(delta.version);
+  EXPECT_TRUE(removed.changed.empty());
+  EXPECT_EQ((vector<string>{"other", "static"}), removed.removed);
+  EXPECT_FALSE(removed.full);
+  EXPECT_TRUE(data.getOptionsSince(0).full);
+}
+
+TEST_F(ServiceDataTest, optionsDeltaHistory) {
+  data.setOption("kept", "1");
+  auto const first = data.getOptionsSnapshot()->version;
+  // each round adds and removes an option, i.e. makes two versions
+  auto const rounds = ServiceData::kOptionsDeltaHistory + 1;
+  for (uint64_t i = 0; i < rounds; ++i) {
+    data.setOption("churn" + std::to_string(i), "x");
+    data.getOptionsSnapshot();
+    data.resetAllData();
+    data.setOption("kept", "1");
+    data.getOptionsSnapshot();
+  }
+
+  // the removals since first were forgotten
+  auto delta = data.getOptionsSince(first);
+  EXPECT_TRUE(delta.full);
+  EXPECT_EQ((map<string, string>{{"kept", "1"}}), delta.changed);
+  EXPECT_TRUE(delta.removed.empty());
+
+  // the recent ones were not
+  delta = data.getOptionsSince(delta.version - 2);
+  EXPECT_FALSE(delta.full);
+  EXPECT_TRUE(delta.changed.empty());
+  EXPECT_EQ(
+      (vector<string>{"churn" + std::to_string(rounds - 1)}), delta.removed);
+}
+
 TEST_F(ServiceDataTest, allowedFlags) {
   auto getflags = []() -> std::map<std::string, std::string> {
     std::map<std::string, std::string> _return;
@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fb303/ServiceDataView.h>
+
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fb303/LegacyClock.h>
+#include <gtest/gtest.h>
+
+using namespace facebook::fb303;
+
+using Counters = std::map<std::string, int64_t>;
+
+TEST(ServiceDataViewTest, Counters) {
+  ServiceData data;
+  ServiceDataView view(data, "mylib.");
+  EXPECT_EQ("mylib.", view.getPrefix());
+
+  EXPECT_EQ(1, view.incrementCounter("requests"));
+  EXPECT_EQ(3, view.incrementCounter("requests", 2));
+  EXPECT_EQ(5, view.setCounter("errors", 5));
+  EXPECT_EQ(3, data.getCounter("mylib.requests"));
+  EXPECT_EQ(5, view.getCounter("errors"));
+  EXPECT_FALSE(view.getCounterIfExists("missing").has_value());
+  EXPECT_THROW(view.getCounter("missing"), std::invalid_argument);
+
+  data.setCounter("mylibx.other", 1);
+  data.setCounter("other", 2);
+  data.getDynamicCounters()->registerCallback("mylib.dyn", [] { return 7; });
+  EXPECT_EQ(
+      (Counters{{"dyn", 7}, {"errors", 5}, {"requests", 3}}),
+      view.getCounters());
+
+  view.clearCounter("errors");
+  EXPECT_FALSE(data.getCounterIfExists("mylib.errors").has_value());
+  // cleared counters are recreated on the next use
+  EXPECT_EQ(1, view.incrementCounter("errors"));
+  data.resetAllData();
+  EXPECT_EQ(2, view.incrementCounter("errors", 2));
+  EXPECT_EQ(2, data.getCounter("mylib.errors"));
+}
+
+TEST(ServiceDataViewTest, SubView) {
+  ServiceData data;
+  ServiceDataView view(data, "mylib.");
+  auto sub = view.subView("cache.");
+  EXPECT_EQ("mylib.cache.", sub.getPrefix());
+  sub.incrementCounter("hits");
+  EXPECT_EQ(1, data.getCounter("mylib.cache.hits"));
+  EXPECT_EQ((Counters{{"cache.hits", 1}}), view.getCounters());
+
+  // copies share the cache
+  auto copy = view;
+  copy.incrementCounter("requests");
+  EXPECT_EQ(1, view.getCounter("requests"));
+}
+
+TEST(ServiceDataViewTest, StatsAndHistograms) {
+  ServiceData data;
+  ServiceDataView view(data, "mylib.");
+
+  view.addStatValue("latency", 7, SUM);
+  view.addStatValue("latency", 3);
+  EXPECT_EQ(10, data.getCounter("mylib.latency.sum"));
+  view.addStatExportType("latency", COUNT);
+  EXPECT_EQ(2, data.getCounter("mylib.latency.count"));
+
+  // values for histograms which do not exist yet are dropped
+  view.addHistogramValue("size", 5);
+  EXPECT_TRUE(view.addHistogram("size", ExportedHistogram(10, 0, 100)));
+  view.addHistogramValue("size", 5);
+  view.addHistogramValue("size", 15);
+  auto hist = data.getHistogramMap()->getHistogram("mylib.size");
+  ASSERT_FALSE(hist.isNull());
+  hist->update(get_legacy_stats_time());
+  EXPECT_EQ(2, hist->count(0));
+
+  view.setExportedValue("version", "1.2");
+  EXPECT_EQ("1.2", data.getExportedValue("mylib.version"));
+  EXPECT_EQ("1.2", view.getExportedValue("version"));
+}
+
+TEST(ServiceDataViewTest, Concurrency) {
+  ServiceData data;
+  ServiceDataView view(data, "mylib.");
+  constexpr int kThreads = 4;
+  constexpr int kIters = 1000;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&] {
+      for (int i = 0; i < kIters; ++i) {
+        view.incrementCounter(std::to_string(i % 10));
+        view.addStatValue("stat", 1, SUM);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_EQ(
+        kThreads * kIters / 10, data.getCounter("mylib." + std::to_string(i)));
+  }
+  EXPECT_EQ(kThreads * kIters, data.getCounter("mylib.stat.sum"));
+}
@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fb303/SharedCounterArena.h>
+
+#include <string>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <fb303/LegacyClock.h>
+#include <fb303/ServiceData.h>
+#include <gtest/gtest.h>
+
+using namespace facebook::fb303;
+
+namespace {
+// Runs fn in a forked child, which exits without detaching, as if it crashed.
+template <typename F>
+void runInChild(F&& fn) {
+  auto const pid = fork();
+  ASSERT_NE(-1, pid);
+  if (pid == 0) {
+    fn();
+    _exit(0);
+  }
+  int status = 0;
+  ASSERT_EQ(pid, waitpid(pid, &status, 0));
+  ASSERT_TRUE(WIFEXITED(status));
+}
+} // namespace
+
+TEST(SharedCounterArenaTest, Increment) {
+  auto arena = SharedCounterArena::create(16, 4);
+  EXPECT_EQ(1, arena->getNumAttachedProcesses());
+  arena->incrementCounter("requests", 2);
+  auto counter = arena->getCounter("requests");
+  counter.increment();
+  arena->incrementCounter("errors");
+
+  EXPECT_EQ(3, arena->getTotal("requests"));
+  EXPECT_FALSE(arena->getTotal("missing").has_value());
+
+  std::map<std::string, int64_t> counters{{"errors", 42}};
+  arena->getCounters(counters);
+  EXPECT_EQ(3, counters.at("requests"));
+  // keys already present are left alone
+  EXPECT_EQ(42, counters.at("errors"));
+
+  EXPECT_THROW(
+      arena->incrementCounter(
+          std::string(SharedCounterArena::kMaxKeyLength + 1, 'x')),
+      std::invalid_argument);
+  EXPECT_THROW(SharedCounterArena::create(0, 1), std::invalid_argument);
+}
+
+TEST(SharedCounterArenaTest, Full) {
+  auto arena = SharedCounterArena::create(2, 1);
+  arena->incrementCounter("a");
+  arena->incrementCounter("b");
+  EXPECT_THROW(arena->incrementCounter("c"), std::length_error);
+  arena->incrementCounter("a");
+  arena->detach();
+  EXPECT_EQ(0, arena->getNumAttachedProcesses());
+  arena->attach();
+  EXPECT_THROW(arena->attach(), std::length_error);
+
+  std::map<std::string, int64_t> counters;
+  arena->getCounters(counters);
+  EXPECT_EQ(2, counters.at("a"));
+  EXPECT_EQ(1, counters.at("b"));
+  EXPECT_EQ(0, counters.count("c"));
+}
+
+TEST(SharedCounterArenaTest, ForkedProcesses) {
+  auto arena = SharedCounterArena::create(16, 4);
+  arena->incrementCounter("requests", 1);
+
+  runInChild([&] {
+    arena->attach();
+    arena->incrementCounter("requests", 10);
+    arena->incrementCounter("child_only", 5);
+  });
+  runInChild([&] {
+    // without attaching, a child adds to its parent's slot
+    arena->incrementCounter("requests", 100);
+  });
+
+  std::map<std::string, int64_t> counters;
+  arena->getCounters(counters);
+  EXPECT_EQ(111, counters.at("requests"));
+  EXPECT_EQ(5, counters.at("child_only"));
+
+  // the slot of the first child is freed, and its counts are kept
+  EXPECT_EQ(2, arena->getNumAttachedProcesses());
+  EXPECT_EQ(1, arena->reapDeadProcesses());
+  EXPECT_EQ(0, arena->reapDeadProcesses());
+  EXPECT_EQ(1, arena->getNumAttachedProcesses());
+  counters.clear();
+  arena->getCounters(counters);
+  EXPECT_EQ(111, counters.at("requests"));
+  EXPECT_EQ(5, counters.at("child_only"));
+}
+
+TEST(SharedCounterArenaTest, ServiceData) {
+  ServiceData data;
+  auto arena = SharedCounterArena::create(16, 4);
+  data.setSharedCounters(arena);
+  EXPECT_EQ(arena, data.getSharedCounters());
+  data.setCounter("local", 1);
+
+  runInChild([&] {
+    arena->attach();
+    arena->incrementCounter("shared", 3);
+  });
+  arena->incrementCounter("shared", 4);
+
+  std::map<std::string, int64_t> counters;
+  data.getCounters(counters);
+  EXPECT_EQ(1, counters.at("local"));
+  EXPECT_EQ(7, counters.at("shared"));
+
+  std::map<std::string, int64_t> visited;
+  data.forEachCounterValue(
+      [&](const std::string& name, int64_t value) { visited[name] = value; });
+  EXPECT_EQ(7, visited.at("shared"));
+
+  {
+    ScopedLegacyStatsTime scopedTime(1000);
+    data.addCounterRateExport("shared");
+    EXPECT_EQ(0, data.getCounter("shared.rate.60"));
+  }
+  arena->incrementCounter("shared", 600);
+  {
+    ScopedLegacyStatsTime scopedTime(1060);
+    EXPECT_EQ(10, data.getCounter("shared.rate.60"));
+  }
+
+  data.setSharedCounters(nullptr);
+  counters.clear();
+  data.getCounters(counters);
+  EXPECT_EQ(0, counters.count("shared"));
+}
@@ -0,0 +1,243 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+
+Measures the memory cost of registering stats with ServiceData, per stat type
+and export combination, so that memory budgets can be based on numbers and
+regressions caught.
+
+For each scenario and key count, a fresh ServiceData registers that many
+objects, and the growth of the allocator's allocated bytes and of the resident
+set size is reported per object:
+
+  stat_memory_benchmark --key_counts=1000,10000,100000,1000000
+
+Allocated bytes come from jemalloc when it is the allocator, and from glibc's
+mallinfo2() otherwise; they are the reliable measure. The resident set size is
+indicative only, since later runs reuse the pages freed by earlier ones.
+
+The "+regex" scenarios additionally run one matching getRegexCounters() after
+registration, so that they include the regex-match-cache entries of the
+registered keys.
+
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <malloc.h>
+#include <unistd.h>
+
+#include <fb303/ServiceData.h>
+#include <fmt/core.h>
+#include <folly/Conv.h>
+#include <folly/FileUtil.h>
+#include <folly/String.h>
+#include <folly/init/Init.h>
+#include <folly/memory/MallctlHelper.h>
+#include <folly/memory/Malloc.h>
+#include <gflags/gflags.h>
+
+using namespace facebook::fb303;
+
+DEFINE_string(
+    key_counts,
+    "1000,10000,100000,1000000",
+    "Comma-separated numbers of objects to register per scenario");
+DEFINE_string(
+    scenarios,
+    "",
+    "Comma-separated scenarios to run; all of them if empty");
+
+namespace {
+
+int64_t getAllocatedBytes() {
+  if (folly::usingJEMalloc()) {
+    uint64_t epoch = 1;
+    folly::mallctlReadWrite("epoch", &epoch, epoch);
+    size_t allocated = 0;
+    folly::mallctlRead("stats.allocated", &allocated);
+    return int64_t(allocated);
+  }
+#if defined(__GLIBC__)
+#if __GLIBC_PREREQ(2, 33)
+  return int64_t(mallinfo2().uordblks);
+#endif
+#endif
+  return 0;
+}
+
+int64_t getRssBytes() {
+  // statm holds "size resident shared ..." in pages.
+  std::string statm;
+  if (!folly::readFile("/proc/self/statm", statm)) {
+    return 0;
+  }
+  std::vector<folly::StringPiece> fields;
+  folly::split(' ', statm, fields);
+  if (fields.size() < 2) {
+    return 0;
+  }
+  auto const pages = folly::tryTo<int64_t>(fields[1]);
+  return pages.hasValue() ? *pages * sysconf(_SC_PAGESIZE) : 0;
+}
+
+std::string key(std::string_view prefix, size_t i) {
+  return fmt::format("memory.{}.{}", prefix, i);
+}
+
+constexpr double kQuantiles[] = {0.5, 0.95, 0.99};
+
+struct Scenario {
+  std::string_view name;
+  std::function<void(ServiceData&, size_t)> registerOne;
+  // A regex matching the registered keys, to populate the regex-match-cache.
+  std::string_view regex;
+};
+
+std::vector<Scenario> const& getScenarios() {
+  static auto const* scenarios = new std::vector<Scenario>{
+      {"counter",
+       [](ServiceData& sd, size_t i) { sd.setCounter(key("counter", i), 1); },
+       {}},
+      {"counter+regex",
+       [](ServiceData& sd, size_t i) { sd.setCounter(key("counter", i), 1); },
+       "memory\\.counter\\..*[0-9]"},
+      {"dynamic_counter",
+       [](ServiceData& sd, size_t i) {
+         sd.getDynamicCounters()->registerCallback(
+             key("dynamic", i), [] { return int64_t(1); });
+       },
+       {}},
+      {"timeseries.sum",
+       [](ServiceData& sd, size_t i) {
+         sd.addStatExportType(key("ts", i), SUM);
+       },
+       {}},
+      {"timeseries.sum_count_avg_rate",
+       [](ServiceData& sd, size_t i) {
+         sd.getStatMap()->exportStat(
+             key("ts", i), ExportTypeConsts::kSumCountAvgRate);
+       },
+       {}},
+      {"timeseries.sum_count_avg_rate+regex",
+       [](ServiceData& sd, size_t i) {
+         sd.getStatMap()->exportStat(
+             key("ts", i), ExportTypeConsts::kSumCountAvgRate);
+       },
+       "memory\\.ts\\..*\\.sum\\.[0-9]+"},
+      {"histogram",
+       [](ServiceData& sd, size_t i) {
+         sd.addHistogram(key("hist", i), 100, 0, 10000);
+       },
+       {}},
+      {"histogram.p50_p99_avg",
+       [](ServiceData& sd, size_t i) {
+         auto const name = key("hist", i);
+         sd.addHistogram(name, 100, 0, 10000);
+         sd.exportHistogram(name, 50, 99, AVG);
+       },
+       {}},
+      {"quantile.3_windows",
+       [](ServiceData& sd, size_t i) {
+         sd.getQuantileStat(
+             key("qstat", i),
+             ExportTypeConsts::kSumCountAvg,
+             kQuantiles,
+             SlidingWindowPeriodConsts::kOneMinTenMinHour);
+       },
+       {}},
+  };
+  return *scenarios;
+}
+
+struct Result {
+  double allocatedPerObject;
+  double rssPerObject;
+  double registerNsPerObject;
+};
+
+Result measure(Scenario const& scenario, size_t count) {
+  auto const allocatedBefore = getAllocatedBytes();
+  auto const rssBefore = getRssBytes();
+  auto const start = std::chrono::steady_clock::now();
+
+  auto serviceData = std::make_unique<ServiceData>();
+  for (size_t i = 0; i < count; ++i) {
+    scenario.registerOne(*serviceData, i);
+  }
+  auto const elapsed = std::chrono::steady_clock::now() - start;
+  if (!scenario.regex.empty()) {
+    serviceData->getRegexCounters(std::string(scenario.regex));
+    serviceData->trimRegexCache(std::chrono::hours(1));
+  }
+
+  auto const allocated = getAllocatedBytes() - allocatedBefore;
+  auto const rss = getRssBytes() - rssBefore;
+  return {
+      double(allocated) / count,
+      double(rss) / count,
+      double(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed)
+                 .count()) /
+          count,
+  };
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  folly::Init init(&argc, &argv, true);
+
+  std::vector<size_t> counts;
+  folly::splitTo<size_t>(
+      ',', FLAGS_key_counts, std::back_inserter(counts), true);
+  std::vector<std::string> selected;
+  folly::split(',', FLAGS_scenarios, selected, /* ignoreEmpty = */ true);
+
+  fmt::print(
+      "{:<40}{:>10}{:>16}{:>16}{:>16}\n",
+      "scenario",
+      "objects",
+      "alloc_B/obj",
+      "rss_B/obj",
+      "register_ns/obj");
+  for (auto const& scenario : getScenarios()) {
+    if (!selected.empty() &&
+        std::find(selected.begin(), selected.end(), scenario.name) ==
+            selected.end()) {
+      continue;
+    }
+    for (auto const count : counts) {
+      auto const result = measure(scenario, count);
+      fmt::print(
+          "{:<40}{:>10}{:>16.1f}{:>16.1f}{:>16.1f}\n",
+          scenario.name,
+          count,
+          result.allocatedPerObject,
+          result.rssPerObject,
+          result.registerNsPerObject);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+
+Measures the time-to-ready of a service registering many stats at startup, i.e.
+the time from a fresh ServiceData to all of the stats being registered and the
+first getCounters() having returned, registering the stats one at a time and in
+bulk:
+
+  stat_registration_benchmark --stat_counts=100000,500000,1000000
+
+The "timeseries" scenarios export each stat as sum, count, avg and rate, which
+is 16 counters per stat with the default levels; the "dynamic_counter"
+scenarios register one callback per stat.
+
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <fb303/ServiceData.h>
+#include <fmt/core.h>
+#include <folly/String.h>
+#include <folly/init/Init.h>
+#include <gflags/gflags.h>
+
+using namespace facebook::fb303;
+
+DEFINE_string(
+    stat_counts,
+    "100000,500000,1000000",
+    "Comma-separated numbers of stats to register per scenario");
+DEFINE_string(
+    scenarios,
+    "",
+    "Comma-separated scenarios to run; all of them if empty");
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Scenario {
+  std::string_view name;
+  std::function<void(ServiceData&, std::vector<std::string> const&)>
+      registerAll;
+};
+
+std::vector<Scenario> const& getScenarios() {
+  static auto const* scenarios = new std::vector<Scenario>{
+      {"timeseries.per_stat",
+       [](ServiceData& sd, std::vector<std::string> const& names) {
+         for (auto const& name : names) {
+           sd.getStatMap()->exportStat(
+               name, ExportTypeConsts::kSumCountAvgRate);
+         }
+       }},
+      {"timeseries.bulk",
+       [](ServiceData& sd, std::vector<std::string> const& names) {
+         sd.addStatExportTypes(
+             folly::range(names),
+             folly::range(ExportTypeConsts::kSumCountAvgRate));
+       }},
+      {"dynamic_counter.per_stat",
+       [](ServiceData& sd, std::vector<std::string> const& names) {
+         for (auto const& name : names) {
+           sd.getDynamicCounters()->registerCallback(
+               name, [] { return int64_t(1); });
+         }
+       }},
+      {"dynamic_counter.bulk",
+       [](ServiceData& sd, std::vector<std::string> const& names) {
+         std::vector<std::pair<std::string, DynamicCounters::Callback>>
+             callbacks;
+         callbacks.reserve(names.size());
+         for (auto const& name : names) {
+           callbacks.emplace_back(name, [] { return int64_t(1); });
+         }
+         sd.getDynamicCounters()->registerCallbacks(std::move(callbacks));
+       }},
+  };
+  return *scenarios;
+}
+
+struct Result {
+  double registerMs;
+  double firstGetMs;
+  size_t numCounters;
+};
+
+Result measure(Scenario const& scenario, size_t count) {
+  std::vector<std::string> names;
+  names.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    names.push_back(fmt::format("startup.{}.stat_{}", i % 1000, i));
+  }
+
+  ServiceData serviceData;
+  auto const start = Clock::now();
+  scenario.registerAll(serviceData, names);
+  auto const registered = Clock::now();
+  std::map<std::string, int64_t> counters;
+  serviceData.getCounters(counters);
+  auto const ready = Clock::now();
+
+  using Ms = std::chrono::duration<double, std::milli>;
+  return {
+      Ms(registered - start).count(),
+      Ms(ready - registered).count(),
+      counters.size(),
+  };
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  folly::Init init(&argc, &argv, true);
+
+  std::vector<size_t> counts;
+  folly::splitTo<size_t>(
+      ',', FLAGS_stat_counts, std::back_inserter(counts), true);
+  std::vector<std::string> selected;
+  folly::split(',', FLAGS_scenarios, selected, /* ignoreEmpty = */ true);
+
+  fmt::print(
+      "{:<28}{:>10}{:>12}{:>16}{:>16}{:>16}\n",
+      "scenario",
+      "stats",
+      "counters",
+      "register_ms",
+      "first_get_ms",
+      "ns/stat");
+  for (auto const& scenario : getScenarios()) {
+    if (!selected.empty() &&
+        std::find(selected.begin(), selected.end(), scenario.name) ==
+            selected.end()) {
+      continue;
+    }
+    for (auto const count : counts) {
+      auto const result = measure(scenario, count);
+      fmt::print(
+          "{:<28}{:>10}{:>12}{:>16.1f}{:>16.1f}{:>16.1f}\n",
+          scenario.name,
+          count,
+          result.numCounters,
+          result.registerMs,
+          result.firstGetMs,
+          (result.registerMs + result.firstGetMs) * 1e6 / count);
+    }
+  }
+  return 0;
+}
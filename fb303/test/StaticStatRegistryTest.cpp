@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fb303/StaticStatRegistry.h>
+
+#include <thread>
+#include <vector>
+
+#include <fb303/ThreadCachedServiceData.h>
+#include <gtest/gtest.h>
+
+using namespace facebook::fb303;
+
+DEFINE_timeseries(static_stat_registry_test, SUM, COUNT);
+
+TEST(StaticStatRegistryTest, RegisterTimeseries) {
+  StaticStatRegistry registry;
+  EXPECT_EQ(0, registry.registerTimeseries("a"));
+  EXPECT_EQ(1, registry.registerTimeseries("b"));
+  EXPECT_EQ(0, registry.registerTimeseries("a"));
+  EXPECT_EQ(2, registry.size());
+  EXPECT_EQ("b", registry.getKey(1));
+}
+
+TEST(StaticStatRegistryTest, Publish) {
+  ServiceData data;
+  StaticStatRegistry registry;
+  std::vector<uint32_t> indices;
+  // enough stats to span several chunks
+  for (size_t i = 0; i < StaticStatRegistry::kChunkSize * 2 + 1; ++i) {
+    auto const key = "stat" + std::to_string(i);
+    data.addStatExportType(key, SUM);
+    data.addStatExportType(key, COUNT);
+    indices.push_back(registry.registerTimeseries(key));
+  }
+  auto const last = indices.back();
+
+  registry.addValue(indices[0], 5);
+  registry.addValue(last, 7);
+  registry.addValueAggregated(last, 10, 3);
+  registry.publish(data);
+  EXPECT_EQ(5, data.getCounter("stat0.sum"));
+  EXPECT_EQ(1, data.getCounter("stat0.count"));
+  auto const lastKey = registry.getKey(last);
+  EXPECT_EQ(17, data.getCounter(lastKey + ".sum"));
+  EXPECT_EQ(4, data.getCounter(lastKey + ".count"));
+  EXPECT_EQ(0, data.getCounter("stat1.count"));
+
+  // only the difference since the previous publish is added
+  registry.addValue(indices[0], 1);
+  registry.publish(data);
+  registry.publish(data);
+  EXPECT_EQ(6, data.getCounter("stat0.sum"));
+  EXPECT_EQ(2, data.getCounter("stat0.count"));
+  EXPECT_EQ(17, data.getCounter(lastKey + ".sum"));
+}
+
+TEST(StaticStatRegistryTest, Threads) {
+  ServiceData data;
+  StaticStatRegistry registry;
+  data.addStatExportType("hits", SUM);
+  auto const index = registry.registerTimeseries("hits");
+
+  constexpr int kThreads = 4;
+  constexpr int kIters = 10000;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&] {
+      for (int i = 0; i < kIters; ++i) {
+        registry.addValue(index, 1);
+        if (i % 1000 == 0) {
+          registry.publish(data);
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  // the exited threads left what they accumulated for the next publish
+  registry.publish(data);
+  EXPECT_EQ(kThreads * kIters, data.getCounter("hits.sum"));
+}
+
+TEST(StaticStatRegistryTest, ReuseIndices) {
+  ServiceData data;
+  StaticStatRegistry registry;
+  data.addStatExportType("old", SUM);
+  data.addStatExportType("new", SUM);
+  auto const index = registry.registerTimeseries("old");
+  EXPECT_EQ(index, registry.registerTimeseries("old"));
+  registry.addValue(index, 5);
+  registry.unregisterTimeseries(index);
+  registry.unregisterTimeseries(index);
+  // not reused until a publish collected its slots
+  EXPECT_NE(index, registry.registerTimeseries("other"));
+
+  registry.publish(data);
+  EXPECT_EQ(5, data.getCounter("old.sum"));
+  EXPECT_EQ(index, registry.registerTimeseries("new"));
+  EXPECT_EQ("new", registry.getKey(index));
+  registry.addValue(index, 2);
+  registry.publish(data);
+  EXPECT_EQ(5, data.getCounter("old.sum"));
+  EXPECT_EQ(2, data.getCounter("new.sum"));
+}
+
+TEST(StaticStatRegistryTest, Full) {
+  ServiceData data;
+  StaticStatRegistry registry;
+  for (size_t i = 0; i < StaticStatRegistry::kMaxStats; ++i) {
+    registry.registerTimeseries("stat" + std::to_string(i));
+  }
+  EXPECT_EQ(
+      StaticStatRegistry::kNoIndex, registry.registerTimeseries("one_more"));
+
+  registry.unregisterTimeseries(0);
+  registry.publish(data);
+  EXPECT_EQ(0, registry.registerTimeseries("one_more"));
+}
+
+TEST(StaticStatRegistryTest, TimeseriesWrapper) {
+  auto& tcData = *ThreadCachedServiceData::get();
+  std::thread([] {
+    STATS_static_stat_registry_test.add(3);
+    STATS_static_stat_registry_test.addAggregated(4, 2);
+  }).join();
+  tcData.publishStats();
+  EXPECT_EQ(7, fbData->getCounter("static_stat_registry_test.sum"));
+  EXPECT_EQ(3, fbData->getCounter("static_stat_registry_test.count"));
+}
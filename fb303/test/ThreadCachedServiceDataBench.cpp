@@ -16,6 +16,10 @@
 
 #include <fb303/ThreadCachedServiceData.h>
 
+#include <memory>
+#include <vector>
+
+#include <fmt/core.h>
 #include <folly/Benchmark.h>
 #include <folly/init/Init.h>
 
@@ -68,6 +72,65 @@ BENCHMARK(FormattedKeyHolderOld, iters) {
   });
 }
 
+using namespace facebook::fb303;
+
+DEFINE_timeseries(static_timeseries_bench, SUM);
+
+// The per-thread TLTimeseries that DEFINE_timeseries used before the
+// StaticStatRegistry.
+BENCHMARK(TimeseriesAddThreadLocalStats, iters) {
+  folly::BenchmarkSuspender braces;
+  auto timeseries =
+      ThreadCachedServiceData::getStatsThreadLocal()->getTimeseriesSafe(
+          "tl_timeseries_bench");
+  braces.dismissing([&] {
+    while (iters--) {
+      timeseries->addValue(1);
+    }
+  });
+}
+
+BENCHMARK_RELATIVE(TimeseriesAddStaticRegistry, iters) {
+  while (iters--) {
+    STATS_static_timeseries_bench.add(1);
+  }
+}
+
+BENCHMARK_DRAW_LINE();
+
+// Publishes 10000 timeseries, each updated by one thread.
+BENCHMARK(PublishThreadLocalStats, iters) {
+  folly::BenchmarkSuspender braces;
+  auto& local = ThreadCachedServiceData::getStatsThreadLocal();
+  std::vector<std::shared_ptr<ThreadCachedServiceData::TLTimeseries>> stats;
+  for (int i = 0; i < 10000; ++i) {
+    stats.push_back(
+        local->getTimeseriesSafe(fmt::format("tl_publish_bench.{}", i)));
+  }
+  while (iters--) {
+    for (auto& stat : stats) {
+      stat->addValue(1);
+    }
+    braces.dismissing([&] { local->aggregate(); });
+  }
+}
+
+BENCHMARK_RELATIVE(PublishStaticRegistry, iters) {
+  folly::BenchmarkSuspender braces;
+  auto& registry = StaticStatRegistry::get();
+  std::vector<uint32_t> indices;
+  for (int i = 0; i < 10000; ++i) {
+    indices.push_back(
+        registry.registerTimeseries(fmt::format("static_publish_bench.{}", i)));
+  }
+  while (iters--) {
+    for (auto index : indices) {
+      registry.addValue(index, 1);
+    }
+    braces.dismissing([&] { registry.publish(*ServiceData::get()); });
+  }
+}
+
 int main(int argc, char** argv) {
   folly::Init init(&argc, &argv);
   folly::runBenchmarks();
@@ -714,3 +714,71 @@ TEST(ThreadLocalStats, StatLifecycle) {
   // After stat is destroyed, aggregate should still work
   EXPECT_EQ(0, tlstats.aggregate());
 }
+
+// Test that counters are re-resolved after their global counter is cleared
+TEST(ThreadLocalStats, CounterHandleAfterClear) {
+  ServiceData data;
+  ThreadLocalStatsT<TLStatsThreadSafe> tlstats(&data);
+  TLCounterT<TLStatsThreadSafe> a(&tlstats, "a");
+  TLCounterT<TLStatsThreadSafe> b(&tlstats, "b");
+
+  a.incrementValue(1);
+  b.incrementValue(2);
+  tlstats.aggregate();
+  a.incrementValue(3);
+  tlstats.aggregate();
+  EXPECT_EQ(4, data.getCounter("a"));
+  EXPECT_EQ(2, data.getCounter("b"));
+
+  data.clearCounter("a");
+  a.incrementValue(5);
+  b.incrementValue(6);
+  tlstats.aggregate();
+  EXPECT_EQ(5, data.getCounter("a"));
+  EXPECT_EQ(8, data.getCounter("b"));
+
+  data.resetAllData();
+  a.incrementValue(7);
+  a.aggregate();
+  EXPECT_EQ(7, data.getCounter("a"));
+  EXPECT_FALSE(data.getCounterIfExists("b").has_value());
+}
+
+// Test that a TLMultiStat fans its values out to all of its sinks
+TEST(ThreadLocalStats, MultiStat) {
+  ServiceData data;
+  ThreadLocalStatsT<TLStatsThreadSafe> tlstats(&data);
+  data.addStatExportType("multi", SUM);
+  data.addStatExportType("multi.hourly", AVG);
+  data.addHistogram("multi.hist", 10, 0, 100);
+  data.exportHistogram("multi.hist", COUNT);
+  data.addHistogram("multi.coarse", 50, 0, 100);
+  data.exportHistogram("multi.coarse", SUM);
+
+  auto statMap = data.getStatMap();
+  auto histMap = data.getHistogramMap();
+  TLMultiStatT<TLStatsThreadSafe> stat(
+      &tlstats,
+      "multi",
+      {statMap->getLockableStat("multi"),
+       statMap->getLockableStat("multi.hourly")},
+      {histMap->getLockableHistogram("multi.hist"),
+       histMap->getLockableHistogram("multi.coarse")});
+
+  stat.addValue(5);
+  stat.addValue(15);
+  stat.addRepeatedValue(90, 2);
+  tlstats.aggregate();
+  EXPECT_EQ(200, data.getCounter("multi.sum"));
+  EXPECT_EQ(50, data.getCounter("multi.hourly.avg"));
+  EXPECT_EQ(4, data.getCounter("multi.hist.count"));
+  // the coarse histogram gets the means of the buckets of the fine one
+  EXPECT_EQ(200, data.getCounter("multi.coarse.sum"));
+
+  // without histogram sinks, only the count and sum are kept
+  TLMultiStatT<TLStatsThreadSafe> plain(
+      &tlstats, "plain", {statMap->getLockableStat("multi")}, {});
+  plain.addValue(7);
+  tlstats.aggregate();
+  EXPECT_EQ(207, data.getCounter("multi.sum"));
+}